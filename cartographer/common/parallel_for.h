@@ -0,0 +1,71 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_COMMON_PARALLEL_FOR_H_
+#define CARTOGRAPHER_COMMON_PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace cartographer {
+namespace common {
+
+// Calls 'function(i)' for all i in [0, 'num_items') on up to 'num_threads'
+// threads, including the calling thread. The threads take the items one at a
+// time in increasing order, so the calls for lower items start first.
+//
+// The threads are started for this call only. Unlike ThreadPool, this is meant
+// for splitting up a single computation that the caller waits for.
+template <typename Function>
+void ParallelFor(const int num_items, const int num_threads,
+                 const Function& function) {
+  std::atomic<int> next_item(0);
+  const auto worker = [&]() {
+    for (int i = next_item.fetch_add(1); i < num_items;
+         i = next_item.fetch_add(1)) {
+      function(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < std::min(num_threads, num_items); ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+// Calls 'function(begin, end)' for consecutive ranges covering
+// [0, 'num_items') on up to 'num_threads' threads, including the calling
+// thread. Each thread gets one range of at least 'min_range_size' items, unless
+// there are fewer items in total.
+template <typename Function>
+void ParallelForRanges(const int num_items, const int num_threads,
+                       const int min_range_size, const Function& function) {
+  const int num_ranges =
+      std::max(1, std::min(num_threads, num_items / min_range_size));
+  ParallelFor(num_ranges, num_ranges, [&](const int i) {
+    function(num_items * i / num_ranges, num_items * (i + 1) / num_ranges);
+  });
+}
+
+}  // namespace common
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_COMMON_PARALLEL_FOR_H_
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer/common/parallel_for.h"
+
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace common {
+namespace {
+
+TEST(ParallelForTest, CallsFunctionForEveryItemOnce) {
+  for (const int num_threads : {1, 3, 8}) {
+    for (const int num_items : {0, 1, 5, 100}) {
+      std::vector<int> num_calls(num_items, 0);
+      ParallelFor(num_items, num_threads, [&](const int i) { ++num_calls[i]; });
+      EXPECT_EQ(std::vector<int>(num_items, 1), num_calls);
+    }
+  }
+}
+
+TEST(ParallelForTest, RangesCoverEveryItemOnce) {
+  for (const int num_threads : {1, 3, 8}) {
+    for (const int num_items : {0, 1, 10, 64, 1000}) {
+      std::vector<int> num_calls(num_items, 0);
+      ParallelForRanges(num_items, num_threads, 64 /* min_range_size */,
+                        [&](const int begin, const int end) {
+                          EXPECT_LE(begin, end);
+                          for (int i = begin; i != end; ++i) {
+                            ++num_calls[i];
+                          }
+                        });
+      EXPECT_EQ(std::vector<int>(num_items, 1), num_calls);
+    }
+  }
+}
+
+TEST(ParallelForTest, RangesHaveMinimumSize) {
+  std::atomic<int> num_ranges(0);
+  ParallelForRanges(200, 8, 64 /* min_range_size */,
+                    [&num_ranges](const int begin, const int end) {
+                      EXPECT_GE(end - begin, 64);
+                      ++num_ranges;
+                    });
+  EXPECT_EQ(3, num_ranges);
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace cartographer
@@ -41,6 +41,10 @@ proto::ConstraintBuilderOptions CreateConstraintBuilderOptions(
   options.set_lower_covariance_eigenvalue_bound(
       parameter_dictionary->GetDouble("lower_covariance_eigenvalue_bound"));
   options.set_log_matches(parameter_dictionary->GetBool("log_matches"));
+  options.set_precomputation_grid_cache_memory_in_mb(
+      parameter_dictionary->GetInt("precomputation_grid_cache_memory_in_mb"));
+  options.set_precomputation_grid_directory(
+      parameter_dictionary->GetString("precomputation_grid_directory"));
   *options.mutable_fast_correlative_scan_matcher_options() =
       mapping_2d::scan_matching::CreateFastCorrelativeScanMatcherOptions(
           parameter_dictionary->GetDictionary("fast_correlative_scan_matcher")
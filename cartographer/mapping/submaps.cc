@@ -16,6 +16,7 @@
 
 #include "../mapping/submaps.h"
 
+#include <string>
 #include <vector>
 
 #include "../common/port.h"
@@ -68,6 +69,97 @@ std::vector<int> Submaps::insertion_indices() const
   return {size() - 1};
 }
 
+void Submaps::SubmapQueryToProto(
+    const proto::SubmapQuery::Request& request,
+    const std::vector<mapping::TrajectoryNode>& trajectory_nodes,
+    const transform::Rigid3d& global_submap_pose,
+    proto::SubmapQuery::Response* const response)
+{
+  const int index = request.submap_id();
+  if (index < 0 || index >= size())
+  {
+    response->set_error_message("Requested submap " + std::to_string(index) +
+                                " does not exist.");
+    return;
+  }
+  if (request.has_grid_version())
+  {
+    SubmapDeltaToProto(index, request.grid_version(), trajectory_nodes,
+                       global_submap_pose, response);
+  }
+  else
+  {
+    SubmapToProto(index, trajectory_nodes, global_submap_pose, response);
+  }
+  // Same version as in 'SubmapList', i.e. the number of inserted range data.
+  const Submap* const submap = Get(index);
+  response->set_submap_id(index);
+  response->set_submap_version(submap->end_laser_fan_index -
+                               submap->begin_laser_fan_index);
+}
+
+void Submaps::SubmapDeltaToProto(
+    const int index, const int grid_version,
+    const std::vector<mapping::TrajectoryNode>& trajectory_nodes,
+    const transform::Rigid3d& global_submap_pose,
+    proto::SubmapQuery::Response* const response)
+{
+  SubmapToProto(index, trajectory_nodes, global_submap_pose, response);
+}
+
+namespace {
+
+// Appends the value and alpha of the cell at 'xy_index' to 'cells'.
+void AppendCell(const mapping_2d::ProbabilityGrid& probability_grid,
+                const Eigen::Array2i& xy_index, string* const cells)
+{
+  if (probability_grid.IsKnown(xy_index))
+  {
+    // We would like to add 'delta' but this is not possible using a value and
+    // alpha. We use premultiplied alpha, so when 'delta' is positive we can
+    // add it by setting 'alpha' to zero. If it is negative, we set 'value' to
+    // zero, and use 'alpha' to subtract. This is only correct when the pixel
+    // is currently white, so walls will look too gray. This should be hard to
+    // detect visually for the user, though.
+    const int delta =
+        128 -
+        ProbabilityToLogOddsInteger(probability_grid.GetProbability(xy_index));
+    const uint8 alpha = delta > 0 ? 0 : -delta;
+    const uint8 value = delta > 0 ? delta : 0;
+    cells->push_back(value);
+    cells->push_back((value || alpha) ? alpha : 1);
+  }
+  else
+  {
+    cells->push_back(static_cast<uint8>(Submaps::kUnknownLogOdds));  // value
+    cells->push_back(0);                                             // alpha
+  }
+}
+
+// Fills in the parts of 'response' which are common to full and delta
+// responses.
+void AddGridGeometryToResponse(
+    const transform::Rigid3d& local_submap_pose,
+    const mapping_2d::ProbabilityGrid& probability_grid,
+    const Eigen::Array2i& offset, const mapping_2d::CellLimits& limits,
+    proto::SubmapQuery::Response* const response)
+{
+  response->set_grid_version(probability_grid.version());
+  response->set_width(limits.num_x_cells);
+  response->set_height(limits.num_y_cells);
+  const double resolution = probability_grid.limits().resolution();
+  response->set_resolution(resolution);
+  const double max_x =
+      probability_grid.limits().max().x() - resolution * offset.y();
+  const double max_y =
+      probability_grid.limits().max().y() - resolution * offset.x();
+  *response->mutable_slice_pose() = transform::ToProto(
+      local_submap_pose.inverse() *
+      transform::Rigid3d::Translation(Eigen::Vector3d(max_x, max_y, 0.)));
+}
+
+}  // namespace
+
 void Submaps::AddProbabilityGridToResponse(
     const transform::Rigid3d& local_submap_pose,
     const mapping_2d::ProbabilityGrid& probability_grid,
@@ -81,41 +173,63 @@ void Submaps::AddProbabilityGridToResponse(
   for (const Eigen::Array2i& xy_index :
        mapping_2d::XYIndexRangeIterator(limits))
   {
-    if (probability_grid.IsKnown(xy_index + offset))
+    AppendCell(probability_grid, xy_index + offset, &cells);
+  }
+  common::FastGzipString(cells, response->mutable_cells());
+  AddGridGeometryToResponse(local_submap_pose, probability_grid, offset,
+                            limits, response);
+}
+
+// 只把版本号grid_version之后修改过的tile编码到response中
+// 没有变化的submap只需要返回一个空的delta
+void Submaps::AddProbabilityGridToResponse(
+    const transform::Rigid3d& local_submap_pose,
+    const mapping_2d::ProbabilityGrid& probability_grid,
+    const int grid_version, proto::SubmapQuery::Response* const response)
+{
+  if (grid_version > probability_grid.version())
+  {
+    // The client has a version we do not know about, so send everything.
+    AddProbabilityGridToResponse(local_submap_pose, probability_grid,
+                                 response);
+    return;
+  }
+
+  Eigen::Array2i offset;
+  mapping_2d::CellLimits limits;
+  probability_grid.ComputeCroppedLimits(&offset, &limits);
+  const Eigen::Array2i cropped_max =
+      offset + Eigen::Array2i(limits.num_x_cells, limits.num_y_cells) - 1;
+
+  string cells;
+  for (const Eigen::Array2i& tile_begin :
+       probability_grid.ComputeTilesChangedSince(grid_version))
+  {
+    // Only the part of the tile inside the cropped limits is sent.
+    const Eigen::Array2i region_begin = tile_begin.max(offset);
+    const Eigen::Array2i region_end =
+        (tile_begin + mapping_2d::ProbabilityGrid::kTileSize - 1)
+            .min(cropped_max);
+    if ((region_begin > region_end).any())
     {
-      // We would like to add 'delta' but this is not possible using a value and
-      // alpha. We use premultiplied alpha, so when 'delta' is positive we can
-      // add it by setting 'alpha' to zero. If it is negative, we set 'value' to
-      // zero, and use 'alpha' to subtract. This is only correct when the pixel
-      // is currently white, so walls will look too gray. This should be hard to
-      // detect visually for the user, though.
-      const int delta =
-          128 - ProbabilityToLogOddsInteger(
-                    probability_grid.GetProbability(xy_index + offset));
-      const uint8 alpha = delta > 0 ? 0 : -delta;
-      const uint8 value = delta > 0 ? delta : 0;
-      cells.push_back(value);
-      cells.push_back((value || alpha) ? alpha : 1);
+      continue;
     }
-    else
+    proto::SubmapQuery::Response::CellRegion* const region =
+        response->add_changed_regions();
+    region->set_x_offset(region_begin.x() - offset.x());
+    region->set_y_offset(region_begin.y() - offset.y());
+    region->set_width(region_end.x() - region_begin.x() + 1);
+    region->set_height(region_end.y() - region_begin.y() + 1);
+    for (const Eigen::Array2i& xy_index :
+         mapping_2d::XYIndexRangeIterator(region_begin, region_end))
     {
-      cells.push_back(static_cast<uint8>(kUnknownLogOdds));  // value
-      cells.push_back(0);                                    // alpha
+      AppendCell(probability_grid, xy_index, &cells);
     }
   }
   common::FastGzipString(cells, response->mutable_cells());
-
-  response->set_width(limits.num_x_cells);
-  response->set_height(limits.num_y_cells);
-  const double resolution = probability_grid.limits().resolution();
-  response->set_resolution(resolution);
-  const double max_x =
-      probability_grid.limits().max().x() - resolution * offset.y();
-  const double max_y =
-      probability_grid.limits().max().y() - resolution * offset.x();
-  *response->mutable_slice_pose() = transform::ToProto(
-      local_submap_pose.inverse() *
-      transform::Rigid3d::Translation(Eigen::Vector3d(max_x, max_y, 0.)));
+  response->set_is_delta(true);
+  AddGridGeometryToResponse(local_submap_pose, probability_grid, offset,
+                            limits, response);
 }
 
 }  // namespace mapping
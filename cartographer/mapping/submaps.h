@@ -155,11 +155,38 @@ class Submaps
       const transform::Rigid3d& global_submap_pose,
       proto::SubmapQuery::Response* response) = 0;
 
+  // Answers the submap query 'request' for the Submap with index
+  // 'request.submap_id()'. If the request contains a 'grid_version', only the
+  // regions which changed since then are sent where supported.
+  // 处理submap查询 客户端带上已有的grid_version时只返回变化的区域
+  void SubmapQueryToProto(
+      const proto::SubmapQuery::Request& request,
+      const std::vector<mapping::TrajectoryNode>& trajectory_nodes,
+      const transform::Rigid3d& global_submap_pose,
+      proto::SubmapQuery::Response* response);
+
  protected:
+  // Same as SubmapToProto(), but the 'response' only needs to contain the
+  // regions which changed since the client received 'grid_version'. The
+  // default implementation always fills in the full Submap.
+  // 只返回客户端已有的版本之后发生变化的区域
+  virtual void SubmapDeltaToProto(
+      int index, int grid_version,
+      const std::vector<mapping::TrajectoryNode>& trajectory_nodes,
+      const transform::Rigid3d& global_submap_pose,
+      proto::SubmapQuery::Response* response);
+
   static void AddProbabilityGridToResponse(
       const transform::Rigid3d& local_submap_pose,
       const mapping_2d::ProbabilityGrid& probability_grid,
       proto::SubmapQuery::Response* response);
+
+  // Like above, but only adds the regions of 'probability_grid' which changed
+  // after 'grid_version' as a delta response.
+  static void AddProbabilityGridToResponse(
+      const transform::Rigid3d& local_submap_pose,
+      const mapping_2d::ProbabilityGrid& probability_grid, int grid_version,
+      proto::SubmapQuery::Response* response);
 };
 
 }  // namespace mapping
@@ -17,7 +17,11 @@
 #include "cartographer/mapping/submaps.h"
 
 #include <cmath>
+#include <string>
+#include <vector>
 
+#include "cartographer/common/port.h"
+#include "cartographer/transform/rigid_transform.h"
 #include "gtest/gtest.h"
 
 namespace cartographer {
@@ -37,6 +41,83 @@ TEST(SubmapsTest, LogOddsConversions) {
   EXPECT_NEAR(Expit(Logit(0.5)), 0.5, 1e-6);
 }
 
+class FakeSubmaps : public Submaps {
+ public:
+  const Submap* Get(int) const override { LOG(FATAL) << "Not implemented."; }
+
+  int size() const override { LOG(FATAL) << "Not implemented."; }
+
+  void SubmapToProto(int, const std::vector<mapping::TrajectoryNode>&,
+                     const transform::Rigid3d&,
+                     proto::SubmapQuery::Response*) override {
+    LOG(FATAL) << "Not implemented.";
+  }
+
+  using Submaps::AddProbabilityGridToResponse;
+};
+
+// Applies the cells of a delta 'response' to the row-major 'cells'.
+void ApplyDelta(const proto::SubmapQuery::Response& response,
+                string* const cells) {
+  string delta_cells;
+  common::FastGunzipString(response.cells(), &delta_cells);
+  size_t delta_index = 0;
+  for (const auto& region : response.changed_regions()) {
+    for (int y = region.y_offset(); y != region.y_offset() + region.height();
+         ++y) {
+      for (int x = region.x_offset(); x != region.x_offset() + region.width();
+           ++x) {
+        const int index = 2 * (x + y * response.width());
+        (*cells)[index] = delta_cells[delta_index++];
+        (*cells)[index + 1] = delta_cells[delta_index++];
+      }
+    }
+  }
+  EXPECT_EQ(delta_cells.size(), delta_index);
+}
+
+TEST(SubmapsTest, DeltaResponseOnlyContainsChangedTiles) {
+  mapping_2d::ProbabilityGrid probability_grid(mapping_2d::MapLimits(
+      0.05, Eigen::Vector2d(10., 10.), mapping_2d::CellLimits(400, 400)));
+  probability_grid.StartUpdate();
+  for (int i = 0; i != 100; ++i) {
+    probability_grid.SetProbability(Eigen::Array2i(100 + i, 150 + i / 2), 0.7);
+  }
+  const transform::Rigid3d local_pose = transform::Rigid3d::Identity();
+  proto::SubmapQuery::Response full_response;
+  FakeSubmaps::AddProbabilityGridToResponse(local_pose, probability_grid,
+                                            &full_response);
+  EXPECT_FALSE(full_response.is_delta());
+
+  proto::SubmapQuery::Response unchanged_response;
+  FakeSubmaps::AddProbabilityGridToResponse(
+      local_pose, probability_grid, full_response.grid_version(),
+      &unchanged_response);
+  EXPECT_TRUE(unchanged_response.is_delta());
+  EXPECT_EQ(0, unchanged_response.changed_regions_size());
+
+  probability_grid.StartUpdate();
+  probability_grid.SetProbability(Eigen::Array2i(150, 160), 0.2);
+  proto::SubmapQuery::Response delta_response;
+  FakeSubmaps::AddProbabilityGridToResponse(local_pose, probability_grid,
+                                            full_response.grid_version(),
+                                            &delta_response);
+  EXPECT_TRUE(delta_response.is_delta());
+  EXPECT_EQ(1, delta_response.changed_regions_size());
+  EXPECT_EQ(full_response.width(), delta_response.width());
+  EXPECT_EQ(full_response.height(), delta_response.height());
+
+  string cells;
+  common::FastGunzipString(full_response.cells(), &cells);
+  ApplyDelta(delta_response, &cells);
+  proto::SubmapQuery::Response expected_response;
+  FakeSubmaps::AddProbabilityGridToResponse(local_pose, probability_grid,
+                                            &expected_response);
+  string expected_cells;
+  common::FastGunzipString(expected_response.cells(), &expected_cells);
+  EXPECT_EQ(expected_cells, cells);
+}
+
 }  // namespace
 }  // namespace mapping
 }  // namespace cartographer
@@ -67,20 +67,22 @@ void LaserFanInserter::Insert(const sensor::LaserFan& laser_fan,
 {
   CHECK_NOTNULL(probability_grid)->StartUpdate();
 
+  // The visitors are passed to the templated CastRays() so that the table
+  // lookups are inlined into the ray stepping loops.
+  // 这里的两个lambda会被内联到CastRays()中 避免了每个栅格一次的间接函数调用
+  const bool insert_free_space = options_.insert_free_space();
+
   // By not starting a new update after hits are inserted, we give hits priority
   // (i.e. no hits will be ignored because of a miss in the same cell).
   CastRays(laser_fan, probability_grid->limits(),
-
-           //传入的这个函数的函数体就是调用probability_grid->ApplyLookupTable()
-           [this, &probability_grid](const Eigen::Array2i& hit) {
+           [this, probability_grid](const Eigen::Array2i& hit) {
              probability_grid->ApplyLookupTable(hit, hit_table_);
            },
-
-           //传入的这个函数的函数体就是调用probability_grid->ApplyLookupTable()来进行地图更新
-           [this, &probability_grid](const Eigen::Array2i& miss) {
-             if (options_.insert_free_space()) {
+           [this, probability_grid,
+            insert_free_space](const Eigen::Array2i& miss) {
+             if (insert_free_space) {
                probability_grid->ApplyLookupTable(miss, miss_table_);
-             } 
+             }
            });
 }
 
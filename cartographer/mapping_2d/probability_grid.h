@@ -18,6 +18,7 @@
 #define CARTOGRAPHER_MAPPING_2D_PROBABILITY_GRID_H_
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <iostream>
 #include <limits>
@@ -25,6 +26,7 @@
 #include <string>
 #include <vector>
 
+#include "../common/make_unique.h"
 #include "../common/math.h"
 #include "../common/port.h"
 #include "../mapping/probability_values.h"
@@ -40,31 +42,57 @@ namespace mapping_2d {
  * @brief The ProbabilityGrid class
  * 覆盖栅格地图．
  * 每个栅格的值表示该点被障碍物占用的概率
+ *
+ * Cells are stored in square tiles of kTileSize x kTileSize cells which are
+ * contiguous in memory and allocated on first write. Reads of cells in tiles
+ * that were never written return unknown without allocating anything, so
+ * large submaps only pay for the area that was actually observed, and ray
+ * casting and scan matching windows stay within a few cache lines per tile.
+ * 栅格按kTileSize x kTileSize的块存储，块在第一次写入时才分配内存
  */
 class ProbabilityGrid
 {
  public:
+  // Number of cells per tile side is 2^kTileBits.
+  static constexpr int kTileBits = 5;
+  static constexpr int kTileSize = 1 << kTileBits;
+
   explicit ProbabilityGrid(const MapLimits& limits)
+      : ProbabilityGrid(limits, 0) {}
+
+  // Creates a grid which starts at 'version', e.g. to continue the versions of
+  // a grid it is derived from.
+  ProbabilityGrid(const MapLimits& limits, const int version)
       : limits_(limits),
-        cells_(limits_.cell_limits().num_x_cells *
-                   limits_.cell_limits().num_y_cells,
-               mapping::kUnknownProbabilityValue),
+        tile_limits_(NumTilesFor(limits_.cell_limits().num_x_cells),
+                     NumTilesFor(limits_.cell_limits().num_y_cells)),
+        tiles_(tile_limits_.num_x_cells * tile_limits_.num_y_cells),
         max_x_(0),
         max_y_(0),
         min_x_(limits_.cell_limits().num_x_cells - 1),
-        min_y_(limits_.cell_limits().num_y_cells - 1) {}
+        min_y_(limits_.cell_limits().num_y_cells - 1),
+        version_(version) {}
+
+  ProbabilityGrid(ProbabilityGrid&&) = default;
+  ProbabilityGrid& operator=(ProbabilityGrid&&) = default;
 
   // Returns the limits of this ProbabilityGrid.
   // 返回地图的参数 包括分辨率 最大物理坐标 最大栅格坐标之类的
   const MapLimits& limits() const { return limits_; }
 
+  // Returns the version of this grid. It is increased by every call to
+  // StartUpdate(), so cells changed afterwards have a newer version.
+  // 地图的版本号 每次StartUpdate()都会加1
+  int version() const { return version_; }
+
   // Starts the next update sequence.
   void StartUpdate()
   {
+    ++version_;
     while (!update_indices_.empty())
     {
-      DCHECK_GE(cells_[update_indices_.back()], mapping::kUpdateMarker);
-      cells_[update_indices_.back()] -= mapping::kUpdateMarker;
+      DCHECK_GE(*update_indices_.back(), mapping::kUpdateMarker);
+      *update_indices_.back() -= mapping::kUpdateMarker;
       update_indices_.pop_back();
     }
   }
@@ -74,7 +102,7 @@ class ProbabilityGrid
   // 设置index为xy_index的cell的概率　只有这个cell为unknown时才可以这么做
   void SetProbability(const Eigen::Array2i& xy_index, const float probability)
   {
-    uint16& cell = cells_[GetIndexOfCell(xy_index)];
+    uint16& cell = *mutable_value(xy_index);
     CHECK_EQ(cell, mapping::kUnknownProbabilityValue);
     cell = mapping::ProbabilityToValue(probability);
     UpdateBounds(xy_index);
@@ -93,18 +121,17 @@ class ProbabilityGrid
                         const std::vector<uint16>& table)
   {
     DCHECK_EQ(table.size(), mapping::kUpdateMarker);
-    const int cell_index = GetIndexOfCell(xy_index);
-    uint16& cell = cells_[cell_index];
-    if (cell >= mapping::kUpdateMarker)
+    uint16* const cell = mutable_value(xy_index);
+    if (*cell >= mapping::kUpdateMarker)
     {
       return false;
     }
 
-    //存储下来所有要更新的栅格的坐标
-    update_indices_.push_back(cell_index);
-    cell = table[cell];
+    //存储下来所有要更新的栅格的地址 tile不会被释放 所以地址一直有效
+    update_indices_.push_back(cell);
+    *cell = table[*cell];
 
-    DCHECK_GE(cell, mapping::kUpdateMarker);
+    DCHECK_GE(*cell, mapping::kUpdateMarker);
 
     //更新地图的边界
     UpdateBounds(xy_index);
@@ -117,7 +144,7 @@ class ProbabilityGrid
   {
     if (limits_.Contains(xy_index))
     {
-      return mapping::ValueToProbability(cells_[GetIndexOfCell(xy_index)]);
+      return mapping::ValueToProbability(value(xy_index));
     }
     return mapping::kMinProbability;
   }
@@ -134,8 +161,46 @@ class ProbabilityGrid
   bool IsKnown(const Eigen::Array2i& xy_index) const
   {
     return limits_.Contains(xy_index) &&
-           cells_[GetIndexOfCell(xy_index)] !=
-               mapping::kUnknownProbabilityValue;
+           value(xy_index) != mapping::kUnknownProbabilityValue;
+  }
+
+  // Copies the values of the 'cell_limits' cells starting at 'offset' into
+  // 'values', row by row with x as the fast index, without the update marker.
+  // Unknown cells and cells outside of the grid are kUnknownProbabilityValue.
+  // This copies whole rows of tiles at once and is much faster than calling
+  // GetProbability() for each cell.
+  // 把一个矩形区域内的栅格值拷贝出来 区域外和未知的栅格为0
+  void CopyValues(const Eigen::Array2i& offset, const CellLimits& cell_limits,
+                  uint16* const values) const
+  {
+    std::fill(values, values + cell_limits.num_x_cells * cell_limits.num_y_cells,
+              mapping::kUnknownProbabilityValue);
+    // Only the known cells need to be copied.
+    const int begin_x = std::max(offset.x(), min_x_);
+    const int begin_y = std::max(offset.y(), min_y_);
+    const int end_x = std::min(offset.x() + cell_limits.num_x_cells, max_x_ + 1);
+    const int end_y = std::min(offset.y() + cell_limits.num_y_cells, max_y_ + 1);
+    constexpr int kMask = kTileSize - 1;
+    for (int y = begin_y; y < end_y; ++y)
+    {
+      uint16* const row =
+          values + (y - offset.y()) * cell_limits.num_x_cells;
+      for (int x = begin_x; x < end_x; x = (x | kMask) + 1)
+      {
+        const Tile* const tile = tiles_[GetTileIndex(Eigen::Array2i(x, y))].get();
+        if (tile == nullptr)
+        {
+          continue;
+        }
+        const uint16* const tile_row =
+            tile->cells.data() + ((y & kMask) << kTileBits);
+        const int tile_end_x = std::min(end_x, (x | kMask) + 1);
+        for (int i = x; i != tile_end_x; ++i)
+        {
+          row[i - offset.x()] = tile_row[i & kMask] & ~mapping::kUpdateMarker;
+        }
+      }
+    }
   }
 
   // Fills in 'offset' and 'limits' to define a subregion of that contains all
@@ -152,42 +217,77 @@ class ProbabilityGrid
                          std::max(max_y_, min_y_) - min_y_ + 1);
   }
 
+  // Returns the index of the first cell of each allocated tile which contains
+  // cells changed after 'version'. Cells of a tile have indices up to
+  // kTileSize - 1 larger in each direction.
+  // 返回在版本号version之后被修改过的tile 用于只发送地图中变化了的部分
+  std::vector<Eigen::Array2i> ComputeTilesChangedSince(const int version) const
+  {
+    std::vector<Eigen::Array2i> changed_tiles;
+    for (int tile_y = 0; tile_y != tile_limits_.num_y_cells; ++tile_y)
+    {
+      for (int tile_x = 0; tile_x != tile_limits_.num_x_cells; ++tile_x)
+      {
+        const Tile* const tile =
+            tiles_[tile_x + tile_y * tile_limits_.num_x_cells].get();
+        if (tile != nullptr && tile->version > version)
+        {
+          changed_tiles.emplace_back(tile_x << kTileBits, tile_y << kTileBits);
+        }
+      }
+    }
+    return changed_tiles;
+  }
+
   // Grows the map as necessary to include 'x' and 'y'. This changes the meaning
   // of these coordinates going forward. This method must be called immediately
   // after 'StartUpdate', before any calls to 'ApplyLookupTable'.
   // 拓展地图的边界,使得地图会包含点(x,y)
   // 新扩展出来的点被设置为unknown
+  //
+  // The grid grows by at least half its size on each side, rounded up to
+  // whole tiles. Existing tiles are only moved to their new position in the
+  // tile table, so growing never copies or touches cell data and the cost is
+  // amortized over the cells that were added.
+  // 每次扩展的大小为整数个tile 因此只需要移动tile的指针 不需要拷贝栅格
   void GrowLimits(const double x, const double y)
   {
     CHECK(update_indices_.empty());
     while (!limits_.Contains(limits_.GetXYIndexOfCellContainingPoint(x, y)))
     {
-      const int x_offset = limits_.cell_limits().num_x_cells / 2;
-      const int y_offset = limits_.cell_limits().num_y_cells / 2;
+      const int x_tile_offset =
+          std::max(1, NumTilesFor(limits_.cell_limits().num_x_cells / 2));
+      const int y_tile_offset =
+          std::max(1, NumTilesFor(limits_.cell_limits().num_y_cells / 2));
+      const int x_offset = x_tile_offset << kTileBits;
+      const int y_offset = y_tile_offset << kTileBits;
 
       const MapLimits new_limits(
           limits_.resolution(),
           limits_.max() +
               limits_.resolution() * Eigen::Vector2d(y_offset, x_offset),
-          CellLimits(2 * limits_.cell_limits().num_x_cells,
-                     2 * limits_.cell_limits().num_y_cells));
-
-      const int stride = new_limits.cell_limits().num_x_cells;
-      const int offset = x_offset + stride * y_offset;
-      const int new_size = new_limits.cell_limits().num_x_cells *
-                           new_limits.cell_limits().num_y_cells;
-      std::vector<uint16> new_cells(new_size,
-                                    mapping::kUnknownProbabilityValue);
-      for (int i = 0; i < limits_.cell_limits().num_y_cells; ++i)
+          CellLimits(limits_.cell_limits().num_x_cells + 2 * x_offset,
+                     limits_.cell_limits().num_y_cells + 2 * y_offset));
+      const CellLimits new_tile_limits(
+          NumTilesFor(new_limits.cell_limits().num_x_cells),
+          NumTilesFor(new_limits.cell_limits().num_y_cells));
+
+      // Cells beyond the old limits in partially covered tiles were never
+      // written, so they correctly end up as unknown cells of the new grid.
+      std::vector<std::unique_ptr<Tile>> new_tiles(
+          new_tile_limits.num_x_cells * new_tile_limits.num_y_cells);
+      for (int tile_y = 0; tile_y != tile_limits_.num_y_cells; ++tile_y)
       {
-        for (int j = 0; j < limits_.cell_limits().num_x_cells; ++j)
+        for (int tile_x = 0; tile_x != tile_limits_.num_x_cells; ++tile_x)
         {
-          new_cells[offset + j + i * stride] =
-              cells_[j + i * limits_.cell_limits().num_x_cells];
+          new_tiles[(tile_x + x_tile_offset) +
+                    (tile_y + y_tile_offset) * new_tile_limits.num_x_cells] =
+              std::move(tiles_[tile_x + tile_y * tile_limits_.num_x_cells]);
         }
       }
-      cells_ = new_cells;
       limits_ = new_limits;
+      tile_limits_ = new_tile_limits;
+      tiles_ = std::move(new_tiles);
       min_x_ += x_offset;
       min_y_ += y_offset;
       max_x_ += x_offset;
@@ -196,12 +296,64 @@ class ProbabilityGrid
   }
 
  private:
-  // Returns the index of the cell at 'xy_index'.
-  // 把(x,y)坐标转化为index
-  int GetIndexOfCell(const Eigen::Array2i& xy_index) const
+  // A square block of cells which is contiguous in memory.
+  struct Tile
+  {
+    Tile() { cells.fill(mapping::kUnknownProbabilityValue); }
+
+    std::array<uint16, kTileSize * kTileSize> cells;
+
+    // Grid version during the last change of any of 'cells'.
+    int version = 0;
+  };
+
+  // Returns the number of tiles needed to cover 'num_cells' cells.
+  static int NumTilesFor(const int num_cells)
+  {
+    return (num_cells + kTileSize - 1) >> kTileBits;
+  }
+
+  // Returns the index of the tile containing 'xy_index'.
+  int GetTileIndex(const Eigen::Array2i& xy_index) const
+  {
+    return tile_limits_.num_x_cells * (xy_index.y() >> kTileBits) +
+           (xy_index.x() >> kTileBits);
+  }
+
+  // Returns the index of the cell at 'xy_index' inside its tile.
+  static int GetIndexInTile(const Eigen::Array2i& xy_index)
+  {
+    constexpr int kMask = kTileSize - 1;
+    return ((xy_index.y() & kMask) << kTileBits) + (xy_index.x() & kMask);
+  }
+
+  // Returns the value of the cell at 'xy_index' which must be contained in
+  // the grid. Cells in unallocated tiles are unknown.
+  uint16 value(const Eigen::Array2i& xy_index) const
+  {
+    DCHECK(limits_.Contains(xy_index)) << xy_index;
+    const Tile* const tile = tiles_[GetTileIndex(xy_index)].get();
+    if (tile == nullptr)
+    {
+      return mapping::kUnknownProbabilityValue;
+    }
+    return tile->cells[GetIndexInTile(xy_index)];
+  }
+
+  // Returns a pointer to the cell at 'xy_index' to allow changing it. The tile
+  // containing it is allocated if necessary and marked as changed in the
+  // current version.
+  // 得到栅格的指针 如果对应的tile还没有分配 则进行分配
+  uint16* mutable_value(const Eigen::Array2i& xy_index)
   {
     CHECK(limits_.Contains(xy_index)) << xy_index;
-    return limits_.cell_limits().num_x_cells * xy_index.y() + xy_index.x();
+    std::unique_ptr<Tile>& tile = tiles_[GetTileIndex(xy_index)];
+    if (tile == nullptr)
+    {
+      tile = common::make_unique<Tile>();
+    }
+    tile->version = version_;
+    return &tile->cells[GetIndexInTile(xy_index)];
   }
 
   // 扩展地图的边界使得它包含点xy_index
@@ -215,8 +367,17 @@ class ProbabilityGrid
   }
 
   MapLimits limits_;                //地图的一些参数
-  std::vector<uint16> cells_;       //地图的栅格 Highest bit is update marker.
-  std::vector<int> update_indices_; //
+
+  // Number of tiles in each direction.
+  // 每个方向上tile的数量
+  CellLimits tile_limits_;
+
+  // Row-major tiles, nullptr for tiles which have never been written.
+  // 地图的栅格 Highest bit is update marker.
+  std::vector<std::unique_ptr<Tile>> tiles_;
+
+  // Cells changed since the last call to StartUpdate().
+  std::vector<uint16*> update_indices_;
 
   // Minimum and maximum cell coordinates of know cells to efficiently compute
   // cropping limits.
@@ -225,6 +386,9 @@ class ProbabilityGrid
   int max_y_;
   int min_x_;
   int min_y_;
+
+  // Number of calls to StartUpdate() so far.
+  int version_;
 };
 
 }  // namespace mapping_2d
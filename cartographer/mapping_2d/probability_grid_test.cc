@@ -16,7 +16,9 @@
 
 #include "../mapping_2d/probability_grid.h"
 
+#include <map>
 #include <random>
+#include <utility>
 
 #include "gtest/gtest.h"
 
@@ -162,6 +164,152 @@ TEST(ProbabilityGridTest, CorrectCropping) {
   EXPECT_EQ(limits.num_y_cells, 200);
 }
 
+TEST(ProbabilityGridTest, CellsAcrossTileBoundaries) {
+  // Use a grid size that is not a multiple of the tile size so that the last
+  // row and column of tiles are only partially covered.
+  const int num_cells = 3 * ProbabilityGrid::kTileSize + 7;
+  ProbabilityGrid probability_grid(MapLimits(
+      0.05, Eigen::Vector2d(10., 10.), CellLimits(num_cells, num_cells)));
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> value_distribution(
+      mapping::kMinProbability, mapping::kMaxProbability);
+  std::uniform_int_distribution<int> index_distribution(0, num_cells - 1);
+  std::map<std::pair<int, int>, float> expected_probabilities;
+  probability_grid.StartUpdate();
+  for (int i = 0; i != 1000; ++i) {
+    const Eigen::Array2i xy_index(index_distribution(rng),
+                                  index_distribution(rng));
+    if (probability_grid.IsKnown(xy_index)) {
+      continue;
+    }
+    const float probability = value_distribution(rng);
+    probability_grid.SetProbability(xy_index, probability);
+    expected_probabilities[std::make_pair(xy_index.x(), xy_index.y())] =
+        probability;
+  }
+  for (const Eigen::Array2i& xy_index :
+       XYIndexRangeIterator(probability_grid.limits().cell_limits())) {
+    const auto it =
+        expected_probabilities.find(std::make_pair(xy_index.x(), xy_index.y()));
+    if (it == expected_probabilities.end()) {
+      EXPECT_FALSE(probability_grid.IsKnown(xy_index));
+      EXPECT_EQ(mapping::kMinProbability,
+                probability_grid.GetProbability(xy_index));
+    } else {
+      EXPECT_TRUE(probability_grid.IsKnown(xy_index));
+      EXPECT_NEAR(it->second, probability_grid.GetProbability(xy_index),
+                  1e-4);
+    }
+  }
+}
+
+TEST(ProbabilityGridTest, CopyValues) {
+  const int num_cells = 3 * ProbabilityGrid::kTileSize + 7;
+  ProbabilityGrid probability_grid(MapLimits(
+      0.05, Eigen::Vector2d(10., 10.), CellLimits(num_cells, num_cells)));
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> value_distribution(
+      mapping::kMinProbability, mapping::kMaxProbability);
+  std::uniform_int_distribution<int> index_distribution(5, num_cells - 20);
+  probability_grid.StartUpdate();
+  for (int i = 0; i != 1000; ++i) {
+    const Eigen::Array2i xy_index(index_distribution(rng),
+                                  index_distribution(rng));
+    if (!probability_grid.IsKnown(xy_index)) {
+      probability_grid.SetProbability(xy_index, value_distribution(rng));
+    }
+  }
+  // Cells which were just updated have the update marker set.
+  probability_grid.StartUpdate();
+  probability_grid.ApplyLookupTable(
+      Eigen::Array2i(10, 12),
+      mapping::ComputeLookupTableToApplyOdds(mapping::Odds(0.9)));
+
+  // Partially outside of the grid.
+  const Eigen::Array2i offset(-9, 20);
+  const CellLimits cell_limits(num_cells, num_cells - 3);
+  std::vector<uint16> values(cell_limits.num_x_cells *
+                             cell_limits.num_y_cells);
+  probability_grid.CopyValues(offset, cell_limits, values.data());
+  for (const Eigen::Array2i& xy_index : XYIndexRangeIterator(cell_limits)) {
+    const uint16 value =
+        values[xy_index.y() * cell_limits.num_x_cells + xy_index.x()];
+    EXPECT_LT(value, mapping::kUpdateMarker);
+    EXPECT_EQ(probability_grid.IsKnown(xy_index + offset),
+              value != mapping::kUnknownProbabilityValue);
+    EXPECT_EQ(probability_grid.GetProbability(xy_index + offset),
+              mapping::ValueToProbability(value));
+  }
+}
+
+TEST(ProbabilityGridTest, GrowLimitsKeepsKnownCells) {
+  ProbabilityGrid probability_grid(
+      MapLimits(1., Eigen::Vector2d(5., 5.), CellLimits(10, 10)));
+  probability_grid.StartUpdate();
+  probability_grid.SetProbability(
+      probability_grid.limits().GetXYIndexOfCellContainingPoint(0.5, 0.5),
+      mapping::kMaxProbability);
+  probability_grid.SetProbability(
+      probability_grid.limits().GetXYIndexOfCellContainingPoint(-4.5, 3.5),
+      mapping::kMinProbability);
+
+  probability_grid.GrowLimits(-100., 100.);
+  EXPECT_TRUE(probability_grid.limits().Contains(
+      probability_grid.limits().GetXYIndexOfCellContainingPoint(-100., 100.)));
+  EXPECT_NEAR(mapping::kMaxProbability,
+              probability_grid.GetProbability(0.5, 0.5), 1e-4);
+  EXPECT_NEAR(mapping::kMinProbability,
+              probability_grid.GetProbability(-4.5, 3.5), 1e-4);
+  EXPECT_FALSE(probability_grid.IsKnown(
+      probability_grid.limits().GetXYIndexOfCellContainingPoint(1.5, 0.5)));
+
+  Eigen::Array2i offset;
+  CellLimits limits;
+  probability_grid.ComputeCroppedLimits(&offset, &limits);
+  EXPECT_TRUE((offset == probability_grid.limits()
+                             .GetXYIndexOfCellContainingPoint(0.5, 3.5))
+                  .all());
+  EXPECT_EQ(4, limits.num_x_cells);
+  EXPECT_EQ(6, limits.num_y_cells);
+}
+
+TEST(ProbabilityGridTest, GrowLimitsAppliesUpdatesAfterGrowing) {
+  ProbabilityGrid probability_grid(
+      MapLimits(1., Eigen::Vector2d(5., 5.), CellLimits(10, 10)));
+  const std::vector<uint16> table =
+      mapping::ComputeLookupTableToApplyOdds(mapping::Odds(0.9));
+  probability_grid.StartUpdate();
+  EXPECT_TRUE(probability_grid.ApplyLookupTable(
+      probability_grid.limits().GetXYIndexOfCellContainingPoint(0.5, 0.5),
+      table));
+
+  // Grow in several steps, each of which only moves existing tiles.
+  for (const double x : {-40., 80., -300.}) {
+    probability_grid.StartUpdate();
+    probability_grid.GrowLimits(x, -x);
+    EXPECT_TRUE(probability_grid.limits().Contains(
+        probability_grid.limits().GetXYIndexOfCellContainingPoint(x, -x)));
+    EXPECT_NEAR(0.9, probability_grid.GetProbability(0.5, 0.5), 1e-2);
+  }
+
+  const Eigen::Array2i far_index =
+      probability_grid.limits().GetXYIndexOfCellContainingPoint(-300., 300.);
+  EXPECT_FALSE(probability_grid.IsKnown(far_index));
+  EXPECT_TRUE(probability_grid.ApplyLookupTable(far_index, table));
+  EXPECT_FALSE(probability_grid.ApplyLookupTable(far_index, table));
+  probability_grid.StartUpdate();
+  EXPECT_NEAR(0.9, probability_grid.GetProbability(-300., 300.), 1e-2);
+
+  Eigen::Array2i offset;
+  CellLimits limits;
+  probability_grid.ComputeCroppedLimits(&offset, &limits);
+  const Eigen::Array2i near_index =
+      probability_grid.limits().GetXYIndexOfCellContainingPoint(0.5, 0.5);
+  EXPECT_TRUE((offset == Eigen::Array2i(far_index.x(), near_index.y())).all());
+  EXPECT_EQ(near_index.x() - far_index.x() + 1, limits.num_x_cells);
+  EXPECT_EQ(far_index.y() - near_index.y() + 1, limits.num_y_cells);
+}
+
 }  // namespace
 }  // namespace mapping_2d
 }  // namespace cartographer
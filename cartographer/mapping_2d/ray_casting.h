@@ -17,19 +17,222 @@
 #ifndef CARTOGRAPHER_MAPPING_2D_RAY_CASTING_H_
 #define CARTOGRAPHER_MAPPING_2D_RAY_CASTING_H_
 
+#include <algorithm>
 #include <functional>
+#include <vector>
 
 #include "../mapping_2d/map_limits.h"
 #include "../mapping_2d/xy_index.h"
 #include "../sensor/laser.h"
 #include "../sensor/point_cloud.h"
 #include "../transform/transform.h"
+#include "glog/logging.h"
 
 namespace cartographer {
 namespace mapping_2d {
 
+// Implementation details of CastRays() which have to be in this header since
+// it is a template.
+namespace detail {
+
+// Factor for subpixel accuracy of start and end point.
+constexpr int kSubpixelScale = 1000;
+
+// We divide each pixel in kSubpixelScale x kSubpixelScale subpixels. 'begin'
+// and 'end' are coordinates at subpixel precision. We call 'visitor' on all
+// pixels in which some part of the line segment connecting 'begin' and 'end'
+// lies.
+//　真正的bresenham2d画线算法。这个函数被下面的CastRays调用。
+//  visitor是模板参数 因此可以被内联到最内层的循环中
+template <typename Visitor>
+void CastRay(const Eigen::Array2i& begin, const Eigen::Array2i& end,
+             const Visitor& visitor)
+{
+  // For simplicity, we order 'begin' and 'end' by their x coordinate.
+  if (begin.x() > end.x())
+  {
+    CastRay(end, begin, visitor);
+    return;
+  }
+
+  CHECK_GE(begin.x(), 0);
+  CHECK_GE(begin.y(), 0);
+  CHECK_GE(end.y(), 0);
+
+  // Special case: We have to draw a vertical line in full pixels, as 'begin'
+  // and 'end' have the same full pixel x coordinate.
+  if (begin.x() / kSubpixelScale == end.x() / kSubpixelScale)
+  {
+    Eigen::Array2i current(begin.x() / kSubpixelScale,
+                           std::min(begin.y(), end.y()) / kSubpixelScale);
+
+    const int end_y = std::max(begin.y(), end.y()) / kSubpixelScale;
+    for (; current.y() <= end_y; ++current.y())
+    {
+      visitor(current);
+    }
+    return;
+  }
+
+  const int64 dx = end.x() - begin.x();
+  const int64 dy = end.y() - begin.y();
+  const int64 denominator = 2 * kSubpixelScale * dx;
+
+  // The current full pixel coordinates. We begin at 'begin'.
+  Eigen::Array2i current = begin / kSubpixelScale;
+
+  // To represent subpixel centers, we use a factor of 2 * 'kSubpixelScale' in
+  // the denominator.
+  // +-+-+-+ -- 1 = (2 * kSubpixelScale) / (2 * kSubpixelScale)
+  // | | | |
+  // +-+-+-+
+  // | | | |
+  // +-+-+-+ -- top edge of first subpixel = 2 / (2 * kSubpixelScale)
+  // | | | | -- center of first subpixel = 1 / (2 * kSubpixelScale)
+  // +-+-+-+ -- 0 = 0 / (2 * kSubpixelScale)
+
+  // The center of the subpixel part of 'begin.y()' assuming the
+  // 'denominator', i.e., sub_y / denominator is in (0, 1).
+  int64 sub_y = (2 * (begin.y() % kSubpixelScale) + 1) * dx;
+
+  // The distance from the from 'begin' to the right pixel border, to be divided
+  // by 2 * 'kSubpixelScale'.
+  const int first_pixel =
+      2 * kSubpixelScale - 2 * (begin.x() % kSubpixelScale) - 1;
+  // The same from the left pixel border to 'end'.
+  const int last_pixel = 2 * (end.x() % kSubpixelScale) + 1;
+
+  // The full pixel x coordinate of 'end'.
+  const int end_x = std::max(begin.x(), end.x()) / kSubpixelScale;
+
+  // Move from 'begin' to the next pixel border to the right.
+  sub_y += dy * first_pixel;
+  if (dy > 0)
+  {
+    while (true)
+    {
+      visitor(current);
+      while (sub_y > denominator)
+      {
+        sub_y -= denominator;
+        ++current.y();
+        visitor(current);
+      }
+      ++current.x();
+      if (sub_y == denominator)
+      {
+        sub_y -= denominator;
+        ++current.y();
+      }
+      if (current.x() == end_x)
+      {
+        break;
+      }
+      // Move from one pixel border to the next.
+      sub_y += dy * 2 * kSubpixelScale;
+    }
+    // Move from the pixel border on the right to 'end'.
+    sub_y += dy * last_pixel;
+    visitor(current);
+    while (sub_y > denominator)
+    {
+      sub_y -= denominator;
+      ++current.y();
+      visitor(current);
+    }
+    CHECK_NE(sub_y, denominator);
+    CHECK_EQ(current.y(), end.y() / kSubpixelScale);
+    return;
+  }
+
+  // Same for lines non-ascending in y coordinates.
+  while (true)
+  {
+    visitor(current);
+    while (sub_y < 0)
+    {
+      sub_y += denominator;
+      --current.y();
+      visitor(current);
+    }
+    ++current.x();
+    if (sub_y == 0)
+    {
+      sub_y += denominator;
+      --current.y();
+    }
+    if (current.x() == end_x)
+    {
+      break;
+    }
+    sub_y += dy * 2 * kSubpixelScale;
+  }
+  sub_y += dy * last_pixel;
+  visitor(current);
+  while (sub_y < 0)
+  {
+    sub_y += denominator;
+    --current.y();
+    visitor(current);
+  }
+  CHECK_NE(sub_y, 0);
+  CHECK_EQ(current.y(), end.y() / kSubpixelScale);
+}
+
+}  // namespace detail
+
 // For each ray in 'laser_fan', calls 'hit_visitor' and 'miss_visitor' on the
-// appropriate cells. Hits are handled before misses.
+// appropriate cells. Hits are handled before misses. The visitors are template
+// parameters, so calls to them can be inlined into the ray stepping loops.
+// 与下面的std::function版本功能相同 但是visitor可以被内联
+template <typename HitVisitor, typename MissVisitor>
+void CastRays(const sensor::LaserFan& laser_fan, const MapLimits& limits,
+              const HitVisitor& hit_visitor, const MissVisitor& miss_visitor)
+{
+  using detail::kSubpixelScale;
+  const double superscaled_resolution = limits.resolution() / kSubpixelScale;
+
+  const MapLimits superscaled_limits(
+      superscaled_resolution, limits.max(),
+      CellLimits(limits.cell_limits().num_x_cells * kSubpixelScale,
+                 limits.cell_limits().num_y_cells * kSubpixelScale));
+
+  const Eigen::Array2i begin =
+      superscaled_limits.GetXYIndexOfCellContainingPoint(laser_fan.origin.x(),
+                                                         laser_fan.origin.y());
+
+  // Compute and add the end points.
+  // 计算激光雷达数据集中的坐标点　这里会调用hit_visitor函数来进行地图更新
+  std::vector<Eigen::Array2i> ends;
+  ends.reserve(laser_fan.point_cloud.size());
+  for (const Eigen::Vector2f& laser_return : laser_fan.point_cloud)
+  {
+    ends.push_back(superscaled_limits.GetXYIndexOfCellContainingPoint(
+        laser_return.x(), laser_return.y()));
+    hit_visitor(ends.back() / kSubpixelScale);
+  }
+
+  // Now add the misses.
+  // 计算激光雷达数据经过的空闲点　这里面会调用miss_visitor函数进行地图更新。
+  for (const Eigen::Array2i& end : ends)
+  {
+    detail::CastRay(begin, end, miss_visitor);
+  }
+
+  // Finally, compute and add empty rays based on missing echos in the scan.
+  // 那些击中了空气的激光帧数据也会被用来计算freespace
+  for (const Eigen::Vector2f& missing_echo :
+       laser_fan.missing_echo_point_cloud)
+  {
+    detail::CastRay(begin,
+                    superscaled_limits.GetXYIndexOfCellContainingPoint(
+                        missing_echo.x(), missing_echo.y()),
+                    miss_visitor);
+  }
+}
+
+// Same as the templated CastRays() with type-erased visitors, for callers
+// which do not need the visitors to be inlined.
 // 进行栅格地图构建的时候需要用到的raytrace，基本算法为bresenham2d算法．
 // 计算hit_visitor 和 miss_visitor，先处理hits
 void CastRays(const sensor::LaserFan& laser_fan, const MapLimits& limits,
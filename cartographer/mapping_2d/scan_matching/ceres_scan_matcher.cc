@@ -16,14 +16,18 @@
 
 #include "../mapping_2d/scan_matching/ceres_scan_matcher.h"
 
+#include <algorithm>
+#include <cmath>
 #include <utility>
 #include <vector>
 
+#include "eigen3/Eigen/Cholesky"
 #include "eigen3/Eigen/Core"
 #include "../common/ceres_solver_options.h"
 #include "../common/lua_parameter_dictionary.h"
 #include "../kalman_filter/pose_tracker.h"
 #include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/float_probability_grid.h"
 #include "../mapping_2d/scan_matching/occupied_space_cost_functor.h"
 #include "../mapping_2d/scan_matching/rotation_delta_cost_functor.h"
 #include "../mapping_2d/scan_matching/translation_delta_cost_functor.h"
@@ -44,6 +48,61 @@ namespace cartographer {
 namespace mapping_2d {
 namespace scan_matching {
 
+namespace {
+
+// Stopping criteria, step acceptance and damping of the Levenberg-Marquardt
+// loop in MatchBatch(), the same as the defaults of ceres::Solver::Options.
+constexpr double kFunctionTolerance = 1e-6;
+constexpr double kGradientTolerance = 1e-10;
+constexpr double kParameterTolerance = 1e-8;
+constexpr double kMinRelativeDecrease = 1e-3;
+constexpr double kInitialTrustRegionRadius = 1e4;
+constexpr double kMaxTrustRegionRadius = 1e16;
+constexpr double kMinDiagonal = 1e-6;
+constexpr double kMaxDiagonal = 1e32;
+
+// The cost of a pose and the normal equations of its linearization.
+struct NormalEquations
+{
+  double cost;
+  Eigen::Matrix3d hessian;
+  Eigen::Vector3d gradient;
+};
+
+// Evaluates the cost which Match() minimizes at 'pose'. The translation and
+// rotation delta costs towards 'target' have constant diagonal Jacobians with
+// 'delta_weights' on the diagonal. 'residuals' and 'jacobian' are buffers
+// large enough for the occupied space cost.
+void Linearize(
+    const OccupiedSpaceCostFunction<FloatProbabilityGrid>& cost_function,
+    const Eigen::Vector3d& delta_weights, const Eigen::Vector3d& target,
+    const Eigen::Vector3d& pose, std::vector<double>* const residuals,
+    std::vector<double>* const jacobian,
+    NormalEquations* const normal_equations)
+{
+  const double* const parameters[] = {pose.data()};
+  double* jacobians[] = {jacobian->data()};
+  cost_function.Evaluate(parameters, residuals->data(), jacobians);
+  const int num_residuals = cost_function.num_residuals();
+  const Eigen::Map<const Eigen::VectorXd> occupied_space_residuals(
+      residuals->data(), num_residuals);
+  const Eigen::Map<
+      const Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>>
+      occupied_space_jacobian(jacobian->data(), num_residuals, 3);
+  const Eigen::Vector3d delta_residuals =
+      delta_weights.cwiseProduct(pose - target);
+  normal_equations->cost = 0.5 * (occupied_space_residuals.squaredNorm() +
+                                  delta_residuals.squaredNorm());
+  normal_equations->hessian =
+      occupied_space_jacobian.transpose() * occupied_space_jacobian;
+  normal_equations->hessian.diagonal() += delta_weights.cwiseAbs2();
+  normal_equations->gradient =
+      occupied_space_jacobian.transpose() * occupied_space_residuals +
+      delta_weights.cwiseProduct(delta_residuals);
+}
+
+}  // namespace
+
 proto::CeresScanMatcherOptions CreateCeresScanMatcherOptions(
     common::LuaParameterDictionary* const parameter_dictionary) {
   proto::CeresScanMatcherOptions options;
@@ -80,6 +139,140 @@ void CeresScanMatcher::Match(const transform::Rigid2d& previous_pose,
                              transform::Rigid2d* const pose_estimate,
                              kalman_filter::Pose2DCovariance* const covariance,
                              ceres::Solver::Summary* const summary) const
+{
+  MatchInGrid(previous_pose, initial_pose_estimate, point_cloud,
+              probability_grid, pose_estimate, covariance, summary);
+}
+
+void CeresScanMatcher::Match(
+    const transform::Rigid2d& previous_pose,
+    const transform::Rigid2d& initial_pose_estimate,
+    const sensor::PointCloud2D& point_cloud,
+    const FloatProbabilityGrid& float_probability_grid,
+    transform::Rigid2d* const pose_estimate,
+    kalman_filter::Pose2DCovariance* const covariance,
+    ceres::Solver::Summary* const summary) const
+{
+  MatchInGrid(previous_pose, initial_pose_estimate, point_cloud,
+              float_probability_grid, pose_estimate, covariance, summary);
+}
+
+void CeresScanMatcher::MatchBatch(
+    const std::vector<transform::Rigid2d>& initial_pose_estimates,
+    const std::vector<const sensor::PointCloud2D*>& point_clouds,
+    const FloatProbabilityGrid& float_probability_grid,
+    std::vector<transform::Rigid2d>* const pose_estimates,
+    std::vector<kalman_filter::Pose2DCovariance>* const covariances) const
+{
+  CHECK_EQ(initial_pose_estimates.size(), point_clouds.size());
+  CHECK_GT(options_.occupied_space_cost_functor_weight(), 0.);
+  CHECK_GT(options_.previous_pose_translation_delta_cost_functor_weight(), 0.);
+  CHECK_GT(options_.initial_pose_estimate_rotation_delta_cost_functor_weight(),
+           0.);
+  const Eigen::Vector3d delta_weights(
+      options_.previous_pose_translation_delta_cost_functor_weight(),
+      options_.previous_pose_translation_delta_cost_functor_weight(),
+      options_.initial_pose_estimate_rotation_delta_cost_functor_weight());
+  pose_estimates->clear();
+  covariances->clear();
+  std::vector<double> residuals;
+  std::vector<double> jacobian;
+  for (size_t i = 0; i != point_clouds.size(); ++i)
+  {
+    const sensor::PointCloud2D& point_cloud = *point_clouds[i];
+    const OccupiedSpaceCostFunction<FloatProbabilityGrid> cost_function(
+        options_.occupied_space_cost_functor_weight() /
+            std::sqrt(static_cast<double>(point_cloud.size())),
+        point_cloud, float_probability_grid);
+    residuals.resize(point_cloud.size());
+    jacobian.resize(3 * point_cloud.size());
+
+    const Eigen::Vector3d target(initial_pose_estimates[i].translation().x(),
+                                 initial_pose_estimates[i].translation().y(),
+                                 initial_pose_estimates[i].rotation().angle());
+    Eigen::Vector3d pose = target;
+    NormalEquations current;
+    Linearize(cost_function, delta_weights, target, pose, &residuals,
+              &jacobian, &current);
+    // Like Ceres, the steps are computed for parameters scaled by the column
+    // norms of the initial Jacobian.
+    // 和ceres一样 用初始雅克比矩阵的列范数对参数进行缩放
+    const Eigen::Vector3d scale =
+        (current.hessian.diagonal().cwiseSqrt().array() + 1.)
+            .inverse()
+            .matrix();
+    // 和ceres一样 阻尼为对角线元素除以信赖域半径
+    double trust_region_radius = kInitialTrustRegionRadius;
+    double radius_decrease_factor = 2.;
+    for (int iteration = 0;
+         iteration != options_.ceres_solver_options().max_num_iterations();
+         ++iteration)
+    {
+      if (current.gradient.lpNorm<Eigen::Infinity>() <= kGradientTolerance)
+      {
+        break;
+      }
+      const Eigen::Matrix3d scaled_hessian =
+          scale.asDiagonal() * current.hessian * scale.asDiagonal();
+      Eigen::Matrix3d damped_hessian = scaled_hessian;
+      damped_hessian.diagonal() +=
+          scaled_hessian.diagonal().cwiseMax(kMinDiagonal).cwiseMin(
+              kMaxDiagonal) /
+          trust_region_radius;
+      const Eigen::Vector3d step =
+          scale.cwiseProduct(damped_hessian.ldlt().solve(
+              -scale.cwiseProduct(current.gradient)));
+      if (step.norm() <=
+          kParameterTolerance * (pose.norm() + kParameterTolerance))
+      {
+        break;
+      }
+      const Eigen::Vector3d candidate_pose = pose + step;
+      NormalEquations candidate;
+      Linearize(cost_function, delta_weights, target, candidate_pose,
+                &residuals, &jacobian, &candidate);
+      const double model_cost_change =
+          -(current.gradient.dot(step) +
+            0.5 * step.dot(current.hessian * step));
+      const double cost_change = current.cost - candidate.cost;
+      //实际下降和模型预测的下降之比太小的时候 和ceres一样拒绝这一步
+      const double step_quality = cost_change / model_cost_change;
+      if (cost_change > 0. && model_cost_change > 0. &&
+          step_quality >= kMinRelativeDecrease)
+      {
+        trust_region_radius = std::min(
+            kMaxTrustRegionRadius,
+            trust_region_radius /
+                std::max(1. / 3., 1. - std::pow(2. * step_quality - 1., 3)));
+        radius_decrease_factor = 2.;
+        pose = candidate_pose;
+        current = candidate;
+        if (cost_change <= kFunctionTolerance * (current.cost + cost_change))
+        {
+          break;
+        }
+      }
+      else
+      {
+        trust_region_radius /= radius_decrease_factor;
+        radius_decrease_factor *= 2.;
+      }
+    }
+    pose_estimates->emplace_back(Eigen::Vector2d(pose.x(), pose.y()),
+                                 pose.z());
+    covariances->push_back(options_.covariance_scale() *
+                           current.hessian.inverse());
+  }
+}
+
+template <typename Grid>
+void CeresScanMatcher::MatchInGrid(
+    const transform::Rigid2d& previous_pose,
+    const transform::Rigid2d& initial_pose_estimate,
+    const sensor::PointCloud2D& point_cloud, const Grid& grid,
+    transform::Rigid2d* const pose_estimate,
+    kalman_filter::Pose2DCovariance* const covariance,
+    ceres::Solver::Summary* const summary) const
 {
   double ceres_pose_estimate[3] = {initial_pose_estimate.translation().x(),
                                    initial_pose_estimate.translation().y(),
@@ -89,13 +282,10 @@ void CeresScanMatcher::Match(const transform::Rigid2d& previous_pose,
 
   //构造残差--栅格
   problem.AddResidualBlock(
-      new ceres::AutoDiffCostFunction<OccupiedSpaceCostFunctor, ceres::DYNAMIC,
-                                      3>(
-          new OccupiedSpaceCostFunctor(
-              options_.occupied_space_cost_functor_weight() /
-                  std::sqrt(static_cast<double>(point_cloud.size())),
-              point_cloud, probability_grid),
-          point_cloud.size()),
+      new OccupiedSpaceCostFunction<Grid>(
+          options_.occupied_space_cost_functor_weight() /
+              std::sqrt(static_cast<double>(point_cloud.size())),
+          point_cloud, grid),
       nullptr, ceres_pose_estimate);
   CHECK_GT(options_.previous_pose_translation_delta_cost_functor_weight(), 0.);
 
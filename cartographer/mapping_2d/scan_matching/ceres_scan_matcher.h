@@ -24,6 +24,7 @@
 #include "../common/lua_parameter_dictionary.h"
 #include "../kalman_filter/pose_tracker.h"
 #include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/float_probability_grid.h"
 #include "../sensor/point_cloud.h"
 
 #include "cartographer/mapping_2d/scan_matching/proto/ceres_scan_matcher_options.pb.h"
@@ -57,7 +58,42 @@ class CeresScanMatcher
              kalman_filter::Pose2DCovariance* covariance,
              ceres::Solver::Summary* summary) const;
 
+  // Same as above, but reads the map from 'float_probability_grid', which is
+  // faster when it is built once and then matched against many times.
+  void Match(const transform::Rigid2d& previous_pose,
+             const transform::Rigid2d& initial_pose_estimate,
+             const sensor::PointCloud2D& point_cloud,
+             const FloatProbabilityGrid& float_probability_grid,
+             transform::Rigid2d* pose_estimate,
+             kalman_filter::Pose2DCovariance* covariance,
+             ceres::Solver::Summary* summary) const;
+
+  // Aligns each of 'point_clouds' independently within
+  // 'float_probability_grid' like Match() with the corresponding entry of
+  // 'initial_pose_estimates' as both 'previous_pose' and
+  // 'initial_pose_estimate'. Instead of setting up a Ceres problem for each
+  // scan, the same cost is minimized by a small Levenberg-Marquardt loop over
+  // the three pose parameters which reuses its buffers for all scans. It takes
+  // the same steps as Ceres with its default options, but always as if
+  // 'use_nonmonotonic_steps' was false. The covariances are computed from the
+  // normal equations at the solution.
+  // 对同一个submap的多帧激光依次优化 省去每帧构建ceres::Problem和协方差计算的开销
+  void MatchBatch(
+      const std::vector<transform::Rigid2d>& initial_pose_estimates,
+      const std::vector<const sensor::PointCloud2D*>& point_clouds,
+      const FloatProbabilityGrid& float_probability_grid,
+      std::vector<transform::Rigid2d>* pose_estimates,
+      std::vector<kalman_filter::Pose2DCovariance>* covariances) const;
+
  private:
+  template <typename Grid>
+  void MatchInGrid(const transform::Rigid2d& previous_pose,
+                   const transform::Rigid2d& initial_pose_estimate,
+                   const sensor::PointCloud2D& point_cloud, const Grid& grid,
+                   transform::Rigid2d* pose_estimate,
+                   kalman_filter::Pose2DCovariance* covariance,
+                   ceres::Solver::Summary* summary) const;
+
   const proto::CeresScanMatcherOptions options_;
   ceres::Solver::Options ceres_solver_options_;
 };
@@ -16,12 +16,16 @@
 
 #include "../mapping_2d/scan_matching/ceres_scan_matcher.h"
 
+#include <cmath>
 #include <memory>
+#include <vector>
 
 #include "../common/lua_parameter_dictionary.h"
 #include "../common/lua_parameter_dictionary_test_helpers.h"
 #include "../common/make_unique.h"
 #include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/float_probability_grid.h"
+#include "../mapping_2d/scan_matching/occupied_space_cost_functor.h"
 #include "../sensor/point_cloud.h"
 #include "../transform/rigid_transform_test_helpers.h"
 #include "gtest/gtest.h"
@@ -71,6 +75,13 @@ class CeresScanMatcherTest : public ::testing::Test {
     EXPECT_THAT(pose, transform::IsNearly(expected_pose, 1e-2))
         << "Actual: " << transform::ToProto(pose).DebugString()
         << "\nExpected: " << transform::ToProto(expected_pose).DebugString();
+
+    const FloatProbabilityGrid float_probability_grid(probability_grid_);
+    transform::Rigid2d float_pose;
+    ceres_scan_matcher_->Match(initial_pose, initial_pose, point_cloud_,
+                               float_probability_grid, &float_pose,
+                               &covariance, &summary);
+    EXPECT_THAT(float_pose, transform::IsNearly(pose, 1e-9));
   }
 
   ProbabilityGrid probability_grid_;
@@ -94,6 +105,185 @@ TEST_F(CeresScanMatcherTest, testOptimizeAlongXY) {
   TestFromInitialPose(transform::Rigid2d::Translation({-0.3, 0.3}));
 }
 
+TEST_F(CeresScanMatcherTest, MatchBatch) {
+  const std::vector<transform::Rigid2d> initial_poses = {
+      transform::Rigid2d::Translation({-0.5, 0.5}),
+      transform::Rigid2d::Translation({-0.3, 0.5}),
+      transform::Rigid2d::Translation({-0.45, 0.3}),
+      transform::Rigid2d::Translation({-0.3, 0.3})};
+  const std::vector<const sensor::PointCloud2D*> point_clouds(
+      initial_poses.size(), &point_cloud_);
+  const FloatProbabilityGrid float_probability_grid(probability_grid_);
+  std::vector<transform::Rigid2d> poses;
+  std::vector<kalman_filter::Pose2DCovariance> covariances;
+  ceres_scan_matcher_->MatchBatch(initial_poses, point_clouds,
+                                  float_probability_grid, &poses,
+                                  &covariances);
+  ASSERT_EQ(initial_poses.size(), poses.size());
+  ASSERT_EQ(initial_poses.size(), covariances.size());
+  const transform::Rigid2d expected_pose =
+      transform::Rigid2d::Translation({-0.5, 0.5});
+  for (size_t i = 0; i != poses.size(); ++i) {
+    EXPECT_THAT(poses[i], transform::IsNearly(expected_pose, 1e-2));
+    EXPECT_GT(covariances[i].determinant(), 0.);
+  }
+}
+
+// Matches an asymmetric point cloud from rotated initial poses in a batch.
+class CeresScanMatcherBatchTest : public CeresScanMatcherTest {
+ protected:
+  CeresScanMatcherBatchTest()
+      : options_(CreateOptions()), monotonic_ceres_scan_matcher_(options_) {
+    probability_grid_.SetProbability(
+        probability_grid_.limits().GetXYIndexOfCellContainingPoint(1.5, -0.5),
+        0.7);
+    point_cloud_.emplace_back(2., -1.);
+    float_probability_grid_ =
+        common::make_unique<FloatProbabilityGrid>(probability_grid_);
+    initial_poses_ = {transform::Rigid2d({-0.5, 0.5}, 0.),
+                      transform::Rigid2d({-0.3, 0.5}, 0.05),
+                      transform::Rigid2d({-0.45, 0.3}, -0.1),
+                      transform::Rigid2d({-0.3, 0.3}, 0.2),
+                      transform::Rigid2d({-0.6, 0.65}, -0.02)};
+    const std::vector<const sensor::PointCloud2D*> point_clouds(
+        initial_poses_.size(), &point_cloud_);
+    monotonic_ceres_scan_matcher_.MatchBatch(initial_poses_, point_clouds,
+                                             *float_probability_grid_, &poses_,
+                                             &covariances_);
+  }
+
+  static proto::CeresScanMatcherOptions CreateOptions() {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          occupied_space_cost_functor_weight = 1.,
+          previous_pose_translation_delta_cost_functor_weight = 0.1,
+          initial_pose_estimate_rotation_delta_cost_functor_weight = 1.5,
+          covariance_scale = 10.,
+          ceres_solver_options = {
+            use_nonmonotonic_steps = false,
+            max_num_iterations = 50,
+            num_threads = 1,
+          },
+        })text");
+    return CreateCeresScanMatcherOptions(parameter_dictionary.get());
+  }
+
+  // Returns the residuals of the problem Match() solves for 'initial_pose' at
+  // 'pose' and their 'jacobian' by central differences.
+  Eigen::VectorXd ComputeResiduals(const transform::Rigid2d& initial_pose,
+                                   const Eigen::Vector3d& pose,
+                                   Eigen::MatrixXd* const jacobian) const {
+    constexpr double kDelta = 1e-6;
+    const Eigen::VectorXd residuals = ComputeResiduals(initial_pose, pose);
+    jacobian->resize(residuals.size(), 3);
+    for (int i = 0; i != 3; ++i) {
+      const Eigen::Vector3d delta = kDelta * Eigen::Vector3d::Unit(i);
+      jacobian->col(i) = (ComputeResiduals(initial_pose, pose + delta) -
+                          ComputeResiduals(initial_pose, pose - delta)) /
+                         (2. * kDelta);
+    }
+    return residuals;
+  }
+
+  // Returns the residuals of the problem Match() solves for 'initial_pose' at
+  // 'pose'.
+  Eigen::VectorXd ComputeResiduals(const transform::Rigid2d& initial_pose,
+                                   const Eigen::Vector3d& pose) const {
+    const OccupiedSpaceCostFunction<FloatProbabilityGrid> cost_function(
+        options_.occupied_space_cost_functor_weight() /
+            std::sqrt(static_cast<double>(point_cloud_.size())),
+        point_cloud_, *float_probability_grid_);
+    Eigen::VectorXd residuals(point_cloud_.size() + 3);
+    const double* const parameters[] = {pose.data()};
+    cost_function.Evaluate(parameters, residuals.data(), nullptr);
+    const int num_points = point_cloud_.size();
+    residuals(num_points) =
+        options_.previous_pose_translation_delta_cost_functor_weight() *
+        (pose.x() - initial_pose.translation().x());
+    residuals(num_points + 1) =
+        options_.previous_pose_translation_delta_cost_functor_weight() *
+        (pose.y() - initial_pose.translation().y());
+    residuals(num_points + 2) =
+        options_.initial_pose_estimate_rotation_delta_cost_functor_weight() *
+        (pose.z() - initial_pose.rotation().angle());
+    return residuals;
+  }
+
+  const proto::CeresScanMatcherOptions options_;
+  const CeresScanMatcher monotonic_ceres_scan_matcher_;
+  std::unique_ptr<FloatProbabilityGrid> float_probability_grid_;
+  std::vector<transform::Rigid2d> initial_poses_;
+  std::vector<transform::Rigid2d> poses_;
+  std::vector<kalman_filter::Pose2DCovariance> covariances_;
+};
+
+TEST_F(CeresScanMatcherBatchTest, MatchBatchFindsMinimum) {
+  // Checks the results against numerical derivatives of the cost, which does
+  // not depend on how Ceres takes its steps. The iterations stop at the
+  // function tolerance, so the gradient is small but not zero.
+  ASSERT_EQ(initial_poses_.size(), poses_.size());
+  ASSERT_EQ(initial_poses_.size(), covariances_.size());
+  for (size_t i = 0; i != initial_poses_.size(); ++i) {
+    const Eigen::Vector3d initial_pose(initial_poses_[i].translation().x(),
+                                       initial_poses_[i].translation().y(),
+                                       initial_poses_[i].rotation().angle());
+    const Eigen::Vector3d pose(poses_[i].translation().x(),
+                               poses_[i].translation().y(),
+                               poses_[i].rotation().angle());
+    const double initial_cost =
+        0.5 * ComputeResiduals(initial_poses_[i], initial_pose).squaredNorm();
+    Eigen::MatrixXd jacobian;
+    const Eigen::VectorXd residuals =
+        ComputeResiduals(initial_poses_[i], pose, &jacobian);
+    const double cost = 0.5 * residuals.squaredNorm();
+    EXPECT_LE(cost, initial_cost);
+    // The decrease a Gauss-Newton step would still achieve is negligible.
+    const Eigen::Vector3d gradient = jacobian.transpose() * residuals;
+    const double remaining_decrease =
+        0.5 *
+        gradient.dot((jacobian.transpose() * jacobian).ldlt().solve(gradient));
+    EXPECT_LT(remaining_decrease, 1e-3 * cost)
+        << "Gradient: " << gradient.transpose();
+    const Eigen::Matrix3d expected_covariance =
+        options_.covariance_scale() *
+        (jacobian.transpose() * jacobian).inverse();
+    for (int row = 0; row != 3; ++row) {
+      for (int column = 0; column != 3; ++column) {
+        EXPECT_NEAR(expected_covariance(row, column),
+                    covariances_[i](row, column),
+                    1e-3 * expected_covariance.cwiseAbs().maxCoeff())
+            << "Covariance entry (" << row << ", " << column << ")";
+      }
+    }
+  }
+}
+
+TEST_F(CeresScanMatcherBatchTest, MatchBatchAgreesWithMatch) {
+  // MatchBatch() takes the same steps as Ceres with monotonic steps.
+  ASSERT_EQ(initial_poses_.size(), poses_.size());
+  ASSERT_EQ(initial_poses_.size(), covariances_.size());
+  for (size_t i = 0; i != initial_poses_.size(); ++i) {
+    transform::Rigid2d expected_pose;
+    kalman_filter::Pose2DCovariance expected_covariance;
+    ceres::Solver::Summary summary;
+    monotonic_ceres_scan_matcher_.Match(
+        initial_poses_[i], initial_poses_[i], point_cloud_,
+        *float_probability_grid_, &expected_pose, &expected_covariance,
+        &summary);
+    EXPECT_THAT(poses_[i], transform::IsNearly(expected_pose, 1e-6))
+        << "Actual: " << transform::ToProto(poses_[i]).DebugString()
+        << "\nExpected: " << transform::ToProto(expected_pose).DebugString();
+    for (int row = 0; row != 3; ++row) {
+      for (int column = 0; column != 3; ++column) {
+        EXPECT_NEAR(expected_covariance(row, column),
+                    covariances_[i](row, column),
+                    1e-4 * expected_covariance.cwiseAbs().maxCoeff())
+            << "Covariance entry (" << row << ", " << column << ")";
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_2d
@@ -18,12 +18,47 @@
 
 #include <cmath>
 
+#include "eigen3/Eigen/Geometry"
 #include "../common/math.h"
 
 namespace cartographer {
 namespace mapping_2d {
 namespace scan_matching {
 
+namespace {
+
+// Computes the same rotations as GenerateRotatedScans().
+void ComputeRotations(SearchParameters* const search_parameters)
+{
+  search_parameters->cos_rotations.clear();
+  search_parameters->sin_rotations.clear();
+  search_parameters->cos_rotations.reserve(search_parameters->num_scans);
+  search_parameters->sin_rotations.reserve(search_parameters->num_scans);
+  double delta_theta = -search_parameters->num_angular_perturbations *
+                       search_parameters->angular_perturbation_step_size;
+  for (int scan_index = 0; scan_index < search_parameters->num_scans;
+       ++scan_index,
+           delta_theta += search_parameters->angular_perturbation_step_size)
+  {
+    const Eigen::Matrix2f rotation =
+        Eigen::Rotation2Df(delta_theta).toRotationMatrix();
+    search_parameters->cos_rotations.push_back(rotation(0, 0));
+    search_parameters->sin_rotations.push_back(rotation(1, 0));
+  }
+}
+
+// Same as common::RoundToInt(), i.e. rounding half away from zero, for values
+// in the range of int. It does not call std::lround(), so that loops using it
+// can be vectorized.
+inline int RoundToIntVectorizable(const double value)
+{
+  const int truncated = static_cast<int>(value);
+  const double fraction = value - truncated;
+  return truncated + (fraction >= 0.5) - (fraction <= -0.5);
+}
+
+}  // namespace
+
 /**
  * @brief SearchParameters::SearchParameters
  * 根据设置的线性搜索窗口 & 角度搜索窗口的大小 来计算一些搜索参数。实际的范围是设置的2倍。因为正负都要搜索
@@ -83,6 +118,7 @@ SearchParameters::SearchParameters(const double linear_search_window,
         LinearBounds{-num_linear_perturbations, num_linear_perturbations,
                      -num_linear_perturbations, num_linear_perturbations});
   }
+  ComputeRotations(this);
 }
 
 SearchParameters::SearchParameters(const int num_linear_perturbations,
@@ -101,6 +137,7 @@ SearchParameters::SearchParameters(const int num_linear_perturbations,
         LinearBounds{-num_linear_perturbations, num_linear_perturbations,
                      -num_linear_perturbations, num_linear_perturbations});
   }
+  ComputeRotations(this);
 }
 
 void SearchParameters::ShrinkToFit(const std::vector<DiscreteScan>& scans,
@@ -199,6 +236,67 @@ std::vector<DiscreteScan> DiscretizeScans(
   return discrete_scans;
 }
 
+/**
+ * @brief DiscretizeRotatedScans
+ * 和DiscretizeScans(map_limits, GenerateRotatedScans(point_cloud, search_parameters),
+ * initial_translation)的结果完全一样 但是旋转 平移 离散化在一次循环中完成
+ * 并且结果写到buffer中 buffer可以被重复使用
+ * @param map_limits            地图的分辨率等信息
+ * @param point_cloud           初始角度为0的点云数据
+ * @param search_parameters     对应的搜索参数 包括事先计算好的cos和sin
+ * @param initial_translation   激光数据的原点
+ * @param buffer                用来存放结果的内存
+ * @return                      buffer->discrete_scans
+ */
+const std::vector<DiscreteScan>& DiscretizeRotatedScans(
+    const MapLimits& map_limits, const sensor::PointCloud2D& point_cloud,
+    const SearchParameters& search_parameters,
+    const Eigen::Translation2f& initial_translation,
+    DiscreteScanBuffer* const buffer)
+{
+  CHECK_EQ(search_parameters.cos_rotations.size(),
+           search_parameters.num_scans);
+  const int num_points = point_cloud.size();
+  buffer->x.resize(num_points);
+  buffer->y.resize(num_points);
+  for (int i = 0; i != num_points; ++i)
+  {
+    buffer->x[i] = point_cloud[i].x();
+    buffer->y[i] = point_cloud[i].y();
+  }
+  const float* const x = buffer->x.data();
+  const float* const y = buffer->y.data();
+  const float translation_x = initial_translation.x();
+  const float translation_y = initial_translation.y();
+  // The same arithmetic as MapLimits::GetXYIndexOfCellContainingPoint(), so
+  // that the cells are exactly the same.
+  const double max_x = map_limits.max().x();
+  const double max_y = map_limits.max().y();
+  const double resolution = map_limits.resolution();
+
+  buffer->discrete_scans.resize(search_parameters.num_scans);
+  for (int scan_index = 0; scan_index != search_parameters.num_scans;
+       ++scan_index)
+  {
+    DiscreteScan& discrete_scan = buffer->discrete_scans[scan_index];
+    discrete_scan.resize(num_points);
+    Eigen::Array2i* const xy_indices = discrete_scan.data();
+    const float cos_rotation = search_parameters.cos_rotations[scan_index];
+    const float sin_rotation = search_parameters.sin_rotations[scan_index];
+    for (int i = 0; i < num_points; ++i)
+    {
+      const float rotated_x = cos_rotation * x[i] - sin_rotation * y[i];
+      const float rotated_y = sin_rotation * x[i] + cos_rotation * y[i];
+      xy_indices[i] = Eigen::Array2i(
+          RoundToIntVectorizable(
+              (max_y - (rotated_y + translation_y)) / resolution - 0.5),
+          RoundToIntVectorizable(
+              (max_x - (rotated_x + translation_x)) / resolution - 0.5));
+    }
+  }
+  return buffer->discrete_scans;
+}
+
 }  // namespace scan_matching
 }  // namespace mapping_2d
 }  // namespace cartographer
@@ -68,6 +68,24 @@ struct SearchParameters
   double resolution;                        //占用栅格地图的分辨率
   int num_scans;                            //rotated scan的数量
   std::vector<LinearBounds> linear_bounds;  //每个rotated scan都要有一个对应的linear_bound Per rotated scans.
+
+  // Cosine and sine of the rotation of each rotated scan, so that they are
+  // computed once and not for every point.
+  // 每个rotated scan的旋转角度的cos和sin 事先计算好
+  std::vector<float> cos_rotations;
+  std::vector<float> sin_rotations;
+};
+
+// Scratch memory for DiscretizeRotatedScans(). When the same buffer is used
+// for several scans, memory is only allocated if a scan needs more than any
+// scan before.
+// 用来存放离散化之后的rotated scans 多次匹配的时候重复使用 避免每次都重新分配内存
+struct DiscreteScanBuffer
+{
+  // The point cloud with x and y in separate arrays, which vectorizes better.
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<DiscreteScan> discrete_scans;
 };
 
 // Generates a collection of rotated scans.
@@ -83,6 +101,18 @@ std::vector<DiscreteScan> DiscretizeScans(
     const MapLimits& map_limits, const std::vector<sensor::PointCloud2D>& scans,
     const Eigen::Translation2f& initial_translation);
 
+// Rotates 'point_cloud' by the rotation of each rotated scan, translates it
+// by 'initial_translation' and discretizes it, all in one pass over the
+// points. The result is the same as DiscretizeScans() of
+// GenerateRotatedScans(), but is written to 'buffer' and no intermediate point
+// clouds are created. Returns 'buffer->discrete_scans'.
+// 把GenerateRotatedScans()和DiscretizeScans()合并成一步 直接得到地图坐标
+const std::vector<DiscreteScan>& DiscretizeRotatedScans(
+    const MapLimits& map_limits, const sensor::PointCloud2D& point_cloud,
+    const SearchParameters& search_parameters,
+    const Eigen::Translation2f& initial_translation,
+    DiscreteScanBuffer* buffer);
+
 // A possible solution.
 // 进行scan-match时候的一个可行解 或者说是 一个搜索节点
 struct Candidate
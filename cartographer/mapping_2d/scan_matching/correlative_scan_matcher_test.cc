@@ -16,6 +16,8 @@
 
 #include "../mapping_2d/scan_matching/correlative_scan_matcher.h"
 
+#include <random>
+
 #include "../sensor/point_cloud.h"
 #include "gtest/gtest.h"
 
@@ -96,6 +98,40 @@ TEST(DiscretizeScans, DiscretizeScans) {
   EXPECT_TRUE((Eigen::Array2i(4, 3) == discrete_scans[0][6]).all());
 }
 
+TEST(DiscretizeRotatedScans, MatchesDiscretizeScans) {
+  std::mt19937 prng(42);
+  std::uniform_real_distribution<float> distribution(-10.f, 10.f);
+  const MapLimits map_limits(0.05, Eigen::Vector2d(3., -2.), CellLimits(40, 50));
+  DiscreteScanBuffer buffer;
+  // The buffer is reused for scans with fewer and more points and rotations.
+  for (const int num_points : {100, 30, 200}) {
+    sensor::PointCloud2D point_cloud;
+    for (int i = 0; i != num_points; ++i) {
+      point_cloud.emplace_back(distribution(prng), distribution(prng));
+    }
+    // Points on cell boundaries.
+    point_cloud.emplace_back(0.1f, -0.25f);
+    point_cloud.emplace_back(-3.05f, 2.5f);
+    const SearchParameters search_parameters(0.3, 0.01 * num_points,
+                                             point_cloud, 0.05);
+    const Eigen::Translation2f initial_translation(0.3f, -1.7f);
+    const std::vector<DiscreteScan> expected = DiscretizeScans(
+        map_limits, GenerateRotatedScans(point_cloud, search_parameters),
+        initial_translation);
+    const std::vector<DiscreteScan>& actual = DiscretizeRotatedScans(
+        map_limits, point_cloud, search_parameters, initial_translation,
+        &buffer);
+    EXPECT_EQ(&buffer.discrete_scans, &actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i != expected.size(); ++i) {
+      ASSERT_EQ(expected[i].size(), actual[i].size());
+      for (size_t j = 0; j != expected[i].size(); ++j) {
+        EXPECT_TRUE((expected[i][j] == actual[i][j]).all());
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_2d
@@ -17,13 +17,16 @@
 #include "../mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <deque>
+#include <cstring>
 #include <functional>
 #include <limits>
+#include <utility>
 
 #include "eigen3/Eigen/Geometry"
 #include "../common/math.h"
+#include "../common/parallel_for.h"
 #include "../mapping_2d/probability_grid.h"
 #include "../sensor/point_cloud.h"
 #include "../transform/transform.h"
@@ -35,59 +38,108 @@ namespace scan_matching {
 
 namespace {
 
-// A collection of values which can be added and later removed, and the maximum
-// of the current values in the collection can be retrieved.
-// All of it in (amortized) O(1).
-// 用来储存一些列数据的结构体，这个结构体可以维护这一些列数据中的最大值。
-// 及时对数据进行删除和插入操作　也依然可以得到最大值
-// 这个sliding_window是按照从大到小依次排列的，最大的元素位于队首　最小的位于队尾
-// 这个滑动窗口主要是用来生成地图的时候　求解一个范围内的所有元素的最大值
-class SlidingWindowMaximum
+// Rows are only split between threads in chunks of at least this many rows,
+// smaller grids are not worth starting threads for.
+constexpr int kMinNumRowsPerThread = 64;
+
+// Computes 'target' with limits 'source_limits' grown by 'shift' in x and y.
+// Each cell of 'target' is the maximum of the cells of 'source' at the same
+// index and at the index moved by -'shift' in x, y or both. Cells outside of
+// 'source' count as 0.
+// 一个width的窗口和往前平移shift的窗口合并为width+shift的窗口
+// 这样计算是van Herk/Gil-Werman之外另一种O(1)的滑动窗口最大值算法
+void ComputeShiftedMaximum(const std::vector<uint8>& source,
+                           const CellLimits& source_limits, const int shift,
+                           const int num_threads,
+                           std::vector<uint8>* const target)
 {
- public:
+  const int source_stride = source_limits.num_x_cells;
+  const int target_stride = source_limits.num_x_cells + shift;
+  const int num_target_rows = source_limits.num_y_cells + shift;
+  CHECK_EQ(source.size(), source_stride * source_limits.num_y_cells);
+  target->resize(target_stride * num_target_rows);
+  common::ParallelForRanges(
+      num_target_rows, num_threads, kMinNumRowsPerThread,
+      [&source, &source_limits, shift, source_stride, target_stride,
+       target](const int begin, const int end)
+      {
+        // The maximum of the two source rows of a target row.
+        std::vector<uint8> row_maximum(source_stride);
+        for (int y = begin; y != end; ++y)
+        {
+          const int lower_y = y - shift;
+          const uint8* const lower_row =
+              lower_y >= 0 ? &source[lower_y * source_stride] : nullptr;
+          const uint8* const upper_row = y < source_limits.num_y_cells
+                                             ? &source[y * source_stride]
+                                             : nullptr;
+          if (lower_row != nullptr && upper_row != nullptr)
+          {
+            for (int x = 0; x != source_stride; ++x)
+            {
+              row_maximum[x] = std::max(lower_row[x], upper_row[x]);
+            }
+          }
+          else
+          {
+            std::copy(lower_row != nullptr ? lower_row : upper_row,
+                      (lower_row != nullptr ? lower_row : upper_row) +
+                          source_stride,
+                      row_maximum.begin());
+          }
+
+          // Same in x: 'target_row[x]' is the maximum of 'row_maximum' at
+          // x - 'shift' and x.
+          uint8* const target_row = &(*target)[y * target_stride];
+          std::fill(target_row, target_row + target_stride, 0);
+          for (int x = 0; x != source_stride; ++x)
+          {
+            target_row[x] = row_maximum[x];
+          }
+          for (int x = 0; x != source_stride; ++x)
+          {
+            target_row[x + shift] =
+                std::max(target_row[x + shift], row_maximum[x]);
+          }
+        }
+      });
+}
 
-  //插入一个值　找到sliding window中的位置
-  void AddValue(const float value)
+// Scores the 'kNumCandidates' candidates starting at 'candidates[begin]' at
+// once, if they all belong to the same rotated scan. Returns false otherwise.
+// 如果从begin开始的kNumCandidates个候选解属于同一个旋转角度 则一次计算它们的得分
+template <int kNumCandidates>
+bool ScoreCandidatesOfSameScan(const PrecomputationGrid& precomputation_grid,
+                               const std::vector<DiscreteScan>& discrete_scans,
+                               const size_t begin,
+                               std::vector<Candidate>* const candidates)
+{
+  if (begin + kNumCandidates > candidates->size())
   {
-    while (!non_ascending_maxima_.empty() &&
-           value > non_ascending_maxima_.back())
-    {
-      non_ascending_maxima_.pop_back();
-    }
-    non_ascending_maxima_.push_back(value);
+    return false;
   }
-
-  //删除值　每次只能删除最大的值
-  void RemoveValue(const float value)
+  Candidate* const batch = &(*candidates)[begin];
+  std::array<Eigen::Array2i, kNumCandidates> offsets;
+  for (int k = 0; k != kNumCandidates; ++k)
   {
-    // DCHECK for performance, since this is done for every value in the
-    // precomputation grid.
-    DCHECK(!non_ascending_maxima_.empty());
-    DCHECK_LE(value, non_ascending_maxima_.front());
-
-    if (value == non_ascending_maxima_.front())
+    if (batch[k].scan_index != batch[0].scan_index)
     {
-      non_ascending_maxima_.pop_front();
+      return false;
     }
+    offsets[k] = Eigen::Array2i(batch[k].x_index_offset,
+                                batch[k].y_index_offset);
   }
-
-  //在预先计算地图的时候　每个栅格都需要用这个函数进行计算
-  float GetMaximum() const
+  const DiscreteScan& discrete_scan = discrete_scans[batch[0].scan_index];
+  std::array<int, kNumCandidates> sums;
+  sums.fill(0);
+  precomputation_grid.SumValues<kNumCandidates>(discrete_scan, offsets, &sums);
+  for (int k = 0; k != kNumCandidates; ++k)
   {
-    // DCHECK for performance, since this is done for every value in the
-    // precomputation grid.
-    DCHECK_GT(non_ascending_maxima_.size(), 0);
-    return non_ascending_maxima_.front();
+    batch[k].score = PrecomputationGrid::ToProbability(
+        sums[k] / static_cast<float>(discrete_scan.size()));
   }
-
-  void CheckIsEmpty() const { CHECK_EQ(non_ascending_maxima_.size(), 0); }
-
- private:
-  // Maximum of the current sliding window at the front. Then the maximum of the
-  // remaining window that came after this values first occurence, and so on.
-  // 这个sliding　window的最大值位于队列的首位
-  std::deque<float> non_ascending_maxima_;
-};
+  return true;
+}
 
 }  // namespace
 
@@ -115,123 +167,91 @@ CreateFastCorrelativeScanMatcherOptions(
  * @param limits                            地图的参数(原始地图的参数　大小 x方向和y方向的cell的数量)
  * @param width                             地图的宽度(地图是正方形的)　可以认为是地图的分辨率 width*width个原始地图栅格合成一个
  * @param reusable_intermediate_grid        可以重复使用的中间栅格 用来计算最大值的一个中间值
+ * @param num_threads                       用来并行计算各行的线程数
  */
 PrecomputationGrid::PrecomputationGrid(
     const ProbabilityGrid& probability_grid,
     const CellLimits& limits,
     const int width,
-    std::vector<float>* reusable_intermediate_grid)
+    std::vector<uint8>* reusable_intermediate_grid,
+    const int num_threads)
     : offset_(-width + 1, -width + 1),
       wide_limits_(limits.num_x_cells + width - 1,
-                   limits.num_y_cells + width - 1),
-      cells_(wide_limits_.num_x_cells * wide_limits_.num_y_cells)
+                   limits.num_y_cells + width - 1)
 {
   CHECK_GE(width, 1);
   CHECK_GE(limits.num_x_cells, 1);
   CHECK_GE(limits.num_y_cells, 1);
 
-  //地图的一行的栅格数量　这个地图的栅格数量在原始地图的基础上增加了width-1个 因为原始地图的边界元素也需要做同样的修改
-  const int stride = wide_limits_.num_x_cells;
-
-  // First we compute the maximum probability for each (x0, y) achieved in the
-  // span defined by x0 <= x < x0 + width.
-  //　保持y的分辨率不变　把x0分割为长度为width的线段　并且求解每个线段的中的最大值
-  std::vector<float>& intermediate = *reusable_intermediate_grid;
-
-  //重新设置大小
-  intermediate.resize(wide_limits_.num_x_cells * limits.num_y_cells);
-
-  //枚举原始地图所有的y　这里是把每一行分为width的段，求解出每个width的段的最大值
-  for (int y = 0; y != limits.num_y_cells; ++y)
-  {
-    SlidingWindowMaximum current_values;
-
-    //设置0
-    current_values.AddValue(
-        probability_grid.GetProbability(Eigen::Array2i(0, y)));
-
-    //求x=(1,width-1)区间的最大值　上面已经加入了0　因此总的东西是(0,width-1)
-    for (int x = -width + 1; x != 0; ++x)
-    {
-      intermediate[x + width - 1 + y * stride] = current_values.GetMaximum();
-
-      if (x + width < limits.num_x_cells)
+  // ComputeCellValue() is monotonic, so the maximum can be taken after the
+  // conversion to uint8. First convert every cell of the probability grid.
+  // 先把概率转换为CellValue 之后全部在uint8上计算最大值
+  cells_.resize(limits.num_x_cells * limits.num_y_cells);
+  common::ParallelForRanges(
+      limits.num_y_cells, num_threads, kMinNumRowsPerThread,
+      [this, &probability_grid, &limits](const int begin, const int end)
       {
-        current_values.AddValue(
-            probability_grid.GetProbability(Eigen::Array2i(x + width, y)));
-      }
-    }
-
-    //求x=(width,limits.num_x_cells)区间的最大值
-    for (int x = 0; x < limits.num_x_cells - width; ++x)
-    {
-      intermediate[x + width - 1 + y * stride] = current_values.GetMaximum();
-
-      //求出(x,y)加入(x_width,y) 相当于窗口进行滑动，在x轴进行滑动
-      current_values.RemoveValue(
-          probability_grid.GetProbability(Eigen::Array2i(x, y)));
-
-      current_values.AddValue(
-          probability_grid.GetProbability(Eigen::Array2i(x + width, y)));
-    }
-
-    for (int x = std::max(limits.num_x_cells - width, 0);
-         x != limits.num_x_cells; ++x)
-    {
-      intermediate[x + width - 1 + y * stride] = current_values.GetMaximum();
-      current_values.RemoveValue(
-          probability_grid.GetProbability(Eigen::Array2i(x, y)));
-    }
-    current_values.CheckIsEmpty();
-  }
-
-
-  // For each (x, y), we compute the maximum probability in the width x width
-  // region starting at each (x, y) and precompute the resulting bound on the
-  // score.
-  // 对应每个(x,y)，我们都需要计算周围width*width的范围对应的栅格的最大值　作为当前的值
-  // 这里枚举的是要生成的地图的每一个x的栅格值
-
-  // 经过上面的计算　intermediate的每一个行元素存储的都是一个width线段的最大值。
-  // 这里的width线段是当前点i和i+width-1这一段的值
-  // 下面的功能基本上是一样的，不过因为intermediate已经计算出来了，是width的线段的最大值
-  // 这里计算的就是width*width里面的最大值
-  for (int x = 0; x != wide_limits_.num_x_cells; ++x)
+        for (int y = begin; y != end; ++y)
+        {
+          for (int x = 0; x != limits.num_x_cells; ++x)
+          {
+            cells_[x + y * limits.num_x_cells] = ComputeCellValue(
+                probability_grid.GetProbability(Eigen::Array2i(x, y)));
+          }
+        }
+      });
+
+  // Then repeatedly double the window while possible, and finally grow it by
+  // the remainder: a window of width w is covered by two windows of width
+  // p <= w which are w - p cells apart.
+  // 窗口宽度不断翻倍 最后再用两个重叠的窗口凑出width
+  std::vector<uint8>& intermediate = *reusable_intermediate_grid;
+  CellLimits current_limits = limits;
+  int current_width = 1;
+  while (current_width != width)
   {
+    const int shift = std::min(current_width, width - current_width);
+    ComputeShiftedMaximum(cells_, current_limits, shift, num_threads,
+                          &intermediate);
+    cells_.swap(intermediate);
+    current_limits.num_x_cells += shift;
+    current_limits.num_y_cells += shift;
+    current_width += shift;
+  }
+  CHECK_EQ(cells_.size(), wide_limits_.num_x_cells * wide_limits_.num_y_cells);
+}
 
-    SlidingWindowMaximum current_values;
-    current_values.AddValue(intermediate[x]);
-
-    //求解第x列的　(0,width-1)的最大值　并且赋值给cells_
-    for (int y = -width + 1; y != 0; ++y)
-    {
-      cells_[x + (y + width - 1) * stride] =
-          ComputeCellValue(current_values.GetMaximum());
-      if (y + width < limits.num_y_cells)
-      {
-        current_values.AddValue(intermediate[x + (y + width) * stride]);
-      }
-    }
-
-    //窗口开始滑动　每入一个　就出一个　按照y的方向滑动.
+PrecomputationGrid::PrecomputationGrid(const PrecomputationGrid& narrower_grid,
+                                       const int shift, const int num_threads)
+    : offset_(narrower_grid.offset_ - shift),
+      wide_limits_(narrower_grid.wide_limits_.num_x_cells + shift,
+                   narrower_grid.wide_limits_.num_y_cells + shift)
+{
+  CHECK_GE(shift, 1);
+  CHECK_LE(shift, narrower_grid.width());
+  ComputeShiftedMaximum(narrower_grid.cells_, narrower_grid.wide_limits_,
+                        shift, num_threads, &cells_);
+}
 
-    for (int y = 0; y < limits.num_y_cells - width; ++y)
-    {
-      cells_[x + (y + width - 1) * stride] =
-          ComputeCellValue(current_values.GetMaximum());
-      current_values.RemoveValue(intermediate[x + y * stride]);
-      current_values.AddValue(intermediate[x + (y + width) * stride]);
-    }
+PrecomputationGrid::PrecomputationGrid(
+    const proto::PrecomputationGridStack::PrecomputationGrid& proto)
+    : offset_(proto.offset_x(), proto.offset_y()),
+      wide_limits_(proto.num_x_cells(), proto.num_y_cells()),
+      cells_(proto.cells().begin(), proto.cells().end())
+{
+  CHECK_EQ(cells_.size(), wide_limits_.num_x_cells * wide_limits_.num_y_cells);
+}
 
-    for (int y = std::max(limits.num_y_cells - width, 0);
-         y != limits.num_y_cells; ++y)
-    {
-      cells_[x + (y + width - 1) * stride] =
-          ComputeCellValue(current_values.GetMaximum());
-      current_values.RemoveValue(intermediate[x + y * stride]);
-    }
-    current_values.CheckIsEmpty();
-  }
+proto::PrecomputationGridStack::PrecomputationGrid PrecomputationGrid::ToProto()
+    const
+{
+  proto::PrecomputationGridStack::PrecomputationGrid proto;
+  proto.set_offset_x(offset_.x());
+  proto.set_offset_y(offset_.y());
+  proto.set_num_x_cells(wide_limits_.num_x_cells);
+  proto.set_num_y_cells(wide_limits_.num_y_cells);
+  proto.set_cells(cells_.data(), cells_.size());
+  return proto;
 }
 
 /**
@@ -248,67 +268,75 @@ uint8 PrecomputationGrid::ComputeCellValue(const float probability) const
       (probability - mapping::kMinProbability) *
       (255.f / (mapping::kMaxProbability - mapping::kMinProbability)));
 
-  assert()
-
   CHECK_GE(cell_value, 0);
   CHECK_LE(cell_value, 255);
   return cell_value;
 }
 
-/**
- * @brief The PrecomputationGridStack class
- * 这里面用的Multi-Level Resolution方法。
- * 因此要计算很多个尺度长的computation Grid。
- * 这个PrecomputationGridStack()里面就存储了一系列的不同分辨率的Computation Grid
- */
-class PrecomputationGridStack
+PrecomputationGridStack::PrecomputationGridStack(
+    const ProbabilityGrid& probability_grid,
+    const proto::FastCorrelativeScanMatcherOptions& options,
+    const int num_threads)
 {
- public:
-  PrecomputationGridStack(
-      const ProbabilityGrid& probability_grid,
-      const proto::FastCorrelativeScanMatcherOptions& options)
+  //最粗的分辨率　这个是由分枝定界的深度决定的。
+  CHECK_GE(options.branch_and_bound_depth(), 1);
+
+  //GridStack中地图的个数 即地图分为多少分辨率的
+  // Reserved up front, since every grid is computed from a reference to the
+  // previous one.
+  precomputation_grids_.reserve(options.branch_and_bound_depth());
+
+  //最细的分辨率 origin_resolution 直接由概率地图得到
+  std::vector<uint8> unused_intermediate_grid;
+  precomputation_grids_.emplace_back(probability_grid,
+                                     probability_grid.limits().cell_limits(),
+                                     1, &unused_intermediate_grid, num_threads);
+
+  //构造各个不同分辨率的栅格地图
+  //width表示不同分辨率的栅格
+  //1表示　最细的分辨率 origin_resolutino
+  //2表示　　２*origin_resolution
+  //4表示　　4*origin_resolution
+  //8表示　　8*origin_resolution
+  //每一层都由上一层把窗口翻倍得到
+  for (int i = 1; i != options.branch_and_bound_depth(); ++i)
   {
-    //最粗的分辨率　这个是由分枝定界的深度决定的。
-    CHECK_GE(options.branch_and_bound_depth(), 1);
-    const int max_width = 1 << (options.branch_and_bound_depth() - 1);
-
-    //GridStack中地图的个数 即地图分为多少分辨率的
-    precomputation_grids_.reserve(options.branch_and_bound_depth());
-
-    //可以重复使用的中间栅格
-    std::vector<float> reusable_intermediate_grid;
-    const CellLimits limits = probability_grid.limits().cell_limits();
-
-    reusable_intermediate_grid.reserve((limits.num_x_cells + max_width - 1) *
-                                       limits.num_y_cells);
-
-    //构造各个不同分辨率的栅格地图
-    //width表示不同分辨率的栅格
-    //1表示　最细的分辨率 origin_resolutino
-    //2表示　　２*origin_resolution
-    //4表示　　4*origin_resolution
-    //8表示　　8*origin_resolution
-    for (int i = 0; i != options.branch_and_bound_depth(); ++i)
-    {
-      //表示步长
-      const int width = 1 << i;
-      precomputation_grids_.emplace_back(probability_grid, limits, width,
-                                         &reusable_intermediate_grid);
-    }
+    const PrecomputationGrid& narrower_grid = precomputation_grids_.back();
+    precomputation_grids_.emplace_back(narrower_grid, narrower_grid.width(),
+                                       num_threads);
   }
+}
 
-  //得到index对应的栅格地图　index表示深度
-  const PrecomputationGrid& Get(int index)
+PrecomputationGridStack::PrecomputationGridStack(
+    const proto::PrecomputationGridStack& proto)
+{
+  CHECK_GE(proto.grid_size(), 1);
+  precomputation_grids_.reserve(proto.grid_size());
+  for (const auto& grid_proto : proto.grid())
   {
-    return precomputation_grids_[index];
+    precomputation_grids_.emplace_back(grid_proto);
   }
+}
 
-  //最多有多少个分辨率
-  int max_depth() const { return precomputation_grids_.size() - 1; }
+proto::PrecomputationGridStack PrecomputationGridStack::ToProto() const
+{
+  proto::PrecomputationGridStack proto;
+  for (const PrecomputationGrid& precomputation_grid : precomputation_grids_)
+  {
+    *proto.add_grid() = precomputation_grid.ToProto();
+  }
+  return proto;
+}
 
- private:
-  std::vector<PrecomputationGrid> precomputation_grids_;
-};
+size_t PrecomputationGridStack::MemoryUsage() const
+{
+  size_t bytes = sizeof(*this);
+  for (const PrecomputationGrid& precomputation_grid : precomputation_grids_)
+  {
+    bytes += sizeof(PrecomputationGrid) + precomputation_grid.MemoryUsage();
+  }
+  return bytes;
+}
 
 FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
     const ProbabilityGrid& probability_grid,
@@ -316,7 +344,21 @@ FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
     : options_(options),
       limits_(probability_grid.limits()),
       precomputation_grid_stack_(
-          new PrecomputationGridStack(probability_grid, options)) {}
+          std::make_shared<const PrecomputationGridStack>(probability_grid,
+                                                          options)) {}
+
+FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
+    const ProbabilityGrid& probability_grid,
+    std::shared_ptr<const PrecomputationGridStack> precomputation_grid_stack,
+    const proto::FastCorrelativeScanMatcherOptions& options)
+    : options_(options),
+      limits_(probability_grid.limits()),
+      precomputation_grid_stack_(std::move(precomputation_grid_stack))
+{
+  CHECK(precomputation_grid_stack_ != nullptr);
+  CHECK_EQ(precomputation_grid_stack_->max_depth() + 1,
+           options_.branch_and_bound_depth());
+}
 
 FastCorrelativeScanMatcher::~FastCorrelativeScanMatcher() {}
 
@@ -334,7 +376,8 @@ FastCorrelativeScanMatcher::~FastCorrelativeScanMatcher() {}
 bool FastCorrelativeScanMatcher::Match(
     const transform::Rigid2d& initial_pose_estimate,
     const sensor::PointCloud2D& point_cloud, const float min_score,
-    float* score, transform::Rigid2d* pose_estimate) const
+    float* score, transform::Rigid2d* pose_estimate,
+    const int num_threads) const
 {
   //设置搜索参数
   const SearchParameters search_parameters(options_.linear_search_window(),
@@ -344,7 +387,8 @@ bool FastCorrelativeScanMatcher::Match(
   //用这个参数进行匹配
   return MatchWithSearchParameters(search_parameters, initial_pose_estimate,
                                    point_cloud, min_score, score,
-                                   pose_estimate);
+                                   pose_estimate, num_threads,
+                                   0 /* search_index */, nullptr);
 }
 
 /**
@@ -362,7 +406,30 @@ bool FastCorrelativeScanMatcher::MatchFullSubmap(
     const sensor::PointCloud2D& point_cloud,
     float min_score,
     float* score,
-    transform::Rigid2d* pose_estimate) const
+    transform::Rigid2d* pose_estimate,
+    const int num_threads) const
+{
+  return MatchInFullSubmap(point_cloud, min_score, score, pose_estimate,
+                           num_threads, 0 /* search_index */, nullptr);
+}
+
+bool FastCorrelativeScanMatcher::MatchFullSubmap(
+    const sensor::PointCloud2D& point_cloud, const int search_index,
+    BestScoreSoFar* const best_score_so_far, float* const score,
+    transform::Rigid2d* const pose_estimate) const
+{
+  CHECK_NOTNULL(best_score_so_far);
+  return MatchInFullSubmap(point_cloud,
+                           best_score_so_far->MinScore(search_index), score,
+                           pose_estimate, 1 /* num_threads */, search_index,
+                           best_score_so_far);
+}
+
+bool FastCorrelativeScanMatcher::MatchInFullSubmap(
+    const sensor::PointCloud2D& point_cloud, const float min_score,
+    float* const score, transform::Rigid2d* const pose_estimate,
+    const int num_threads, const int search_index,
+    BestScoreSoFar* const best_score_so_far) const
 {
   // Compute a search window around the center of the submap that includes it
   // fully.
@@ -380,7 +447,9 @@ bool FastCorrelativeScanMatcher::MatchFullSubmap(
                           limits_.cell_limits().num_x_cells));
 
   return MatchWithSearchParameters(search_parameters, center, point_cloud,
-                                   min_score, score, pose_estimate);
+                                   min_score, score, pose_estimate,
+                                   num_threads, search_index,
+                                   best_score_so_far);
 }
 
 /**
@@ -395,6 +464,8 @@ bool FastCorrelativeScanMatcher::MatchFullSubmap(
  * @param min_score                 接受位姿的最小的得分
  * @param score                     最优位姿的得分
  * @param pose_estimate             最优位姿
+ * @param search_index              多个submap并行搜索时 这次搜索的编号
+ * @param best_score_so_far         多个submap并行搜索时 共享的最优得分 否则为nullptr
  * @return
  */
 bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
@@ -403,9 +474,13 @@ bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
     const sensor::PointCloud2D& point_cloud,
     float min_score,
     float* score,
-    transform::Rigid2d* pose_estimate) const
+    transform::Rigid2d* pose_estimate,
+    const int num_threads,
+    const int search_index,
+    BestScoreSoFar* const best_score_so_far) const
 {
   CHECK_NOTNULL(score);
+  CHECK_GE(num_threads, 1);
   CHECK_NOTNULL(pose_estimate);
 
   //把激光数据旋转到世界坐标系中的0度的位置
@@ -415,17 +490,15 @@ bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
           point_cloud,
           transform::Rigid2d::Rotation(initial_rotation).cast<float>());
 
-  //生成一系列的rotated scans
-  const std::vector<sensor::PointCloud2D> rotated_scans =
-      GenerateRotatedScans(rotated_point_cloud, search_parameters);
-
-  //把上面的rotated scans转换到世界坐标系中 然后转换到地图坐标系中
+  //生成一系列的rotated scans 并转换到世界坐标系中 然后转换到地图坐标系中
   //这里之后，所有激光点的坐标走在世界坐标系中了　或者说地图坐标系中。
   //这里的离散激光点　是在最细的分辨率的地图上面
-  const std::vector<DiscreteScan> discrete_scans = DiscretizeScans(
-      limits_, rotated_scans,
+  DiscreteScanBuffer discrete_scan_buffer;
+  const std::vector<DiscreteScan>& discrete_scans = DiscretizeRotatedScans(
+      limits_, rotated_point_cloud, search_parameters,
       Eigen::Translation2f(initial_pose_estimate.translation().x(),
-                           initial_pose_estimate.translation().y()));
+                           initial_pose_estimate.translation().y()),
+      &discrete_scan_buffer);
 
   search_parameters.ShrinkToFit(discrete_scans, limits_.cell_limits());
 
@@ -436,9 +509,17 @@ bool FastCorrelativeScanMatcher::MatchWithSearchParameters(
       ComputeLowestResolutionCandidates(discrete_scans, search_parameters);
 
   //用分枝定界方法来计算最优的候选解
-  const Candidate best_candidate = BranchAndBound(
-      discrete_scans, search_parameters, lowest_resolution_candidates,
-      precomputation_grid_stack_->max_depth(), min_score);
+  //多个submap并行搜索时 单个submap内部不再并行 而是和其他submap的最优解比较来进行剪枝
+  const Candidate best_candidate =
+      best_score_so_far == nullptr && num_threads > 1 &&
+              precomputation_grid_stack_->max_depth() > 0
+          ? ParallelBranchAndBound(discrete_scans, search_parameters,
+                                   lowest_resolution_candidates, min_score,
+                                   num_threads)
+          : BranchAndBound(discrete_scans, search_parameters,
+                           lowest_resolution_candidates,
+                           precomputation_grid_stack_->max_depth(), min_score,
+                           search_index, best_score_so_far);
 
   //如果计算出来的解大于最小的阈值 则认为匹配成功，返回对应的位姿
   if (best_candidate.score > min_score)
@@ -550,8 +631,27 @@ void FastCorrelativeScanMatcher::ScoreCandidates(
     std::vector<Candidate>* const candidates) const
 {
   //枚举所有的候选解
-  for (Candidate& candidate : *candidates)
+  for (size_t i = 0; i != candidates->size();)
   {
+    // Lowest resolution candidates come in long runs for the same rotated
+    // scan, higher resolution candidates in groups of 4 children. Score them
+    // several at a time where possible.
+    // 尽量一次计算多个候选解的得分
+    if (ScoreCandidatesOfSameScan<8>(precomputation_grid, discrete_scans, i,
+                                     candidates))
+    {
+      i += 8;
+      continue;
+    }
+    if (ScoreCandidatesOfSameScan<4>(precomputation_grid, discrete_scans, i,
+                                     candidates))
+    {
+      i += 4;
+      continue;
+    }
+
+    Candidate& candidate = (*candidates)[i];
+    ++i;
     int sum = 0;
     //每个候选解 枚举所有的激光点 累计占用概率log-odd
     //这里都是固定的角度的，因此激光点的坐标就等于激光点在车体坐标系的坐标加上候选解的坐标
@@ -582,6 +682,8 @@ void FastCorrelativeScanMatcher::ScoreCandidates(
  * @param candidates                所有的可行解
  * @param candidate_depth           地图的层数(Multi-Level里面有多少个Level)　当前节点的深度　也就是当前节点的地图的层数
  * @param min_score                 能接受的最小的分数(也可以认为是当前的最优解的得分 凡是比当前最优解低的分数 一律不要)
+ * @param root_index                并行搜索时 这颗子树所属的最低分辨率候选解的下标
+ * @param best_score_so_far         并行搜索时 所有线程共享的最优得分 单线程时为nullptr
  * 在分枝定界的方法中，一节node只表示一个角度。
  * 因此实际构造的束的根节点下面有N个1层子节点，N=rotated scans的数量。
  * 然后每个1层的节点下面都是4个子节点
@@ -594,7 +696,9 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
     const SearchParameters& search_parameters,
     const std::vector<Candidate>& candidates,
     const int candidate_depth,
-    float min_score) const
+    float min_score,
+    const int root_index,
+    BestScoreSoFar* const best_score_so_far) const
 {
   //如果只有一层 那么最低分辨率中最好的就是全局最好的，直接返回
   //相当于是叶子节点 这个分数会用来更新父节点的best_score。
@@ -616,7 +720,13 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
     //因为候选解是按照分数从大到小排列的
     //在进行迭代的时候，这个min_score是会不断的进行更新的。因为会不断的进行搜索。每次在子节点搜索到更优的解。这个值就会被更新。
     //min_score只有最最底层的叶子节点的时候，才会进行更新。
-    if (candidate.score <= min_score)
+    if (candidate.score <= best_high_resolution_candidate.score)
+    {
+      break;
+    }
+    // 并行搜索时 也要和其他线程找到的最优解比较来进行剪枝
+    if (best_score_so_far != nullptr &&
+        candidate.score <= best_score_so_far->MinScore(root_index))
     {
       break;
     }
@@ -657,11 +767,79 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
 
     //进行迭代求解最优值 这里相当于传进去最新的best_score来作为子节点的min_score
     //注意这个best_score相当于这颗子树下面的所有叶子节点的best_score
-    best_high_resolution_candidate = std::max(
-        best_high_resolution_candidate,
-        BranchAndBound(discrete_scans, search_parameters,
-                       higher_resolution_candidates, candidate_depth - 1,
-                       best_high_resolution_candidate.score));
+    const Candidate best_child = BranchAndBound(
+        discrete_scans, search_parameters, higher_resolution_candidates,
+        candidate_depth - 1, best_high_resolution_candidate.score, root_index,
+        best_score_so_far);
+    if (best_high_resolution_candidate < best_child)
+    {
+      best_high_resolution_candidate = best_child;
+      if (best_score_so_far != nullptr)
+      {
+        best_score_so_far->Update(best_child.score, root_index);
+      }
+    }
+  }
+  return best_high_resolution_candidate;
+}
+
+Candidate FastCorrelativeScanMatcher::ParallelBranchAndBound(
+    const std::vector<DiscreteScan>& discrete_scans,
+    const SearchParameters& search_parameters,
+    const std::vector<Candidate>& lowest_resolution_candidates,
+    const float min_score,
+    const int num_threads) const
+{
+  const int num_candidates = lowest_resolution_candidates.size();
+  BestScoreSoFar best_score_so_far(min_score);
+  // Each thread takes the next lowest resolution candidate in order of
+  // decreasing score, so that good candidates are found early.
+  std::vector<Candidate> best_candidates;
+  best_candidates.reserve(num_candidates);
+  std::vector<char> found(num_candidates, false);
+  for (const Candidate& candidate : lowest_resolution_candidates)
+  {
+    best_candidates.push_back(candidate);
+  }
+
+  std::atomic<bool> done(false);
+  common::ParallelFor(
+      num_candidates, num_threads,
+      [&](const int i)
+      {
+        if (done.load(std::memory_order_relaxed))
+        {
+          return;
+        }
+        const float root_min_score = best_score_so_far.MinScore(i);
+        if (lowest_resolution_candidates[i].score <= root_min_score)
+        {
+          // All remaining candidates have lower or equal scores.
+          done.store(true, std::memory_order_relaxed);
+          return;
+        }
+        const Candidate best_candidate = BranchAndBound(
+            discrete_scans, search_parameters,
+            {lowest_resolution_candidates[i]},
+            precomputation_grid_stack_->max_depth(), root_min_score, i,
+            &best_score_so_far);
+        if (best_candidate.score > root_min_score)
+        {
+          best_candidates[i] = best_candidate;
+          found[i] = true;
+        }
+      });
+
+  // Same as the single-threaded search: the best score wins, and on ties the
+  // candidate which it would have found first.
+  Candidate best_high_resolution_candidate(0, 0, 0, search_parameters);
+  best_high_resolution_candidate.score = min_score;
+  for (int i = 0; i != num_candidates; ++i)
+  {
+    if (found[i] && best_high_resolution_candidate < best_candidates[i])
+    {
+      best_high_resolution_candidate = best_candidates[i];
+    }
   }
   return best_high_resolution_candidate;
 }
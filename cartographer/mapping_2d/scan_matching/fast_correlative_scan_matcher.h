@@ -33,6 +33,11 @@
 #ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_FAST_CORRELATIVE_SCAN_MATCHER_H_
 #define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_FAST_CORRELATIVE_SCAN_MATCHER_H_
 
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <vector>
 
@@ -43,6 +48,7 @@
 #include "../sensor/point_cloud.h"
 
 #include "cartographer/mapping_2d/scan_matching/proto/fast_correlative_scan_matcher_options.pb.h"
+#include "cartographer/mapping_2d/scan_matching/proto/precomputation_grid_stack.pb.h"
 
 namespace cartographer {
 namespace mapping_2d {
@@ -60,9 +66,30 @@ CreateFastCorrelativeScanMatcherOptions(
 class PrecomputationGrid
 {
  public:
+  // Rows are computed on up to 'num_threads' threads, including the calling
+  // thread.
   PrecomputationGrid(const ProbabilityGrid& probability_grid,
                      const CellLimits& limits, int width,
-                     std::vector<float>* reusable_intermediate_grid);
+                     std::vector<uint8>* reusable_intermediate_grid,
+                     int num_threads = 1);
+
+  // Computes the grid of width 'narrower_grid.width()' + 'shift' from
+  // 'narrower_grid' without going back to the probability grid: the window of
+  // each cell is covered by two overlapping narrower windows per axis. With
+  // 'shift' == 'narrower_grid.width()' this doubles the width.
+  // 由上一层地图直接计算 每个格子只需要取4个值的最大值
+  PrecomputationGrid(const PrecomputationGrid& narrower_grid, int shift,
+                     int num_threads = 1);
+
+  // Restores a grid serialized by ToProto(). The 'proto' must be consistent,
+  // see IsValidPrecomputationGridStack().
+  explicit PrecomputationGrid(
+      const proto::PrecomputationGridStack::PrecomputationGrid& proto);
+
+  proto::PrecomputationGridStack::PrecomputationGrid ToProto() const;
+
+  // Side length of the window of each cell in cells of the probability grid.
+  int width() const { return 1 - offset_.x(); }
 
   // Returns a value between 0 and 255 to represent probabilities between
   // kMinProbability and kMaxProbability.
@@ -89,6 +116,53 @@ class PrecomputationGrid
     return cells_[local_xy_index.x() + local_xy_index.y() * stride];
   }
 
+  // For each k in [0, kNumCandidates), adds the sum of GetValue() over all
+  // 'xy_indices' shifted by 'offsets[k]' to '(*sums)[k]'. The shifted cells of
+  // one index are a constant number of cells apart in memory. If they all lie
+  // in the bounding box of 'offsets' within the grid, a single bounds check is
+  // done for all of them and the inner loop can be vectorized.
+  // 一次计算kNumCandidates个候选解的得分
+  template <int kNumCandidates>
+  void SumValues(const DiscreteScan& xy_indices,
+                 const std::array<Eigen::Array2i, kNumCandidates>& offsets,
+                 std::array<int, kNumCandidates>* const sums) const
+  {
+    const int stride = wide_limits_.num_x_cells;
+    Eigen::Array2i min_offset = offsets[0];
+    Eigen::Array2i max_offset = offsets[0];
+    std::array<int, kNumCandidates> cell_offsets;
+    for (int k = 0; k != kNumCandidates; ++k)
+    {
+      min_offset = min_offset.min(offsets[k]);
+      max_offset = max_offset.max(offsets[k]);
+      const Eigen::Array2i delta = offsets[k] - offsets[0];
+      cell_offsets[k] = delta.x() + delta.y() * stride;
+    }
+    std::array<int, kNumCandidates>& candidate_sums = *sums;
+    for (const Eigen::Array2i& xy_index : xy_indices)
+    {
+      const Eigen::Array2i local_xy_index = xy_index - offset_;
+      if (Contains(local_xy_index + min_offset) &&
+          Contains(local_xy_index + max_offset))
+      {
+        const uint8* const cells =
+            &cells_[(local_xy_index.x() + offsets[0].x()) +
+                    (local_xy_index.y() + offsets[0].y()) * stride];
+        for (int k = 0; k != kNumCandidates; ++k)
+        {
+          candidate_sums[k] += cells[cell_offsets[k]];
+        }
+      }
+      else
+      {
+        for (int k = 0; k != kNumCandidates; ++k)
+        {
+          candidate_sums[k] += GetValue(xy_index + offsets[k]);
+        }
+      }
+    }
+  }
+
   // Maps values from [0, 255] to [kMinProbability, kMaxProbability].
   // 把CellValue转换为占用概率
   static float ToProbability(float value)
@@ -98,10 +172,22 @@ class PrecomputationGrid
                ((mapping::kMaxProbability - mapping::kMinProbability) / 255.f);
   }
 
+  // Number of bytes used by the cells of this grid.
+  size_t MemoryUsage() const { return cells_.capacity() * sizeof(uint8); }
+
  private:
   //把占用概率转换为CellValue
   uint8 ComputeCellValue(float probability) const;
 
+  // Returns true if 'local_xy_index' relative to 'offset_' is in the grid.
+  bool Contains(const Eigen::Array2i& local_xy_index) const
+  {
+    return static_cast<unsigned>(local_xy_index.x()) <
+               static_cast<unsigned>(wide_limits_.num_x_cells) &&
+           static_cast<unsigned>(local_xy_index.y()) <
+               static_cast<unsigned>(wide_limits_.num_y_cells);
+  }
+
   // Offset of the precomputation grid in relation to the 'probability_grid'
   // including the additional 'width' - 1 cells.
   // 预计算地图　和　概率地图的唯一关系
@@ -118,8 +204,111 @@ class PrecomputationGrid
   std::vector<uint8> cells_;
 };
 
-//用来存储一系列不同分辨率的PrecomputationGrid
-class PrecomputationGridStack;
+// 这里面用的Multi-Level Resolution方法。
+// 因此要计算很多个尺度长的computation Grid。
+// 这个PrecomputationGridStack里面就存储了一系列的不同分辨率的PrecomputationGrid
+// The stack only depends on the probability grid and the
+// 'branch_and_bound_depth', so it can be shared between several
+// FastCorrelativeScanMatcher of the same finished submap.
+class PrecomputationGridStack
+{
+ public:
+  // Each grid is derived from the previous one on up to 'num_threads'
+  // threads, including the calling thread.
+  PrecomputationGridStack(
+      const ProbabilityGrid& probability_grid,
+      const proto::FastCorrelativeScanMatcherOptions& options,
+      int num_threads = 1);
+
+  // Restores the grids of a stack serialized by ToProto().
+  explicit PrecomputationGridStack(const proto::PrecomputationGridStack& proto);
+
+  PrecomputationGridStack(const PrecomputationGridStack&) = delete;
+  PrecomputationGridStack& operator=(const PrecomputationGridStack&) = delete;
+
+  //得到index对应的栅格地图　index表示深度
+  const PrecomputationGrid& Get(int index) const
+  {
+    return precomputation_grids_[index];
+  }
+
+  //最多有多少个分辨率
+  int max_depth() const { return precomputation_grids_.size() - 1; }
+
+  // Approximate number of bytes held by all grids of the stack.
+  size_t MemoryUsage() const;
+
+  // Serializes the grids. The header describing the probability grid is
+  // filled in by WritePrecomputationGridStack().
+  proto::PrecomputationGridStack ToProto() const;
+
+ private:
+  std::vector<PrecomputationGrid> precomputation_grids_;
+};
+
+// The best score found so far by several branch and bound searches running in
+// parallel, shared by all of them to prune against it. The searches are
+// numbered, either by the lowest resolution candidate they start from or by
+// the submap they search in.
+//
+// To return the same result as searching one after the other, which keeps the
+// first best candidate it finds, ties are broken in favor of the search with
+// the lower index. Score and index are packed into a single 64-bit word so
+// that both are updated atomically.
+class BestScoreSoFar {
+ public:
+  explicit BestScoreSoFar(const float min_score)
+      : packed_(Pack(min_score, -1)) {}
+
+  // Returns the score which candidates of the search 'root_index' have to
+  // exceed to become the result.
+  float MinScore(const int root_index) const {
+    const uint64 packed = packed_.load(std::memory_order_relaxed);
+    const float score = UnpackScore(packed);
+    if (UnpackIndex(packed) > root_index) {
+      // This search wins over a later one with the same score.
+      return std::nextafter(score, -std::numeric_limits<float>::infinity());
+    }
+    return score;
+  }
+
+  // Records that a candidate with 'score' has been found by the search
+  // 'root_index'.
+  void Update(const float score, const int root_index) {
+    const uint64 packed = Pack(score, root_index);
+    uint64 current = packed_.load(std::memory_order_relaxed);
+    while (packed > current &&
+           !packed_.compare_exchange_weak(current, packed,
+                                          std::memory_order_relaxed)) {
+    }
+  }
+
+ private:
+  // Orders by score first, then prefers lower indices. Scores are mapped to
+  // unsigned integers of the same order.
+  static uint64 Pack(const float score, const int root_index) {
+    uint32 bits;
+    std::memcpy(&bits, &score, sizeof(bits));
+    bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    return (static_cast<uint64>(bits) << 32) |
+           (0xfffffffeu - static_cast<uint32>(root_index));
+  }
+
+  static float UnpackScore(const uint64 packed) {
+    uint32 bits = packed >> 32;
+    bits = (bits & 0x80000000u) ? (bits & 0x7fffffffu) : ~bits;
+    float score;
+    std::memcpy(&score, &bits, sizeof(score));
+    return score;
+  }
+
+  static int UnpackIndex(const uint64 packed) {
+    return static_cast<int>(0xfffffffeu - static_cast<uint32>(packed));
+  }
+
+  std::atomic<uint64> packed_;
+};
+
 
 // An implementation of "Real-Time Correlative Scan Matching" by Olson.
 // 实现了论文中的多分辨率匹配方法(Muiti-Level Resolution)
@@ -129,6 +318,14 @@ class FastCorrelativeScanMatcher
   FastCorrelativeScanMatcher(
       const ProbabilityGrid& probability_grid,
       const proto::FastCorrelativeScanMatcherOptions& options);
+
+  // Uses an already computed 'precomputation_grid_stack' of
+  // 'probability_grid' instead of building a new one. Constructing the
+  // matcher is then cheap.
+  FastCorrelativeScanMatcher(
+      const ProbabilityGrid& probability_grid,
+      std::shared_ptr<const PrecomputationGridStack> precomputation_grid_stack,
+      const proto::FastCorrelativeScanMatcherOptions& options);
   ~FastCorrelativeScanMatcher();
 
   FastCorrelativeScanMatcher(const FastCorrelativeScanMatcher&) = delete;
@@ -142,27 +339,53 @@ class FastCorrelativeScanMatcher
   // 在规定的搜索窗口中来进行匹配 注意每次进行调用的时候，这里面的地图都是已经固定的了。
   // 在RealTimeCorrelativeScanMatcher里面，在进行Match函数调用的时候，会传入地图。
   // 但是在这里面是不行的。因为要计算多分辨率地图，这个是事先计算好的。
+  //
+  // The search uses up to 'num_threads' threads, including the calling thread.
+  // The result does not depend on 'num_threads'.
   bool Match(const transform::Rigid2d& initial_pose_estimate,
              const sensor::PointCloud2D& point_cloud, float min_score,
-             float* score, transform::Rigid2d* pose_estimate) const;
+             float* score, transform::Rigid2d* pose_estimate,
+             int num_threads = 1) const;
 
   // Aligns 'point_cloud' within the full 'probability_grid', i.e., not
   // restricted to the configured search window. If a score above 'min_score'
   // (excluding equality) is possible, true is returned, and 'score' and
   // 'pose_estimate' are updated with the result.
   // 和整个submap来进行匹配，而不是局限在规定的搜索窗口
+  // 'num_threads' is the thread budget of this call, see Match().
   bool MatchFullSubmap(const sensor::PointCloud2D& point_cloud, float min_score,
+                       float* score, transform::Rigid2d* pose_estimate,
+                       int num_threads = 1) const;
+
+  // Same as MatchFullSubmap(), for matching against several submaps in
+  // parallel, see PerformGlobalLocalization(). The search is numbered
+  // 'search_index' and is also pruned against 'best_score_so_far', which is
+  // shared with the other searches and updated with the result. If true is
+  // returned, 'score' exceeds the best score of the other searches at the
+  // time this search started.
+  bool MatchFullSubmap(const sensor::PointCloud2D& point_cloud,
+                       int search_index, BestScoreSoFar* best_score_so_far,
                        float* score, transform::Rigid2d* pose_estimate) const;
 
  private:
+  // Implements both MatchFullSubmap() overloads. 'best_score_so_far' may be
+  // null.
+  bool MatchInFullSubmap(const sensor::PointCloud2D& point_cloud,
+                         float min_score, float* score,
+                         transform::Rigid2d* pose_estimate, int num_threads,
+                         int search_index,
+                         BestScoreSoFar* best_score_so_far) const;
+
   // The actual implementation of the scan matcher, called by Match() and
   // MatchFullSubmap() with appropriate 'initial_pose_estimate' and
-  // 'search_parameters'.
+  // 'search_parameters'. If 'best_score_so_far' is not null, the search is
+  // single-threaded and prunes against it as the search 'search_index'.
   bool MatchWithSearchParameters(
       SearchParameters search_parameters,
       const transform::Rigid2d& initial_pose_estimate,
       const sensor::PointCloud2D& point_cloud, float min_score, float* score,
-      transform::Rigid2d* pose_estimate) const;
+      transform::Rigid2d* pose_estimate, int num_threads, int search_index,
+      BestScoreSoFar* best_score_so_far) const;
 
   std::vector<Candidate> ComputeLowestResolutionCandidates(
       const std::vector<DiscreteScan>& discrete_scans,
@@ -176,14 +399,28 @@ class FastCorrelativeScanMatcher
                        const SearchParameters& search_parameters,
                        std::vector<Candidate>* const candidates) const;
 
+  // If 'best_score_so_far' is not null, the search is one of several running
+  // in parallel, all of them starting from the lowest resolution candidate
+  // with index 'root_index'. Candidates are then also pruned against the best
+  // score found by the other searches.
   Candidate BranchAndBound(const std::vector<DiscreteScan>& discrete_scans,
                            const SearchParameters& search_parameters,
                            const std::vector<Candidate>& candidates,
-                           int candidate_depth, float min_score) const;
+                           int candidate_depth, float min_score,
+                           int root_index,
+                           BestScoreSoFar* best_score_so_far) const;
+
+  // Searches the subtrees of the sorted 'lowest_resolution_candidates' on
+  // 'num_threads' threads. Returns the same candidate as BranchAndBound().
+  Candidate ParallelBranchAndBound(
+      const std::vector<DiscreteScan>& discrete_scans,
+      const SearchParameters& search_parameters,
+      const std::vector<Candidate>& lowest_resolution_candidates,
+      float min_score, int num_threads) const;
 
   const proto::FastCorrelativeScanMatcherOptions options_;
   MapLimits limits_;
-  std::unique_ptr<PrecomputationGridStack> precomputation_grid_stack_;
+  std::shared_ptr<const PrecomputationGridStack> precomputation_grid_stack_;
 };
 
 }  // namespace scan_matching
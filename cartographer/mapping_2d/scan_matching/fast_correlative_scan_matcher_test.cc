@@ -48,7 +48,7 @@ TEST(PrecomputationGridTest, CorrectValues) {
         xy_index, PrecomputationGrid::ToProbability(distribution(prng)));
   }
 
-  std::vector<float> reusable_intermediate_grid;
+  std::vector<uint8> reusable_intermediate_grid;
   for (const int width : {1, 2, 3, 8})
   {
     PrecomputationGrid precomputation_grid(
@@ -87,7 +87,7 @@ TEST(PrecomputationGridTest, TinyProbabilityGrid) {
         xy_index, PrecomputationGrid::ToProbability(distribution(prng)));
   }
 
-  std::vector<float> reusable_intermediate_grid;
+  std::vector<uint8> reusable_intermediate_grid;
   for (const int width : {1, 2, 3, 8, 200}) {
     PrecomputationGrid precomputation_grid(
         probability_grid, probability_grid.limits().cell_limits(), width,
@@ -109,6 +109,83 @@ TEST(PrecomputationGridTest, TinyProbabilityGrid) {
   }
 }
 
+TEST(PrecomputationGridTest, SumValues) {
+  std::mt19937 prng(42);
+  std::uniform_int_distribution<int> value_distribution(0, 255);
+  std::uniform_int_distribution<int> index_distribution(-10, 60);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(1., 1.), CellLimits(40, 40)));
+  probability_grid.StartUpdate();
+  for (const Eigen::Array2i& xy_index :
+       XYIndexRangeIterator(probability_grid.limits().cell_limits())) {
+    probability_grid.SetProbability(
+        xy_index, PrecomputationGrid::ToProbability(value_distribution(prng)));
+  }
+  std::vector<uint8> reusable_intermediate_grid;
+  const PrecomputationGrid precomputation_grid(
+      probability_grid, probability_grid.limits().cell_limits(), 4,
+      &reusable_intermediate_grid);
+
+  DiscreteScan xy_indices;
+  for (int i = 0; i != 100; ++i) {
+    xy_indices.emplace_back(index_distribution(prng),
+                            index_distribution(prng));
+  }
+  // Offsets partially outside of the grid for some of the indices.
+  for (const int half_width : {1, 4, 16}) {
+    const std::array<Eigen::Array2i, 4> offsets = {
+        {Eigen::Array2i(-3, 2), Eigen::Array2i(-3, 2 + half_width),
+         Eigen::Array2i(-3 + half_width, 2),
+         Eigen::Array2i(-3 + half_width, 2 + half_width)}};
+    std::array<int, 4> sums;
+    sums.fill(0);
+    precomputation_grid.SumValues<4>(xy_indices, offsets, &sums);
+    for (int k = 0; k != 4; ++k) {
+      int expected_sum = 0;
+      for (const Eigen::Array2i& xy_index : xy_indices) {
+        expected_sum += precomputation_grid.GetValue(xy_index + offsets[k]);
+      }
+      EXPECT_EQ(expected_sum, sums[k]);
+    }
+  }
+}
+
+TEST(PrecomputationGridTest, StackMatchesDirectComputation) {
+  std::mt19937 prng(42);
+  std::uniform_int_distribution<int> distribution(0, 255);
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(150, 130)));
+  probability_grid.StartUpdate();
+  for (const Eigen::Array2i& xy_index :
+       XYIndexRangeIterator(Eigen::Array2i(10, 20), Eigen::Array2i(139, 99))) {
+    probability_grid.SetProbability(
+        xy_index, PrecomputationGrid::ToProbability(distribution(prng)));
+  }
+
+  proto::FastCorrelativeScanMatcherOptions options;
+  options.set_branch_and_bound_depth(6);
+  // Rows are split between several threads.
+  const PrecomputationGridStack precomputation_grid_stack(probability_grid,
+                                                          options, 3);
+  ASSERT_EQ(5, precomputation_grid_stack.max_depth());
+  std::vector<uint8> reusable_intermediate_grid;
+  for (int depth = 0; depth <= precomputation_grid_stack.max_depth();
+       ++depth) {
+    const int width = 1 << depth;
+    const PrecomputationGrid& stack_grid =
+        precomputation_grid_stack.Get(depth);
+    const PrecomputationGrid direct_grid(
+        probability_grid, probability_grid.limits().cell_limits(), width,
+        &reusable_intermediate_grid);
+    EXPECT_EQ(width, stack_grid.width());
+    for (const Eigen::Array2i& xy_index :
+         XYIndexRangeIterator(Eigen::Array2i(-width - 1, -width - 1),
+                              Eigen::Array2i(151, 131))) {
+      EXPECT_EQ(direct_grid.GetValue(xy_index), stack_grid.GetValue(xy_index));
+    }
+  }
+}
+
 proto::FastCorrelativeScanMatcherOptions
 CreateFastCorrelativeScanMatcherTestOptions(const int branch_and_bound_depth) {
   auto parameter_dictionary =
@@ -225,6 +302,69 @@ TEST(FastCorrelativeScanMatcherTest, FullSubmapMatching) {
   }
 }
 
+TEST(FastCorrelativeScanMatcherTest, ParallelSearchMatchesSerialSearch) {
+  std::mt19937 prng(42);
+  std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+  // Few distinct probabilities so that many candidates have equal scores.
+  std::uniform_int_distribution<int> value_distribution(0, 3);
+  constexpr float kMinScore = 0.1f;
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(4);
+
+  for (int i = 0; i != 4; ++i) {
+    ProbabilityGrid probability_grid(
+        MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(200, 200)));
+    probability_grid.StartUpdate();
+    for (const Eigen::Array2i& xy_index :
+         XYIndexRangeIterator(Eigen::Array2i(20, 20),
+                              Eigen::Array2i(179, 179))) {
+      probability_grid.SetProbability(
+          xy_index,
+          PrecomputationGrid::ToProbability(85 * value_distribution(prng)));
+    }
+    sensor::PointCloud2D point_cloud;
+    for (int j = 0; j != 20; ++j) {
+      point_cloud.emplace_back(3.f * distribution(prng),
+                               3.f * distribution(prng));
+    }
+
+    FastCorrelativeScanMatcher fast_correlative_scan_matcher(probability_grid,
+                                                             options);
+    transform::Rigid2d expected_pose;
+    float expected_score = 0.f;
+    const bool expected_success = fast_correlative_scan_matcher.Match(
+        transform::Rigid2d::Identity(), point_cloud, kMinScore,
+        &expected_score, &expected_pose);
+    transform::Rigid2d expected_full_submap_pose;
+    float expected_full_submap_score = 0.f;
+    const bool expected_full_submap_success =
+        fast_correlative_scan_matcher.MatchFullSubmap(
+            point_cloud, kMinScore, &expected_full_submap_score,
+            &expected_full_submap_pose);
+    for (const int num_threads : {2, 5}) {
+      transform::Rigid2d pose_estimate;
+      float score = 0.f;
+      EXPECT_EQ(expected_success,
+                fast_correlative_scan_matcher.Match(
+                    transform::Rigid2d::Identity(), point_cloud, kMinScore,
+                    &score, &pose_estimate, num_threads));
+      EXPECT_EQ(expected_score, score);
+      EXPECT_EQ(expected_pose.translation(), pose_estimate.translation());
+      EXPECT_EQ(expected_pose.rotation().angle(),
+                pose_estimate.rotation().angle());
+
+      EXPECT_EQ(expected_full_submap_success,
+                fast_correlative_scan_matcher.MatchFullSubmap(
+                    point_cloud, kMinScore, &score, &pose_estimate,
+                    num_threads));
+      EXPECT_EQ(expected_full_submap_score, score);
+      EXPECT_EQ(expected_full_submap_pose.translation(),
+                pose_estimate.translation());
+      EXPECT_EQ(expected_full_submap_pose.rotation().angle(),
+                pose_estimate.rotation().angle());
+    }
+  }
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_2d
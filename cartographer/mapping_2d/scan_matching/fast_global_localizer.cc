@@ -16,12 +16,68 @@
 
 #include "../mapping_2d/scan_matching/fast_global_localizer.h"
 
+#include <algorithm>
+#include <numeric>
+
+#include "../common/parallel_for.h"
 #include "glog/logging.h"
 
 namespace cartographer {
 namespace mapping_2d {
 namespace scan_matching {
 
+namespace {
+
+// Matches 'point_cloud' against the submaps with 'submap_indices', which are
+// searched in this order. The result is the same as matching the submaps one
+// after the other in the order of their indices.
+bool MatchSubmaps(
+    const float cutoff,
+    const std::vector<FastCorrelativeScanMatcher*>& matchers,
+    const std::vector<int>& submap_indices,
+    const sensor::PointCloud2D& point_cloud, const int num_threads,
+    transform::Rigid2d* const best_pose_estimate, float* const best_score,
+    int* const best_submap_index)
+{
+  //多个线程各自取下一个submap 所有的搜索共享目前为止的最优得分来进行剪枝
+  //分数相同的时候下标小的submap优先 所以结果和线程数无关
+  const int num_submaps = submap_indices.size();
+  BestScoreSoFar best_score_so_far(cutoff);
+  std::vector<float> scores(matchers.size());
+  std::vector<transform::Rigid2d> pose_estimates(matchers.size());
+  std::vector<char> found(matchers.size(), false);
+  common::ParallelFor(
+      num_submaps, num_threads,
+      [&](const int i)
+      {
+        const int submap_index = submap_indices[i];
+        found[submap_index] = matchers[submap_index]->MatchFullSubmap(
+            point_cloud, submap_index, &best_score_so_far,
+            &scores[submap_index], &pose_estimates[submap_index]);
+      });
+
+  // Same as matching the submaps one after the other: the best score wins,
+  // and on ties the submap which comes first.
+  *best_score = cutoff;
+  bool success = false;
+  for (size_t i = 0; i != matchers.size(); ++i)
+  {
+    if (found[i] && scores[i] > *best_score)
+    {
+      *best_score = scores[i];
+      *best_pose_estimate = pose_estimates[i];
+      if (best_submap_index != nullptr)
+      {
+        *best_submap_index = i;
+      }
+      success = true;
+    }
+  }
+  return success;
+}
+
+}  // namespace
+
 /**
  * @brief PerformGlobalLocalization
  * 用来进行全局定位的函数
@@ -35,6 +91,8 @@ namespace scan_matching {
  * @param point_cloud           用来定位的激光数据
  * @param best_pose_estimate    估计出来的最好的位姿
  * @param best_score            估计出来的位姿对应的分数
+ * @param num_threads           用来并行匹配各个submap的线程数(包括调用的线程)
+ * @param best_submap_index     匹配得最好的submap在matchers中的下标 可以为空
  * @return
  */
 bool PerformGlobalLocalization(
@@ -43,18 +101,19 @@ bool PerformGlobalLocalization(
     const std::vector<cartographer::mapping_2d::scan_matching::FastCorrelativeScanMatcher*>&matchers,
     const cartographer::sensor::PointCloud2D& point_cloud,
     transform::Rigid2d* const best_pose_estimate,
-    float* const best_score)
+    float* const best_score,
+    const int num_threads,
+    int* const best_submap_index)
 {
   CHECK(best_pose_estimate != nullptr)
       << "Need a non-null output_pose_estimate!";
   CHECK(best_score != nullptr) << "Need a non-null best_score!";
+  CHECK_GE(num_threads, 1);
   *best_score = cutoff;
 
-  transform::Rigid2d pose_estimate;
   const sensor::PointCloud2D filtered_point_cloud =
       voxel_filter.Filter(point_cloud);
 
-  bool success = false;
   if (matchers.size() == 0)
   {
     LOG(WARNING) << "Map not yet large enough to localize in!";
@@ -62,20 +121,58 @@ bool PerformGlobalLocalization(
   }
 
   //枚举每一个FastCorrelativeScanMatcher或者说枚举每一个submap来进行匹配
-  for (auto& matcher : matchers)
+  std::vector<int> submap_indices(matchers.size());
+  std::iota(submap_indices.begin(), submap_indices.end(), 0);
+  return MatchSubmaps(cutoff, matchers, submap_indices, filtered_point_cloud,
+                      num_threads, best_pose_estimate, best_score,
+                      best_submap_index);
+}
+
+bool PerformGlobalLocalization(
+    const float cutoff, const sensor::AdaptiveVoxelFilter& voxel_filter,
+    const std::vector<FastCorrelativeScanMatcher*>& matchers,
+    const std::vector<const RangeAngleHistogram*>& histograms,
+    const int num_candidates, const sensor::PointCloud2D& point_cloud,
+    transform::Rigid2d* const best_pose_estimate, float* const best_score,
+    const int num_threads, int* const best_submap_index)
+{
+  CHECK(best_pose_estimate != nullptr)
+      << "Need a non-null output_pose_estimate!";
+  CHECK(best_score != nullptr) << "Need a non-null best_score!";
+  CHECK_EQ(matchers.size(), histograms.size());
+  CHECK_GE(num_candidates, 1);
+  CHECK_GE(num_threads, 1);
+  *best_score = cutoff;
+
+  if (matchers.size() == 0)
   {
-    float score = -1;
-    transform::Rigid2d pose_estimate;
-    if (matcher->MatchFullSubmap(filtered_point_cloud, *best_score, &score,
-                                 &pose_estimate))
-    {
-      CHECK_GT(score, *best_score) << "MatchFullSubmap lied!";
-      *best_score = score;
-      *best_pose_estimate = pose_estimate;
-      success = true;
-    }
+    LOG(WARNING) << "Map not yet large enough to localize in!";
+    return false;
   }
-  return success;
+
+  //先用直方图对所有的submap打分 只对最像的num_candidates个submap进行分枝定界搜索
+  //最像的submap先搜索 这样能更早地得到较高的分数来剪枝
+  const RangeAngleHistogram point_cloud_histogram(point_cloud);
+  std::vector<float> similarities(matchers.size());
+  for (size_t i = 0; i != matchers.size(); ++i)
+  {
+    similarities[i] = histograms[i]->Match(point_cloud_histogram);
+  }
+  std::vector<int> submap_indices(matchers.size());
+  std::iota(submap_indices.begin(), submap_indices.end(), 0);
+  const auto end = submap_indices.begin() +
+                   std::min<size_t>(num_candidates, submap_indices.size());
+  std::partial_sort(submap_indices.begin(), end, submap_indices.end(),
+                    [&similarities](const int lhs, const int rhs) {
+                      return similarities[lhs] > similarities[rhs] ||
+                             (similarities[lhs] == similarities[rhs] &&
+                              lhs < rhs);
+                    });
+  submap_indices.erase(end, submap_indices.end());
+
+  return MatchSubmaps(cutoff, matchers, submap_indices,
+                      voxel_filter.Filter(point_cloud), num_threads,
+                      best_pose_estimate, best_score, best_submap_index);
 }
 
 }  // namespace scan_matching
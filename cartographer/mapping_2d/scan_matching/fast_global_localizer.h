@@ -21,6 +21,7 @@
 
 #include "eigen3/Eigen/Geometry"
 #include "../mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
+#include "../mapping_2d/scan_matching/range_angle_histogram.h"
 #include "../sensor/voxel_filter.h"
 
 namespace cartographer {
@@ -36,6 +37,15 @@ namespace scan_matching {
 // Returns true in the case of successful localization. The output parameters
 // should not be trusted if the function returns false. The 'cutoff' and
 // 'best_score' are in the range [0.0, 1.0].
+//
+// The submaps are matched on up to 'num_threads' threads, including the
+// calling thread. All searches prune against the best score found so far in
+// any submap, so a search stops early once it cannot beat it. The result does
+// not depend on 'num_threads'.
+//
+// If 'best_submap_index' is not null, it is set to the index into 'matchers'
+// of the submap that matched best. Of several submaps with the same score, the
+// one that comes first in 'matchers' wins.
 // 用来进行全局定位的函数
 // 基本功能就是和地图中的每一个submap进行匹配。如果能匹配上则全局定位成功。
 // 否则全局定位失败
@@ -51,6 +61,8 @@ namespace scan_matching {
  * @param point_cloud           用来定位的激光数据
  * @param best_pose_estimate    估计出来的最好的位姿
  * @param best_score            估计出来的位姿对应的分数
+ * @param num_threads           用来并行匹配各个submap的线程数(包括调用的线程)
+ * @param best_submap_index     匹配得最好的submap在matchers中的下标 可以为空
  * @return
  */
 bool PerformGlobalLocalization(
@@ -59,7 +71,30 @@ bool PerformGlobalLocalization(
         cartographer::mapping_2d::scan_matching::FastCorrelativeScanMatcher*>&
         matchers,
     const cartographer::sensor::PointCloud2D& point_cloud,
-    transform::Rigid2d* best_pose_estimate, float* best_score);
+    transform::Rigid2d* best_pose_estimate, float* best_score,
+    int num_threads = 1, int* best_submap_index = nullptr);
+
+// Same as above, but only the 'num_candidates' submaps whose 'histograms' are
+// most similar to the one of 'point_cloud' are matched, most similar first.
+// 'histograms' has one entry per matcher. This is much faster on large maps,
+// but the submap which would match best can be missed if its histogram is not
+// among the most similar ones. With 'num_candidates' of at least the number of
+// submaps, the result is the same as above.
+//
+// This is library API for localizing in a known map: nothing in the SLAM
+// pipeline calls it. The caller builds one RangeAngleHistogram per finished
+// submap, e.g. when loading the map, and keeps it alive together with the
+// matcher.
+// 先用直方图挑出最像的num_candidates个submap 再只对这些submap进行匹配
+bool PerformGlobalLocalization(
+    float cutoff, const cartographer::sensor::AdaptiveVoxelFilter& voxel_filter,
+    const std::vector<
+        cartographer::mapping_2d::scan_matching::FastCorrelativeScanMatcher*>&
+        matchers,
+    const std::vector<const RangeAngleHistogram*>& histograms,
+    int num_candidates, const cartographer::sensor::PointCloud2D& point_cloud,
+    transform::Rigid2d* best_pose_estimate, float* best_score,
+    int num_threads = 1, int* best_submap_index = nullptr);
 
 }  // namespace scan_matching
 }  // namespace mapping_2d
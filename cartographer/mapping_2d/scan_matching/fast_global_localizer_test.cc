@@ -0,0 +1,284 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/fast_global_localizer.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../common/lua_parameter_dictionary_test_helpers.h"
+#include "../common/make_unique.h"
+#include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/range_angle_histogram.h"
+#include "../transform/rigid_transform_test_helpers.h"
+#include "../transform/transform.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+namespace {
+
+constexpr float kMinScore = 0.3f;
+
+void AddWall(const Eigen::Vector2f& start, const Eigen::Vector2f& end,
+             sensor::PointCloud2D* const points) {
+  const int num_points = (end - start).norm() / 0.05f;
+  for (int i = 0; i <= num_points; ++i) {
+    points->push_back(start + (end - start) * i / num_points);
+  }
+}
+
+void AddBox(const Eigen::Vector2f& min, const Eigen::Vector2f& max,
+            sensor::PointCloud2D* const points) {
+  AddWall(min, Eigen::Vector2f(max.x(), min.y()), points);
+  AddWall(Eigen::Vector2f(max.x(), min.y()), max, points);
+  AddWall(max, Eigen::Vector2f(min.x(), max.y()), points);
+  AddWall(Eigen::Vector2f(min.x(), max.y()), min, points);
+}
+
+// Distinct scenes around the origin, one per submap. None of them looks the
+// same after a rotation, so that a scan has a unique pose in its scene.
+std::vector<sensor::PointCloud2D> CreateScenes() {
+  std::vector<sensor::PointCloud2D> scenes(3);
+  // A square room with a pillar in one corner.
+  AddBox(Eigen::Vector2f(-4.f, -4.f), Eigen::Vector2f(4.f, 4.f), &scenes[0]);
+  AddBox(Eigen::Vector2f(1.5f, -2.5f), Eigen::Vector2f(2.f, -1.5f),
+         &scenes[0]);
+  // A long corridor with a niche on one side.
+  AddBox(Eigen::Vector2f(-4.5f, -1.f), Eigen::Vector2f(4.5f, 1.f), &scenes[1]);
+  AddBox(Eigen::Vector2f(1.f, 1.f), Eigen::Vector2f(2.2f, 2.f), &scenes[1]);
+  // A room with a pillar and a partition wall.
+  AddBox(Eigen::Vector2f(-4.f, -3.f), Eigen::Vector2f(3.f, 4.f), &scenes[2]);
+  AddBox(Eigen::Vector2f(1.f, 1.f), Eigen::Vector2f(1.6f, 2.2f), &scenes[2]);
+  AddWall(Eigen::Vector2f(-4.f, 0.5f), Eigen::Vector2f(-1.5f, 0.5f),
+          &scenes[2]);
+  return scenes;
+}
+
+std::unique_ptr<ProbabilityGrid> CreateSubmap(
+    const sensor::PointCloud2D& scene) {
+  auto probability_grid = common::make_unique<ProbabilityGrid>(
+      MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(200, 200)));
+  probability_grid->StartUpdate();
+  for (const Eigen::Vector2f& point : scene) {
+    const Eigen::Array2i xy_index =
+        probability_grid->limits().GetXYIndexOfCellContainingPoint(point.x(),
+                                                                   point.y());
+    if (!probability_grid->IsKnown(xy_index)) {
+      probability_grid->SetProbability(xy_index, 0.9);
+    }
+  }
+  return probability_grid;
+}
+
+// Returns what a scanner at 'scanner_pose' sees of 'scene' in its own frame.
+sensor::PointCloud2D CreateScan(const sensor::PointCloud2D& scene,
+                                const transform::Rigid2f& scanner_pose) {
+  return sensor::TransformPointCloud2D(scene, scanner_pose.inverse());
+}
+
+class FastGlobalLocalizerTest : public ::testing::Test {
+ protected:
+  FastGlobalLocalizerTest()
+      : scenes_(CreateScenes()),
+        voxel_filter_(CreateVoxelFilterTestOptions()) {
+    const auto options = CreateFastCorrelativeScanMatcherTestOptions();
+    for (const sensor::PointCloud2D& scene : scenes_) {
+      AddSubmap(scene, options);
+    }
+    // A copy of the last submap, which matches every scan with the same score.
+    AddSubmap(scenes_.back(), options);
+  }
+
+  static sensor::proto::AdaptiveVoxelFilterOptions
+  CreateVoxelFilterTestOptions() {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          max_length = 0.2,
+          min_num_points = 200,
+          max_range = 50.,
+        })text");
+    return sensor::CreateAdaptiveVoxelFilterOptions(parameter_dictionary.get());
+  }
+
+  static proto::FastCorrelativeScanMatcherOptions
+  CreateFastCorrelativeScanMatcherTestOptions() {
+    auto parameter_dictionary = common::MakeDictionary(R"text(
+        return {
+          linear_search_window = 3.,
+          angular_search_window = 1.,
+          branch_and_bound_depth = 6,
+        })text");
+    return CreateFastCorrelativeScanMatcherOptions(parameter_dictionary.get());
+  }
+
+  void AddSubmap(const sensor::PointCloud2D& scene,
+                 const proto::FastCorrelativeScanMatcherOptions& options) {
+    probability_grids_.push_back(CreateSubmap(scene));
+    fast_correlative_scan_matchers_.push_back(
+        common::make_unique<FastCorrelativeScanMatcher>(
+            *probability_grids_.back(), options));
+    range_angle_histograms_.push_back(
+        common::make_unique<RangeAngleHistogram>(*probability_grids_.back()));
+  }
+
+  std::vector<FastCorrelativeScanMatcher*> matchers() const {
+    std::vector<FastCorrelativeScanMatcher*> result;
+    for (const auto& matcher : fast_correlative_scan_matchers_) {
+      result.push_back(matcher.get());
+    }
+    return result;
+  }
+
+  std::vector<const RangeAngleHistogram*> histograms() const {
+    std::vector<const RangeAngleHistogram*> result;
+    for (const auto& histogram : range_angle_histograms_) {
+      result.push_back(histogram.get());
+    }
+    return result;
+  }
+
+  const std::vector<sensor::PointCloud2D> scenes_;
+  const sensor::AdaptiveVoxelFilter voxel_filter_;
+  std::vector<std::unique_ptr<ProbabilityGrid>> probability_grids_;
+  std::vector<std::unique_ptr<FastCorrelativeScanMatcher>>
+      fast_correlative_scan_matchers_;
+  std::vector<std::unique_ptr<RangeAngleHistogram>> range_angle_histograms_;
+};
+
+TEST_F(FastGlobalLocalizerTest, ResultDoesNotDependOnNumThreads) {
+  for (size_t i = 0; i != scenes_.size(); ++i) {
+    const transform::Rigid2f scanner_pose(Eigen::Vector2f(-0.8f, 0.3f + i),
+                                          0.4 + i);
+    const sensor::PointCloud2D scan = CreateScan(scenes_[i], scanner_pose);
+
+    transform::Rigid2d serial_pose_estimate;
+    float serial_score = 0.f;
+    int serial_submap_index = -1;
+    ASSERT_TRUE(PerformGlobalLocalization(
+        kMinScore, voxel_filter_, matchers(), scan, &serial_pose_estimate,
+        &serial_score, 1 /* num_threads */, &serial_submap_index));
+    EXPECT_EQ(static_cast<int>(i), serial_submap_index);
+    EXPECT_THAT(scanner_pose,
+                transform::IsNearly(serial_pose_estimate.cast<float>(), 0.1f));
+
+    for (const int num_threads : {2, 4}) {
+      transform::Rigid2d pose_estimate;
+      float score = 0.f;
+      int submap_index = -1;
+      ASSERT_TRUE(PerformGlobalLocalization(kMinScore, voxel_filter_,
+                                            matchers(), scan, &pose_estimate,
+                                            &score, num_threads, &submap_index));
+      EXPECT_EQ(serial_submap_index, submap_index);
+      EXPECT_EQ(serial_score, score);
+      EXPECT_EQ(serial_pose_estimate.translation(),
+                pose_estimate.translation());
+      EXPECT_EQ(serial_pose_estimate.rotation().angle(),
+                pose_estimate.rotation().angle());
+    }
+  }
+}
+
+TEST_F(FastGlobalLocalizerTest, TiesGoToFirstSubmap) {
+  const transform::Rigid2f scanner_pose(Eigen::Vector2f(-0.8f, 1.3f), 1.4);
+  const sensor::PointCloud2D scan = CreateScan(scenes_.back(), scanner_pose);
+  const int num_submaps = fast_correlative_scan_matchers_.size();
+
+  // The last two submaps are equal. In the reversed order, the copy comes
+  // first.
+  std::vector<FastCorrelativeScanMatcher*> reversed_matchers = matchers();
+  std::reverse(reversed_matchers.begin(), reversed_matchers.end());
+
+  for (const int num_threads : {1, 4}) {
+    transform::Rigid2d pose_estimate;
+    float score = 0.f;
+    int submap_index = -1;
+    ASSERT_TRUE(PerformGlobalLocalization(kMinScore, voxel_filter_, matchers(),
+                                          scan, &pose_estimate, &score,
+                                          num_threads, &submap_index));
+    EXPECT_EQ(num_submaps - 2, submap_index);
+    EXPECT_THAT(scanner_pose,
+                transform::IsNearly(pose_estimate.cast<float>(), 0.1f));
+
+    transform::Rigid2d reversed_pose_estimate;
+    float reversed_score = 0.f;
+    int reversed_submap_index = -1;
+    ASSERT_TRUE(PerformGlobalLocalization(
+        kMinScore, voxel_filter_, reversed_matchers, scan,
+        &reversed_pose_estimate, &reversed_score, num_threads,
+        &reversed_submap_index));
+    EXPECT_EQ(0, reversed_submap_index);
+    EXPECT_EQ(score, reversed_score);
+    EXPECT_EQ(pose_estimate.translation(),
+              reversed_pose_estimate.translation());
+    EXPECT_EQ(pose_estimate.rotation().angle(),
+              reversed_pose_estimate.rotation().angle());
+  }
+}
+
+TEST_F(FastGlobalLocalizerTest, PrefilterKeepsSubmapOfScan) {
+  const int num_submaps = fast_correlative_scan_matchers_.size();
+  for (size_t i = 0; i != scenes_.size(); ++i) {
+    const transform::Rigid2f scanner_pose(Eigen::Vector2f(0.6f, -0.2f - i),
+                                          -0.7 - i);
+    const sensor::PointCloud2D scan = CreateScan(scenes_[i], scanner_pose);
+
+    transform::Rigid2d expected_pose_estimate;
+    float expected_score = 0.f;
+    int expected_submap_index = -1;
+    ASSERT_TRUE(PerformGlobalLocalization(
+        kMinScore, voxel_filter_, matchers(), scan, &expected_pose_estimate,
+        &expected_score, 1 /* num_threads */, &expected_submap_index));
+    EXPECT_EQ(static_cast<int>(i), expected_submap_index);
+
+    // Only the submap with the most similar histogram is matched, which is the
+    // one of the scene.
+    transform::Rigid2d pose_estimate;
+    float score = 0.f;
+    int submap_index = -1;
+    ASSERT_TRUE(PerformGlobalLocalization(
+        kMinScore, voxel_filter_, matchers(), histograms(),
+        1 /* num_candidates */, scan, &pose_estimate, &score,
+        1 /* num_threads */, &submap_index));
+    EXPECT_EQ(expected_submap_index, submap_index);
+    EXPECT_EQ(expected_score, score);
+    EXPECT_THAT(scanner_pose,
+                transform::IsNearly(pose_estimate.cast<float>(), 0.1f));
+
+    // With at least as many candidates as submaps, the result is the same as
+    // without the prefilter.
+    for (const int num_candidates : {num_submaps, num_submaps + 3}) {
+      for (const int num_threads : {1, 4}) {
+        ASSERT_TRUE(PerformGlobalLocalization(
+            kMinScore, voxel_filter_, matchers(), histograms(), num_candidates,
+            scan, &pose_estimate, &score, num_threads, &submap_index));
+        EXPECT_EQ(expected_submap_index, submap_index);
+        EXPECT_EQ(expected_score, score);
+        EXPECT_EQ(expected_pose_estimate.translation(),
+                  pose_estimate.translation());
+        EXPECT_EQ(expected_pose_estimate.rotation().angle(),
+                  pose_estimate.rotation().angle());
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_FLOAT_PROBABILITY_GRID_H_
+#define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_FLOAT_PROBABILITY_GRID_H_
+
+#include <vector>
+
+#include "eigen3/Eigen/Core"
+#include "../common/math.h"
+#include "../common/port.h"
+#include "../mapping/probability_values.h"
+#include "../mapping_2d/map_limits.h"
+#include "../mapping_2d/probability_grid.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+// A read-only copy of the known cells of a ProbabilityGrid with the
+// probabilities stored as floats in one contiguous array. Reading a cell needs
+// neither a tile lookup nor a conversion of the cell value. The copy has a
+// border of unknown cells and indices outside of it are clamped onto that
+// border, so GetProbability() returns the same as for the original grid
+// without a bounds check.
+// 概率栅格的只读拷贝 用于对同一个submap进行多次匹配的情况(比如闭环检测)
+// 构建需要遍历所有已知的栅格 因此只适合不再变化的submap
+class FloatProbabilityGrid
+{
+ public:
+  explicit FloatProbabilityGrid(const ProbabilityGrid& probability_grid)
+      : limits_(probability_grid.limits())
+  {
+    Eigen::Array2i offset;
+    CellLimits cell_limits;
+    probability_grid.ComputeCroppedLimits(&offset, &cell_limits);
+    offset_ = Eigen::Array2i(offset.x() - kBorder, offset.y() - kBorder);
+    num_x_cells_ = cell_limits.num_x_cells + 2 * kBorder;
+    num_y_cells_ = cell_limits.num_y_cells + 2 * kBorder;
+    std::vector<uint16> values(num_x_cells_ * num_y_cells_);
+    probability_grid.CopyValues(offset_, CellLimits(num_x_cells_, num_y_cells_),
+                                values.data());
+    cells_.reserve(values.size());
+    for (const uint16 value : values)
+    {
+      cells_.push_back(mapping::ValueToProbability(value));
+    }
+  }
+
+  FloatProbabilityGrid(const FloatProbabilityGrid&) = delete;
+  FloatProbabilityGrid& operator=(const FloatProbabilityGrid&) = delete;
+
+  // Returns the limits of the original probability grid.
+  const MapLimits& limits() const { return limits_; }
+
+  // Returns the probability of the cell with 'xy_index'.
+  float GetProbability(const Eigen::Array2i& xy_index) const
+  {
+    const int x =
+        common::Clamp(xy_index.x() - offset_.x(), 0, num_x_cells_ - 1);
+    const int y =
+        common::Clamp(xy_index.y() - offset_.y(), 0, num_y_cells_ - 1);
+    return cells_[y * num_x_cells_ + x];
+  }
+
+  // Number of bytes used by the cells of this grid.
+  size_t MemoryUsage() const { return cells_.capacity() * sizeof(float); }
+
+ private:
+  static constexpr int kBorder = 1;
+
+  const MapLimits limits_;
+  Eigen::Array2i offset_;
+  int num_x_cells_;
+  int num_y_cells_;
+  std::vector<float> cells_;
+};
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_FLOAT_PROBABILITY_GRID_H_
@@ -17,12 +17,13 @@
 #ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_OCCUPIED_SPACE_COST_FUNCTOR_H_
 #define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_OCCUPIED_SPACE_COST_FUNCTOR_H_
 
+#include <cmath>
+
 #include "eigen3/Eigen/Core"
-#include "eigen3/Eigen/Geometry"
 #include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/float_probability_grid.h"
 #include "../sensor/point_cloud.h"
 #include "ceres/ceres.h"
-#include "ceres/cubic_interpolation.h"
 
 namespace cartographer {
 namespace mapping_2d {
@@ -31,84 +32,122 @@ namespace scan_matching {
 // Computes the cost of inserting occupied space described by the point cloud
 // into the map. The cost increases with the amount of free space that would be
 // replaced by occupied space.
-class OccupiedSpaceCostFunctor {
+//
+// 'Grid' is a ProbabilityGrid or a FloatProbabilityGrid. The map is
+// interpolated in the same way as by ceres::BiCubicInterpolator, but the
+// Jacobian is computed analytically instead of by automatic differentiation,
+// and the cells are read from 'Grid' directly.
+// 解析求导 比AutoDiffCostFunction少了Jet的运算
+template <typename Grid>
+class OccupiedSpaceCostFunction
+    : public ceres::SizedCostFunction<ceres::DYNAMIC, 3>
+{
  public:
-  // Creates an OccupiedSpaceCostFunctor using the specified map, resolution
-  // level, and point cloud.
-  OccupiedSpaceCostFunctor(const double scaling_factor,
-                           const sensor::PointCloud2D& point_cloud,
-                           const ProbabilityGrid& probability_grid)
-      : scaling_factor_(scaling_factor),
-        point_cloud_(point_cloud),
-        probability_grid_(probability_grid) {}
-
-  OccupiedSpaceCostFunctor(const OccupiedSpaceCostFunctor&) = delete;
-  OccupiedSpaceCostFunctor& operator=(const OccupiedSpaceCostFunctor&) = delete;
-
-  template <typename T>
-  bool operator()(const T* const pose, T* residual) const {
-    Eigen::Matrix<T, 2, 1> translation(pose[0], pose[1]);
-    Eigen::Rotation2D<T> rotation(pose[2]);
-    Eigen::Matrix<T, 2, 2> rotation_matrix = rotation.toRotationMatrix();
-    Eigen::Matrix<T, 3, 3> transform;
-    transform << rotation_matrix, translation, T(0.), T(0.), T(1.);
-
-    const GridArrayAdapter adapter(probability_grid_);
-    ceres::BiCubicInterpolator<GridArrayAdapter> interpolator(adapter);
-    const MapLimits& limits = probability_grid_.limits();
+  // Creates an OccupiedSpaceCostFunction using the specified map and point
+  // cloud. Both have to outlive the cost function.
+  OccupiedSpaceCostFunction(const double scaling_factor,
+                            const sensor::PointCloud2D& point_cloud,
+                            const Grid& grid)
+      : scaling_factor_(scaling_factor), point_cloud_(point_cloud), grid_(grid)
+  {
+    set_num_residuals(point_cloud_.size());
+  }
 
-    for (size_t i = 0; i < point_cloud_.size(); ++i) {
-      // Note that this is a 2D point. The third component is a scaling factor.
-      const Eigen::Matrix<T, 3, 1> point((T(point_cloud_[i].x())),
-                                         (T(point_cloud_[i].y())), T(1.));
-      const Eigen::Matrix<T, 3, 1> world = transform * point;
-      interpolator.Evaluate(
-          (limits.max().x() - world[0]) / limits.resolution() - 0.5 +
-              T(kPadding),
-          (limits.max().y() - world[1]) / limits.resolution() - 0.5 +
-              T(kPadding),
-          &residual[i]);
-      residual[i] = scaling_factor_ * (1. - residual[i]);
+  OccupiedSpaceCostFunction(const OccupiedSpaceCostFunction&) = delete;
+  OccupiedSpaceCostFunction& operator=(const OccupiedSpaceCostFunction&) =
+      delete;
+
+  bool Evaluate(double const* const* const parameters, double* const residuals,
+                double** const jacobians) const override
+  {
+    const double* const pose = parameters[0];
+    double* const jacobian = jacobians == nullptr ? nullptr : jacobians[0];
+    const double cos_theta = std::cos(pose[2]);
+    const double sin_theta = std::sin(pose[2]);
+    const MapLimits& limits = grid_.limits();
+    for (size_t i = 0; i < point_cloud_.size(); ++i)
+    {
+      const double x = point_cloud_[i].x();
+      const double y = point_cloud_[i].y();
+      const double world_x = cos_theta * x - sin_theta * y + pose[0];
+      const double world_y = sin_theta * x + cos_theta * y + pose[1];
+      // 栅格的x方向对应世界坐标的-y方向 y方向对应世界坐标的-x方向
+      double value;
+      double dvalue_drow;
+      double dvalue_dcolumn;
+      Interpolate((limits.max().x() - world_x) / limits.resolution() - 0.5,
+                  (limits.max().y() - world_y) / limits.resolution() - 0.5,
+                  &value, &dvalue_drow, &dvalue_dcolumn);
+      residuals[i] = scaling_factor_ * (1. - value);
+      if (jacobian != nullptr)
+      {
+        // The row and the column decrease by 1 / resolution per meter in x
+        // and y, and the residual decreases with the probability.
+        const double dresidual_dworld_x =
+            scaling_factor_ * dvalue_drow / limits.resolution();
+        const double dresidual_dworld_y =
+            scaling_factor_ * dvalue_dcolumn / limits.resolution();
+        jacobian[3 * i] = dresidual_dworld_x;
+        jacobian[3 * i + 1] = dresidual_dworld_y;
+        jacobian[3 * i + 2] =
+            dresidual_dworld_x * (-sin_theta * x - cos_theta * y) +
+            dresidual_dworld_y * (cos_theta * x - sin_theta * y);
+      }
     }
     return true;
   }
 
  private:
-  static constexpr int kPadding = INT_MAX / 4;
-  class GridArrayAdapter {
-   public:
-    enum { DATA_DIMENSION = 1 };
-
-    explicit GridArrayAdapter(const ProbabilityGrid& probability_grid)
-        : probability_grid_(probability_grid) {}
-
-    void GetValue(const int row, const int column, double* const value) const {
-      if (row < kPadding || column < kPadding || row >= NumRows() - kPadding ||
-          column >= NumCols() - kPadding) {
-        *value = mapping::kMinProbability;
-      } else {
-        *value = static_cast<double>(probability_grid_.GetProbability(
-            Eigen::Array2i(column - kPadding, row - kPadding)));
-      }
-    }
-
-    int NumRows() const {
-      return probability_grid_.limits().cell_limits().num_y_cells +
-             2 * kPadding;
+  // Returns the Catmull-Rom spline through 'p0' to 'p3' between 'p1' (at 0)
+  // and 'p2' (at 1) and its derivative at 'x', like ceres::CubicHermiteSpline.
+  static void CubicHermiteSpline(const double p0, const double p1,
+                                 const double p2, const double p3,
+                                 const double x, double* const f,
+                                 double* const dfdx)
+  {
+    const double a = 0.5 * (-p0 + 3. * p1 - 3. * p2 + p3);
+    const double b = 0.5 * (2. * p0 - 5. * p1 + 4. * p2 - p3);
+    const double c = 0.5 * (-p0 + p2);
+    const double d = p1;
+    *f = d + x * (c + x * (b + x * a));
+    if (dfdx != nullptr)
+    {
+      *dfdx = c + x * (2. * b + 3. * a * x);
     }
+  }
 
-    int NumCols() const {
-      return probability_grid_.limits().cell_limits().num_x_cells +
-             2 * kPadding;
+  // Bicubic interpolation of the probabilities at the continuous 'row' (the y
+  // index) and 'column' (the x index) in the same order as
+  // ceres::BiCubicInterpolator: first along each of the four rows, then along
+  // the column.
+  void Interpolate(const double row, const double column, double* const value,
+                   double* const dvalue_drow,
+                   double* const dvalue_dcolumn) const
+  {
+    const int row_index = std::floor(row);
+    const int column_index = std::floor(column);
+    double values[4];
+    double dvalues_dcolumn[4];
+    for (int i = 0; i != 4; ++i)
+    {
+      const int y = row_index - 1 + i;
+      CubicHermiteSpline(
+          grid_.GetProbability(Eigen::Array2i(column_index - 1, y)),
+          grid_.GetProbability(Eigen::Array2i(column_index, y)),
+          grid_.GetProbability(Eigen::Array2i(column_index + 1, y)),
+          grid_.GetProbability(Eigen::Array2i(column_index + 2, y)),
+          column - column_index, &values[i], &dvalues_dcolumn[i]);
     }
-
-   private:
-    const ProbabilityGrid& probability_grid_;
-  };
+    CubicHermiteSpline(values[0], values[1], values[2], values[3],
+                       row - row_index, value, dvalue_drow);
+    CubicHermiteSpline(dvalues_dcolumn[0], dvalues_dcolumn[1],
+                       dvalues_dcolumn[2], dvalues_dcolumn[3],
+                       row - row_index, dvalue_dcolumn, nullptr);
+  }
 
   const double scaling_factor_;
   const sensor::PointCloud2D& point_cloud_;
-  const ProbabilityGrid& probability_grid_;
+  const Grid& grid_;
 };
 
 }  // namespace scan_matching
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/occupied_space_cost_functor.h"
+
+#include <vector>
+
+#include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/float_probability_grid.h"
+#include "../sensor/point_cloud.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+namespace {
+
+class OccupiedSpaceCostFunctionTest : public ::testing::Test {
+ protected:
+  OccupiedSpaceCostFunctionTest()
+      : probability_grid_(
+            MapLimits(0.1, Eigen::Vector2d(1., 1.), CellLimits(20, 20))) {
+    probability_grid_.StartUpdate();
+    for (int x = 4; x != 12; ++x) {
+      for (int y = 6; y != 15; ++y) {
+        probability_grid_.SetProbability(Eigen::Array2i(x, y),
+                                         0.1f + 0.01f * ((3 * x + 7 * y) % 80));
+      }
+    }
+    point_cloud_.emplace_back(0.1f, 0.2f);
+    point_cloud_.emplace_back(-0.25f, 0.03f);
+    point_cloud_.emplace_back(0.32f, -0.4f);
+    // Outside of the known cells.
+    point_cloud_.emplace_back(0.9f, 0.85f);
+  }
+
+  ProbabilityGrid probability_grid_;
+  sensor::PointCloud2D point_cloud_;
+};
+
+TEST_F(OccupiedSpaceCostFunctionTest, FloatProbabilityGridIsTheSame) {
+  const FloatProbabilityGrid float_probability_grid(probability_grid_);
+  for (int x = -3; x != 23; ++x) {
+    for (int y = -3; y != 23; ++y) {
+      const Eigen::Array2i xy_index(x, y);
+      EXPECT_EQ(probability_grid_.GetProbability(xy_index),
+                float_probability_grid.GetProbability(xy_index));
+    }
+  }
+}
+
+TEST_F(OccupiedSpaceCostFunctionTest, JacobianMatchesNumericalDerivative) {
+  const FloatProbabilityGrid float_probability_grid(probability_grid_);
+  const OccupiedSpaceCostFunction<ProbabilityGrid> cost_function(
+      2., point_cloud_, probability_grid_);
+  const OccupiedSpaceCostFunction<FloatProbabilityGrid> float_cost_function(
+      2., point_cloud_, float_probability_grid);
+  ASSERT_EQ(static_cast<int>(point_cloud_.size()),
+            cost_function.num_residuals());
+
+  const int num_residuals = point_cloud_.size();
+  double pose[3] = {0.013, -0.041, 0.3};
+  const double* parameters[] = {pose};
+  std::vector<double> residuals(num_residuals);
+  std::vector<double> jacobian(3 * num_residuals);
+  double* jacobians[] = {jacobian.data()};
+  ASSERT_TRUE(
+      cost_function.Evaluate(parameters, residuals.data(), jacobians));
+
+  std::vector<double> float_residuals(num_residuals);
+  std::vector<double> float_jacobian(3 * num_residuals);
+  double* float_jacobians[] = {float_jacobian.data()};
+  ASSERT_TRUE(float_cost_function.Evaluate(
+      parameters, float_residuals.data(), float_jacobians));
+  EXPECT_EQ(residuals, float_residuals);
+  EXPECT_EQ(jacobian, float_jacobian);
+
+  constexpr double kDelta = 1e-6;
+  for (int j = 0; j != 3; ++j) {
+    std::vector<double> plus_residuals(num_residuals);
+    std::vector<double> minus_residuals(num_residuals);
+    pose[j] += kDelta;
+    cost_function.Evaluate(parameters, plus_residuals.data(), nullptr);
+    pose[j] -= 2. * kDelta;
+    cost_function.Evaluate(parameters, minus_residuals.data(), nullptr);
+    pose[j] += kDelta;
+    for (int i = 0; i != num_residuals; ++i) {
+      EXPECT_NEAR((plus_residuals[i] - minus_residuals[i]) / (2. * kDelta),
+                  jacobian[3 * i + j], 1e-4)
+          << "residual " << i << " parameter " << j;
+    }
+  }
+  EXPECT_NEAR(2. * (1. - mapping::kMinProbability), residuals.back(), 1e-9);
+  EXPECT_NEAR(0., jacobian.back(), 1e-9);
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/precomputation_grid_stack_cache.h"
+
+#include "../common/make_unique.h"
+#include "glog/logging.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+PrecomputedGrids::PrecomputedGrids(
+    std::unique_ptr<const PrecomputationGridStack> precomputation_grid_stack,
+    const ProbabilityGrid& probability_grid)
+    : precomputation_grid_stack(std::move(precomputation_grid_stack)),
+      float_probability_grid(probability_grid) {}
+
+size_t PrecomputedGrids::MemoryUsage() const
+{
+  return sizeof(*this) + precomputation_grid_stack->MemoryUsage() +
+         float_probability_grid.MemoryUsage();
+}
+
+PrecomputationGridStackCache::PrecomputationGridStackCache(
+    const size_t max_memory_in_bytes)
+    : max_memory_in_bytes_(max_memory_in_bytes) {}
+
+std::shared_ptr<const PrecomputedGrids> PrecomputationGridStackCache::Get(
+    const ProbabilityGrid& probability_grid,
+    const proto::FastCorrelativeScanMatcherOptions& options)
+{
+  return Get(probability_grid, options, [&probability_grid, &options]() {
+    return common::make_unique<PrecomputationGridStack>(probability_grid,
+                                                        options);
+  });
+}
+
+std::shared_ptr<const PrecomputedGrids> PrecomputationGridStackCache::Get(
+    const ProbabilityGrid& probability_grid,
+    const proto::FastCorrelativeScanMatcherOptions& options,
+    const std::function<std::unique_ptr<PrecomputationGridStack>()>&
+        compute_stack)
+{
+  const Key key(&probability_grid, options.branch_and_bound_depth());
+  {
+    common::MutexLocker locker(&mutex_);
+    // If another thread is computing the same grids, waits for its result.
+    locker.Await([this, &key]() REQUIRES(mutex_) {
+      return keys_in_progress_.count(key) == 0;
+    });
+    const auto it = index_.find(key);
+    if (it != index_.end())
+    {
+      //命中 移动到最前面
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return it->second->grids;
+    }
+    keys_in_progress_.insert(key);
+  }
+
+  // Computing the grids takes long, so threads asking for other grids are not
+  // blocked by it.
+  std::unique_ptr<PrecomputationGridStack> stack = compute_stack();
+  CHECK(stack != nullptr);
+  CHECK_EQ(stack->max_depth() + 1, key.second);
+  auto grids = std::make_shared<const PrecomputedGrids>(std::move(stack),
+                                                         probability_grid);
+  common::MutexLocker locker(&mutex_);
+  keys_in_progress_.erase(key);
+  return InsertLocked(key, std::move(grids));
+}
+
+size_t PrecomputationGridStackCache::memory_usage() const
+{
+  common::MutexLocker locker(&mutex_);
+  return memory_usage_;
+}
+
+int PrecomputationGridStackCache::size() const
+{
+  common::MutexLocker locker(&mutex_);
+  return entries_.size();
+}
+
+std::shared_ptr<const PrecomputedGrids>
+PrecomputationGridStackCache::InsertLocked(
+    const Key& key, std::shared_ptr<const PrecomputedGrids> grids)
+{
+  CHECK_EQ(index_.count(key), 0);
+  const size_t grids_memory_usage = grids->MemoryUsage();
+  entries_.push_front(Entry{key, std::move(grids), grids_memory_usage});
+  index_.emplace(key, entries_.begin());
+  memory_usage_ += grids_memory_usage;
+  EvictLocked();
+  return entries_.front().grids;
+}
+
+void PrecomputationGridStackCache::EvictLocked()
+{
+  // The most recently used entry at the front is always kept.
+  auto it = entries_.end();
+  while (memory_usage_ > max_memory_in_bytes_ && --it != entries_.begin())
+  {
+    // Dropping grids which are in use would not free them.
+    if (it->grids.use_count() > 1)
+    {
+      continue;
+    }
+    memory_usage_ -= it->memory_usage;
+    index_.erase(it->key);
+    it = entries_.erase(it);
+  }
+}
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_PRECOMPUTATION_GRID_STACK_CACHE_H_
+#define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_PRECOMPUTATION_GRID_STACK_CACHE_H_
+
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+
+#include "../common/mutex.h"
+#include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
+#include "../mapping_2d/scan_matching/float_probability_grid.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+// The grids computed once from a finished probability grid to match scans
+// against it: the PrecomputationGridStack for the FastCorrelativeScanMatcher
+// and the FloatProbabilityGrid for the CeresScanMatcher.
+struct PrecomputedGrids
+{
+  PrecomputedGrids(
+      std::unique_ptr<const PrecomputationGridStack> precomputation_grid_stack,
+      const ProbabilityGrid& probability_grid);
+
+  // Approximate number of bytes held by both grids.
+  size_t MemoryUsage() const;
+
+  const std::unique_ptr<const PrecomputationGridStack>
+      precomputation_grid_stack;
+  const FloatProbabilityGrid float_probability_grid;
+};
+
+// Caches the PrecomputedGrids of finished probability grids so that every
+// scan matcher of the same grid shares them instead of building its own.
+// 每一个已经完成的submap只计算一次多分辨率地图和浮点地图，所有的匹配器共享这个结果。
+//
+// The grids are reference counted. Once the cached grids use more than
+// 'max_memory_in_bytes', the least recently used ones are dropped from the
+// cache and will be computed again on the next Get(). Grids which are still in
+// use, i.e. referenced from outside of the cache, are not dropped, since that
+// would not free their memory: a batch of matches against one submap keeps its
+// grids until it is done, and the memory usage exceeds the budget by at most
+// the grids in use.
+// 超过内存上限的时候，最久没有使用且当前没有被匹配器引用的地图会被删除，下次用到的时候再重新计算
+//
+// Other than that, eviction only looks at the order of the Get() calls. If the
+// submaps matched in turn need more memory than the budget, e.g. loop closure
+// searches cycling over more submaps than fit, each Get() drops exactly the
+// grids that are asked for next and every Get() recomputes them. The budget
+// should hold the submaps in the search window of a scan.
+// 如果轮流匹配的submap超过内存上限，每次都会重新计算，内存上限应该能容纳一次搜索用到的submap
+//
+// Each entry is built by only one thread at a time: other threads asking for
+// the same grids meanwhile wait for them instead of building them again.
+// 同一个地图只有一个线程在计算，其他线程等待计算结果
+//
+// This class is thread-safe. The probability grids are identified by their
+// address, so they must not change after the first Get() and must outlive the
+// cache.
+class PrecomputationGridStackCache
+{
+ public:
+  explicit PrecomputationGridStackCache(size_t max_memory_in_bytes);
+
+  PrecomputationGridStackCache(const PrecomputationGridStackCache&) = delete;
+  PrecomputationGridStackCache& operator=(const PrecomputationGridStackCache&) =
+      delete;
+
+  // Returns the grids for 'probability_grid' and
+  // 'options.branch_and_bound_depth()', computing them if they are not cached.
+  // The computation is done without holding the lock.
+  std::shared_ptr<const PrecomputedGrids> Get(
+      const ProbabilityGrid& probability_grid,
+      const proto::FastCorrelativeScanMatcherOptions& options) EXCLUDES(mutex_);
+
+  // Like above, but calls 'compute_stack' to obtain a stack that is not cached,
+  // e.g. to read it from a file. The returned stack must have been computed
+  // from 'probability_grid' and 'options'.
+  std::shared_ptr<const PrecomputedGrids> Get(
+      const ProbabilityGrid& probability_grid,
+      const proto::FastCorrelativeScanMatcherOptions& options,
+      const std::function<std::unique_ptr<PrecomputationGridStack>()>&
+          compute_stack) EXCLUDES(mutex_);
+
+  // Number of bytes used by the cached grids, including those in use.
+  size_t memory_usage() const EXCLUDES(mutex_);
+
+  // Number of cached entries.
+  int size() const EXCLUDES(mutex_);
+
+ private:
+  using Key = std::pair<const ProbabilityGrid*, int>;
+
+  struct Entry
+  {
+    Key key;
+    std::shared_ptr<const PrecomputedGrids> grids;
+    size_t memory_usage;
+  };
+
+  // Adds 'grids' for 'key', which must not be cached yet. Returns the cached
+  // grids.
+  std::shared_ptr<const PrecomputedGrids> InsertLocked(
+      const Key& key, std::shared_ptr<const PrecomputedGrids> grids)
+      REQUIRES(mutex_);
+
+  // Drops the least recently used entries which are not in use until the
+  // budget is met. The most recently used entry is always kept.
+  void EvictLocked() REQUIRES(mutex_);
+
+  const size_t max_memory_in_bytes_;
+
+  mutable common::Mutex mutex_;
+  // Most recently used entries first.
+  std::list<Entry> entries_ GUARDED_BY(mutex_);
+  std::map<Key, std::list<Entry>::iterator> index_ GUARDED_BY(mutex_);
+  size_t memory_usage_ GUARDED_BY(mutex_) = 0;
+  // Keys of the entries that are being computed.
+  std::set<Key> keys_in_progress_ GUARDED_BY(mutex_);
+};
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_PRECOMPUTATION_GRID_STACK_CACHE_H_
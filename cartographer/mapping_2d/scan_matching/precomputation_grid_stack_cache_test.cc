@@ -0,0 +1,217 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/precomputation_grid_stack_cache.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/lua_parameter_dictionary_test_helpers.h"
+#include "../common/make_unique.h"
+#include "../mapping_2d/probability_grid.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+namespace {
+
+proto::FastCorrelativeScanMatcherOptions
+CreateFastCorrelativeScanMatcherTestOptions(const int branch_and_bound_depth) {
+  auto parameter_dictionary =
+      common::MakeDictionary(R"text(
+      return {
+         linear_search_window = 3.,
+         angular_search_window = 1.,
+         branch_and_bound_depth = )text" +
+                             std::to_string(branch_and_bound_depth) + "}");
+  return CreateFastCorrelativeScanMatcherOptions(parameter_dictionary.get());
+}
+
+ProbabilityGrid CreateProbabilityGrid() {
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(100, 100)));
+  probability_grid.StartUpdate();
+  probability_grid.SetProbability(Eigen::Array2i(10, 20), 0.7);
+  return probability_grid;
+}
+
+TEST(PrecomputationGridStackCacheTest, SharesGrids) {
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(3);
+  const ProbabilityGrid probability_grid = CreateProbabilityGrid();
+  PrecomputationGridStackCache cache(1 << 30);
+
+  const auto grids = cache.Get(probability_grid, options);
+  ASSERT_NE(nullptr, grids);
+  EXPECT_EQ(2, grids->precomputation_grid_stack->max_depth());
+  EXPECT_EQ(grids, cache.Get(probability_grid, options));
+  EXPECT_EQ(1, cache.size());
+  // Both the stack and the float copy are counted.
+  EXPECT_EQ(grids->MemoryUsage(), cache.memory_usage());
+  EXPECT_GT(grids->MemoryUsage(),
+            grids->precomputation_grid_stack->MemoryUsage() +
+                grids->float_probability_grid.MemoryUsage());
+  EXPECT_GT(grids->float_probability_grid.MemoryUsage(), 0);
+  EXPECT_NEAR(0.7, grids->float_probability_grid.GetProbability(
+                       Eigen::Array2i(10, 20)),
+              1e-3);
+
+  // A different depth needs its own stack.
+  const auto deeper_grids =
+      cache.Get(probability_grid, CreateFastCorrelativeScanMatcherTestOptions(5));
+  EXPECT_EQ(4, deeper_grids->precomputation_grid_stack->max_depth());
+  EXPECT_EQ(2, cache.size());
+}
+
+TEST(PrecomputationGridStackCacheTest, EvictsLeastRecentlyUsed) {
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(3);
+  const ProbabilityGrid grid_a = CreateProbabilityGrid();
+  const ProbabilityGrid grid_b = CreateProbabilityGrid();
+  const ProbabilityGrid grid_c = CreateProbabilityGrid();
+  PrecomputationGridStackCache cache(1 << 30);
+  const size_t grids_memory_usage = cache.Get(grid_a, options)->MemoryUsage();
+  PrecomputationGridStackCache small_cache(2 * grids_memory_usage);
+
+  auto grids_a = small_cache.Get(grid_a, options);
+  auto grids_b = small_cache.Get(grid_b, options);
+  EXPECT_EQ(2, small_cache.size());
+  // Touching 'grid_a' makes 'grid_b' the least recently used one.
+  EXPECT_EQ(grids_a, small_cache.Get(grid_a, options));
+  grids_a.reset();
+  grids_b.reset();
+  small_cache.Get(grid_c, options);
+  EXPECT_EQ(2, small_cache.size());
+  EXPECT_EQ(2 * grids_memory_usage, small_cache.memory_usage());
+
+  // Only the evicted grids are computed again.
+  int num_computations = 0;
+  const auto counting_compute_stack = [&](const ProbabilityGrid& grid) {
+    return [&num_computations, &grid, &options]() {
+      ++num_computations;
+      return common::make_unique<PrecomputationGridStack>(grid, options);
+    };
+  };
+  small_cache.Get(grid_a, options, counting_compute_stack(grid_a));
+  EXPECT_EQ(0, num_computations);
+  small_cache.Get(grid_b, options, counting_compute_stack(grid_b));
+  EXPECT_EQ(1, num_computations);
+  EXPECT_EQ(2, small_cache.size());
+}
+
+TEST(PrecomputationGridStackCacheTest, KeepsGridsInUse) {
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(3);
+  const ProbabilityGrid grid_a = CreateProbabilityGrid();
+  const ProbabilityGrid grid_b = CreateProbabilityGrid();
+  const ProbabilityGrid grid_c = CreateProbabilityGrid();
+  PrecomputationGridStackCache cache(0);
+
+  const auto grids_a = cache.Get(grid_a, options);
+  // Matchers share the ownership of the grids.
+  FastCorrelativeScanMatcher matcher(
+      grid_a,
+      std::shared_ptr<const PrecomputationGridStack>(
+          grids_a, grids_a->precomputation_grid_stack.get()),
+      options);
+  const auto grids_b = cache.Get(grid_b, options);
+  EXPECT_EQ(2, cache.size());
+  EXPECT_EQ(grids_a, cache.Get(grid_a, options));
+  EXPECT_EQ(grids_b, cache.Get(grid_b, options));
+  EXPECT_EQ(grids_a->MemoryUsage() + grids_b->MemoryUsage(),
+            cache.memory_usage());
+
+  // Only grids no longer in use are dropped.
+  cache.Get(grid_c, options);
+  EXPECT_EQ(3, cache.size());
+}
+
+TEST(PrecomputationGridStackCacheTest, KeepsMostRecentlyUsedAboveBudget) {
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(3);
+  const ProbabilityGrid grid_a = CreateProbabilityGrid();
+  const ProbabilityGrid grid_b = CreateProbabilityGrid();
+  PrecomputationGridStackCache cache(0);
+  const auto* const grids_a = cache.Get(grid_a, options).get();
+  EXPECT_EQ(1, cache.size());
+  EXPECT_EQ(grids_a, cache.Get(grid_a, options).get());
+  cache.Get(grid_b, options);
+  EXPECT_EQ(1, cache.size());
+}
+
+TEST(PrecomputationGridStackCacheTest, ComputesEachStackOnce) {
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(3);
+  const ProbabilityGrid probability_grid = CreateProbabilityGrid();
+  PrecomputationGridStackCache cache(1 << 30);
+
+  std::atomic<int> num_computations(0);
+  const auto compute_stack = [&]() {
+    ++num_computations;
+    // Gives the other threads time to ask for the same stack.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return common::make_unique<PrecomputationGridStack>(probability_grid,
+                                                        options);
+  };
+  std::vector<std::shared_ptr<const PrecomputedGrids>> grids(4);
+  std::vector<std::thread> threads;
+  for (auto& thread_grids : grids) {
+    threads.emplace_back([&]() {
+      thread_grids = cache.Get(probability_grid, options, compute_stack);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(1, num_computations);
+  for (const auto& thread_grids : grids) {
+    ASSERT_NE(nullptr, thread_grids);
+    EXPECT_EQ(grids.front(), thread_grids);
+  }
+  EXPECT_EQ(1, cache.size());
+}
+
+TEST(PrecomputationGridStackCacheTest, ObtainsEvictedStacksAgain) {
+  const auto options = CreateFastCorrelativeScanMatcherTestOptions(3);
+  const ProbabilityGrid grid_a = CreateProbabilityGrid();
+  const ProbabilityGrid grid_b = CreateProbabilityGrid();
+  PrecomputationGridStackCache cache(0);
+
+  // Stands in for reading the stack from a file.
+  const PrecomputationGridStack stored_stack(grid_a, options);
+  int num_reads = 0;
+  const auto read_stack = [&]() {
+    ++num_reads;
+    return common::make_unique<PrecomputationGridStack>(
+        stored_stack.ToProto());
+  };
+  cache.Get(grid_a, options, read_stack);
+  cache.Get(grid_a, options, read_stack);
+  EXPECT_EQ(1, num_reads);
+  // Evicts the stack of 'grid_a', which is then read again.
+  cache.Get(grid_b, options);
+  EXPECT_EQ(1, cache.size());
+  const auto grids = cache.Get(grid_a, options, read_stack);
+  EXPECT_EQ(2, num_reads);
+  EXPECT_EQ(stored_stack.max_depth(),
+            grids->precomputation_grid_stack->max_depth());
+  EXPECT_EQ(stored_stack.MemoryUsage(),
+            grids->precomputation_grid_stack->MemoryUsage());
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
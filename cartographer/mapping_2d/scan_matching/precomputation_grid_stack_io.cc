@@ -0,0 +1,187 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/precomputation_grid_stack_io.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "../common/make_unique.h"
+#include "glog/logging.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+namespace {
+
+// 64 bit FNV-1a hash, applied to whole 32 or 64 bit words instead of bytes
+// since it goes through every cell of the probability grid.
+class Fingerprint
+{
+ public:
+  void Add(const float value) { AddWord<uint32>(value); }
+  void Add(const double value) { AddWord<uint64>(value); }
+  void Add(const int value) { AddWord<uint32>(value); }
+
+  uint64 hash() const { return hash_; }
+
+ private:
+  template <typename Word, typename T>
+  void AddWord(const T value)
+  {
+    static_assert(sizeof(Word) == sizeof(T), "Word needs to be of equal size.");
+    Word word;
+    std::memcpy(&word, &value, sizeof(T));
+    hash_ = (hash_ ^ word) * 1099511628211ull;
+  }
+
+  uint64 hash_ = 14695981039346656037ull;
+};
+
+}  // namespace
+
+uint64 ComputeProbabilityGridFingerprint(
+    const ProbabilityGrid& probability_grid)
+{
+  const MapLimits& limits = probability_grid.limits();
+  Fingerprint fingerprint;
+  fingerprint.Add(limits.resolution());
+  fingerprint.Add(limits.max().x());
+  fingerprint.Add(limits.max().y());
+  fingerprint.Add(limits.cell_limits().num_x_cells);
+  fingerprint.Add(limits.cell_limits().num_y_cells);
+  // Unknown cells have the minimum probability, which is all the precomputation
+  // grids depend on.
+  for (int y = 0; y != limits.cell_limits().num_y_cells; ++y)
+  {
+    for (int x = 0; x != limits.cell_limits().num_x_cells; ++x)
+    {
+      fingerprint.Add(probability_grid.GetProbability(Eigen::Array2i(x, y)));
+    }
+  }
+  return fingerprint.hash();
+}
+
+proto::PrecomputationGridStack ToProto(
+    const PrecomputationGridStack& precomputation_grid_stack,
+    const ProbabilityGrid& probability_grid)
+{
+  proto::PrecomputationGridStack proto = precomputation_grid_stack.ToProto();
+  const MapLimits& limits = probability_grid.limits();
+  proto.set_version(kPrecomputationGridStackVersion);
+  proto.set_resolution(limits.resolution());
+  proto.set_max_x(limits.max().x());
+  proto.set_max_y(limits.max().y());
+  proto.set_num_x_cells(limits.cell_limits().num_x_cells);
+  proto.set_num_y_cells(limits.cell_limits().num_y_cells);
+  proto.set_probability_grid_fingerprint(
+      ComputeProbabilityGridFingerprint(probability_grid));
+  return proto;
+}
+
+bool IsValidPrecomputationGridStack(
+    const proto::PrecomputationGridStack& proto,
+    const ProbabilityGrid& probability_grid,
+    const proto::FastCorrelativeScanMatcherOptions& options)
+{
+  const MapLimits& limits = probability_grid.limits();
+  if (proto.version() != kPrecomputationGridStackVersion ||
+      proto.resolution() != limits.resolution() ||
+      proto.max_x() != limits.max().x() || proto.max_y() != limits.max().y() ||
+      proto.num_x_cells() != limits.cell_limits().num_x_cells ||
+      proto.num_y_cells() != limits.cell_limits().num_y_cells ||
+      proto.grid_size() != options.branch_and_bound_depth())
+  {
+    return false;
+  }
+  // Grid i has width 2^i, see PrecomputationGridStack.
+  for (int i = 0; i != proto.grid_size(); ++i)
+  {
+    const auto& grid = proto.grid(i);
+    const int width = 1 << i;
+    if (grid.offset_x() != 1 - width || grid.offset_y() != 1 - width ||
+        grid.num_x_cells() != proto.num_x_cells() + width - 1 ||
+        grid.num_y_cells() != proto.num_y_cells() + width - 1 ||
+        grid.cells().size() !=
+            static_cast<size_t>(grid.num_x_cells()) * grid.num_y_cells())
+    {
+      return false;
+    }
+  }
+  // Checked last, since it needs to go through all cells.
+  return proto.probability_grid_fingerprint() ==
+         ComputeProbabilityGridFingerprint(probability_grid);
+}
+
+bool WritePrecomputationGridStack(
+    const string& filename,
+    const PrecomputationGridStack& precomputation_grid_stack,
+    const ProbabilityGrid& probability_grid)
+{
+  const string temporary_filename = filename + ".tmp";
+  std::ofstream output_file(temporary_filename,
+                            std::ios::out | std::ios::binary);
+  const bool serialized = ToProto(precomputation_grid_stack, probability_grid)
+                              .SerializeToOstream(&output_file);
+  output_file.close();
+  if (!serialized || !output_file)
+  {
+    LOG(WARNING) << "Writing " << temporary_filename << " failed.";
+    std::remove(temporary_filename.c_str());
+    return false;
+  }
+  if (std::rename(temporary_filename.c_str(), filename.c_str()) != 0)
+  {
+    LOG(WARNING) << "Renaming " << temporary_filename << " to " << filename
+                 << " failed.";
+    std::remove(temporary_filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<PrecomputationGridStack> ReadPrecomputationGridStack(
+    const string& filename, const ProbabilityGrid& probability_grid,
+    const proto::FastCorrelativeScanMatcherOptions& options)
+{
+  std::ifstream input_file(filename, std::ios::in | std::ios::binary);
+  if (!input_file.good())
+  {
+    return nullptr;
+  }
+  // Parsing copies all cells into the proto anyway, so the whole file is read
+  // into memory first.
+  const string data((std::istreambuf_iterator<char>(input_file)),
+                    std::istreambuf_iterator<char>());
+  proto::PrecomputationGridStack proto;
+  const bool parsed = !data.empty() && proto.ParseFromString(data);
+
+  if (!parsed ||
+      !IsValidPrecomputationGridStack(proto, probability_grid, options))
+  {
+    LOG(WARNING) << "Ignoring " << filename
+                 << " which does not match its probability grid.";
+    return nullptr;
+  }
+  return common::make_unique<PrecomputationGridStack>(proto);
+}
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
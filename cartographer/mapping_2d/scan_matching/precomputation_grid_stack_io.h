@@ -0,0 +1,80 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reading and writing of PrecomputationGridStacks, so that the stacks of the
+// finished submaps of a known map do not have to be recomputed when the map is
+// used again, e.g. for global localization.
+// 把多分辨率地图存到文件里面 重新加载地图的时候就不需要再计算一遍
+
+#ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_PRECOMPUTATION_GRID_STACK_IO_H_
+#define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_PRECOMPUTATION_GRID_STACK_IO_H_
+
+#include <memory>
+#include <string>
+
+#include "../common/port.h"
+#include "../mapping_2d/probability_grid.h"
+#include "../mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
+#include "cartographer/mapping_2d/scan_matching/proto/fast_correlative_scan_matcher_options.pb.h"
+#include "cartographer/mapping_2d/scan_matching/proto/precomputation_grid_stack.pb.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+// Version of the serialized format. Needs to be increased whenever the
+// format or the values of the precomputation grids change.
+constexpr int kPrecomputationGridStackVersion = 1;
+
+// Returns a fingerprint of the limits and probabilities of 'probability_grid'.
+uint64 ComputeProbabilityGridFingerprint(
+    const ProbabilityGrid& probability_grid);
+
+// Serializes 'precomputation_grid_stack' of 'probability_grid' including the
+// header used to validate it when reading it back.
+proto::PrecomputationGridStack ToProto(
+    const PrecomputationGridStack& precomputation_grid_stack,
+    const ProbabilityGrid& probability_grid);
+
+// Returns true if 'proto' has the current version, was computed from
+// 'probability_grid' with the depth given in 'options' and its grids are
+// consistent.
+bool IsValidPrecomputationGridStack(
+    const proto::PrecomputationGridStack& proto,
+    const ProbabilityGrid& probability_grid,
+    const proto::FastCorrelativeScanMatcherOptions& options);
+
+// Writes 'precomputation_grid_stack' of 'probability_grid' to 'filename'. The
+// stack is written to a temporary file next to it first, which is then renamed,
+// so that readers never see a partially written file. Returns false if writing
+// failed, in which case the caller can go on with the stack it has.
+bool WritePrecomputationGridStack(
+    const string& filename,
+    const PrecomputationGridStack& precomputation_grid_stack,
+    const ProbabilityGrid& probability_grid);
+
+// Reads the stack of 'probability_grid' from 'filename'. Returns nullptr if
+// the file does not exist or does not belong to 'probability_grid' and
+// 'options', so that the caller can compute the stack instead.
+std::unique_ptr<PrecomputationGridStack> ReadPrecomputationGridStack(
+    const string& filename, const ProbabilityGrid& probability_grid,
+    const proto::FastCorrelativeScanMatcherOptions& options);
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_PRECOMPUTATION_GRID_STACK_IO_H_
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/precomputation_grid_stack_io.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+#include "../mapping_2d/probability_grid.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+namespace {
+
+class PrecomputationGridStackIoTest : public ::testing::Test {
+ protected:
+  PrecomputationGridStackIoTest()
+      : probability_grid_(
+            MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(90, 70))),
+        filename_(::testing::TempDir() + "precomputation_grid_stack_io_test") {
+    std::mt19937 prng(42);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    probability_grid_.StartUpdate();
+    for (const Eigen::Array2i& xy_index :
+         XYIndexRangeIterator(Eigen::Array2i(5, 10), Eigen::Array2i(79, 59))) {
+      probability_grid_.SetProbability(
+          xy_index, PrecomputationGrid::ToProbability(distribution(prng)));
+    }
+    options_.set_branch_and_bound_depth(4);
+  }
+
+  ~PrecomputationGridStackIoTest() override { std::remove(filename_.c_str()); }
+
+  ProbabilityGrid probability_grid_;
+  proto::FastCorrelativeScanMatcherOptions options_;
+  const string filename_;
+};
+
+TEST_F(PrecomputationGridStackIoTest, WriteAndRead) {
+  const PrecomputationGridStack expected(probability_grid_, options_);
+  EXPECT_TRUE(
+      WritePrecomputationGridStack(filename_, expected, probability_grid_));
+  const std::unique_ptr<PrecomputationGridStack> actual =
+      ReadPrecomputationGridStack(filename_, probability_grid_, options_);
+  ASSERT_NE(nullptr, actual);
+  ASSERT_EQ(expected.max_depth(), actual->max_depth());
+  for (int depth = 0; depth <= expected.max_depth(); ++depth) {
+    EXPECT_EQ(expected.Get(depth).width(), actual->Get(depth).width());
+    for (const Eigen::Array2i& xy_index :
+         XYIndexRangeIterator(Eigen::Array2i(-10, -10), Eigen::Array2i(95, 75))) {
+      EXPECT_EQ(expected.Get(depth).GetValue(xy_index),
+                actual->Get(depth).GetValue(xy_index));
+    }
+  }
+}
+
+TEST_F(PrecomputationGridStackIoTest, RejectsMismatches) {
+  EXPECT_EQ(nullptr,
+            ReadPrecomputationGridStack(filename_, probability_grid_, options_));
+
+  const PrecomputationGridStack stack(probability_grid_, options_);
+  EXPECT_TRUE(
+      WritePrecomputationGridStack(filename_, stack, probability_grid_));
+
+  proto::FastCorrelativeScanMatcherOptions deeper_options = options_;
+  deeper_options.set_branch_and_bound_depth(5);
+  EXPECT_EQ(nullptr, ReadPrecomputationGridStack(filename_, probability_grid_,
+                                                 deeper_options));
+
+  proto::PrecomputationGridStack proto = ToProto(stack, probability_grid_);
+  EXPECT_TRUE(
+      IsValidPrecomputationGridStack(proto, probability_grid_, options_));
+  proto.set_version(kPrecomputationGridStackVersion + 1);
+  EXPECT_FALSE(
+      IsValidPrecomputationGridStack(proto, probability_grid_, options_));
+  proto = ToProto(stack, probability_grid_);
+  proto.mutable_grid(2)->mutable_cells()->resize(10);
+  EXPECT_FALSE(
+      IsValidPrecomputationGridStack(proto, probability_grid_, options_));
+
+  // The probability grid changed after the stack was written.
+  probability_grid_.StartUpdate();
+  probability_grid_.SetProbability(Eigen::Array2i(1, 1), 0.8);
+  EXPECT_EQ(nullptr,
+            ReadPrecomputationGridStack(filename_, probability_grid_, options_));
+}
+
+TEST_F(PrecomputationGridStackIoTest, ReportsFailedWrites) {
+  const PrecomputationGridStack stack(probability_grid_, options_);
+  EXPECT_FALSE(WritePrecomputationGridStack(
+      filename_ + "_missing_directory/stack", stack, probability_grid_));
+
+  // Renaming the temporary file onto a directory fails, and the temporary file
+  // is removed again.
+  const string directory = filename_ + "_directory";
+  ASSERT_EQ(0, mkdir(directory.c_str(), 0700));
+  EXPECT_FALSE(
+      WritePrecomputationGridStack(directory, stack, probability_grid_));
+  EXPECT_FALSE(std::ifstream(directory + ".tmp").good());
+  EXPECT_EQ(0, rmdir(directory.c_str()));
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
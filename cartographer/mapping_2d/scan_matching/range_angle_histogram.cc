@@ -0,0 +1,150 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/range_angle_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../mapping_2d/xy_index.h"
+#include "../sensor/voxel_filter.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+namespace {
+
+// Cells above this probability are treated as points of a submap.
+constexpr float kMinOccupiedProbability = 0.6f;
+
+// Scans and submaps are voxel filtered with the same edge length, so that both
+// have a similar density of points.
+constexpr float kVoxelSize = 0.2f;
+
+// Only pairs of points at least 'kMinRange' and less than 'kMaxRange' apart are
+// counted. Larger distances are often not visible from a single pose.
+constexpr float kMinRange = 0.2f;
+constexpr float kMaxRange = 6.f;
+
+}  // namespace
+
+constexpr int RangeAngleHistogram::kNumRangeBins;
+constexpr int RangeAngleHistogram::kNumAngleBins;
+
+RangeAngleHistogram::RangeAngleHistogram(
+    const ProbabilityGrid& probability_grid)
+{
+  const MapLimits& limits = probability_grid.limits();
+  Eigen::Array2i offset;
+  CellLimits cell_limits;
+  probability_grid.ComputeCroppedLimits(&offset, &cell_limits);
+  sensor::PointCloud2D points;
+  for (const Eigen::Array2i& xy_index : XYIndexRangeIterator(cell_limits))
+  {
+    const Eigen::Array2i index = xy_index + offset;
+    if (probability_grid.GetProbability(index) > kMinOccupiedProbability)
+    {
+      // 栅格的x方向对应世界坐标的-y方向 y方向对应世界坐标的-x方向
+      points.emplace_back(
+          limits.max().x() - (index.y() + 0.5) * limits.resolution(),
+          limits.max().y() - (index.x() + 0.5) * limits.resolution());
+    }
+  }
+  AddPoints(std::move(points));
+}
+
+RangeAngleHistogram::RangeAngleHistogram(
+    const sensor::PointCloud2D& point_cloud)
+{
+  AddPoints(point_cloud);
+}
+
+float RangeAngleHistogram::Match(const RangeAngleHistogram& other) const
+{
+  const float normalization = histogram_.norm() * other.histogram_.norm();
+  if (normalization < 1e-3f)
+  {
+    return 0.f;
+  }
+  // A rotation by one angle bin shifts the columns of the histogram by one.
+  // The best cyclic shift is used.
+  float best_correlation = 0.f;
+  for (int shift = 0; shift != kNumAngleBins; ++shift)
+  {
+    float correlation = 0.f;
+    for (int angle = 0; angle != kNumAngleBins; ++angle)
+    {
+      correlation += histogram_.col(angle).dot(
+          other.histogram_.col((angle + shift) % kNumAngleBins));
+    }
+    best_correlation = std::max(best_correlation, correlation);
+  }
+  return best_correlation / normalization;
+}
+
+void RangeAngleHistogram::AddPoints(sensor::PointCloud2D points)
+{
+  histogram_.setZero();
+  points = sensor::VoxelFiltered(points, kVoxelSize);
+  // Sorted by x, so that only the pairs which can be closer than 'kMaxRange'
+  // are looked at.
+  std::sort(points.begin(), points.end(),
+            [](const Eigen::Vector2f& lhs, const Eigen::Vector2f& rhs) {
+              return lhs.x() < rhs.x();
+            });
+  for (size_t i = 0; i < points.size(); ++i)
+  {
+    for (size_t j = i + 1;
+         j < points.size() && points[j].x() - points[i].x() < kMaxRange; ++j)
+    {
+      const Eigen::Vector2f delta = points[j] - points[i];
+      const float range = delta.norm();
+      if (range < kMinRange || range >= kMaxRange)
+      {
+        continue;
+      }
+      // The direction of the line through both points is in [0, pi). It is
+      // split between the two closest angle bins, so that a small rotation
+      // changes the histogram only a little.
+      float angle = std::atan2(delta.y(), delta.x());
+      if (angle < 0.f)
+      {
+        angle += static_cast<float>(M_PI);
+      }
+      const float angle_bin =
+          angle / static_cast<float>(M_PI) * kNumAngleBins - 0.5f;
+      const int lower_angle_bin = std::floor(angle_bin);
+      const float upper_weight = angle_bin - lower_angle_bin;
+      const int range_bin = std::min(
+          kNumRangeBins - 1, static_cast<int>((range - kMinRange) /
+                                              (kMaxRange - kMinRange) *
+                                              kNumRangeBins));
+      histogram_(range_bin,
+                 (lower_angle_bin + kNumAngleBins) % kNumAngleBins) +=
+          1.f - upper_weight;
+      histogram_(range_bin, (lower_angle_bin + 1) % kNumAngleBins) +=
+          upper_weight;
+    }
+  }
+  // Long walls contribute many pairs. Taking the square root keeps them from
+  // dominating the comparison.
+  histogram_ = histogram_.cwiseSqrt();
+}
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
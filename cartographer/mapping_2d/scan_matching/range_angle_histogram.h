@@ -0,0 +1,64 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_RANGE_ANGLE_HISTOGRAM_H_
+#define CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_RANGE_ANGLE_HISTOGRAM_H_
+
+#include "eigen3/Eigen/Core"
+#include "../mapping_2d/probability_grid.h"
+#include "../sensor/point_cloud.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+
+// A cheap global descriptor of a finished submap or of a laser scan, used to
+// decide which submaps are worth a full branch and bound search during global
+// localization.
+// 用来进行全局定位时的粗匹配 只有和激光数据最像的submap才进行分枝定界搜索
+//
+// For all pairs of nearby points, the histogram counts the distance between
+// the two points and the direction of the line through them. Distances do not
+// change when a scan is moved or rotated, and a rotation only shifts the
+// directions. Match() therefore finds submaps independent of the unknown pose
+// of the scan, similar to the 3D RotationalScanMatcher.
+class RangeAngleHistogram
+{
+ public:
+  static constexpr int kNumRangeBins = 12;
+  static constexpr int kNumAngleBins = 32;
+
+  // Describes the occupied cells of 'probability_grid'.
+  explicit RangeAngleHistogram(const ProbabilityGrid& probability_grid);
+
+  // Describes 'point_cloud', e.g. a scan in its own frame.
+  explicit RangeAngleHistogram(const sensor::PointCloud2D& point_cloud);
+
+  // Returns the similarity of the two descriptors between 0 (worst) and 1
+  // (best), for the best rotation between them.
+  float Match(const RangeAngleHistogram& other) const;
+
+ private:
+  void AddPoints(sensor::PointCloud2D points);
+
+  Eigen::Matrix<float, kNumRangeBins, kNumAngleBins> histogram_;
+};
+
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
+
+#endif  // CARTOGRAPHER_MAPPING_2D_SCAN_MATCHING_RANGE_ANGLE_HISTOGRAM_H_
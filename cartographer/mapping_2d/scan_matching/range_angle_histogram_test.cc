@@ -0,0 +1,122 @@
+/*
+ * Copyright 2016 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../mapping_2d/scan_matching/range_angle_histogram.h"
+
+#include "../mapping_2d/probability_grid.h"
+#include "../sensor/point_cloud.h"
+#include "../transform/transform.h"
+#include "gtest/gtest.h"
+
+namespace cartographer {
+namespace mapping_2d {
+namespace scan_matching {
+namespace {
+
+void AddWall(const Eigen::Vector2f& start, const Eigen::Vector2f& end,
+             sensor::PointCloud2D* const points) {
+  const int num_points = (end - start).norm() / 0.05f;
+  for (int i = 0; i <= num_points; ++i) {
+    points->push_back(start + (end - start) * i / num_points);
+  }
+}
+
+void AddBox(const Eigen::Vector2f& min, const Eigen::Vector2f& max,
+            sensor::PointCloud2D* const points) {
+  AddWall(min, Eigen::Vector2f(max.x(), min.y()), points);
+  AddWall(Eigen::Vector2f(max.x(), min.y()), max, points);
+  AddWall(max, Eigen::Vector2f(min.x(), max.y()), points);
+  AddWall(Eigen::Vector2f(min.x(), max.y()), min, points);
+}
+
+// A long corridor.
+sensor::PointCloud2D CreateCorridor() {
+  sensor::PointCloud2D points;
+  AddBox(Eigen::Vector2f(-4.5f, -1.f), Eigen::Vector2f(4.5f, 1.f), &points);
+  return points;
+}
+
+// A square room with a pillar in the middle.
+sensor::PointCloud2D CreateRoom() {
+  sensor::PointCloud2D points;
+  AddBox(Eigen::Vector2f(-4.f, -4.f), Eigen::Vector2f(4.f, 4.f), &points);
+  AddBox(Eigen::Vector2f(-0.5f, -0.5f), Eigen::Vector2f(0.5f, 0.5f), &points);
+  return points;
+}
+
+ProbabilityGrid CreateProbabilityGrid(const sensor::PointCloud2D& points) {
+  ProbabilityGrid probability_grid(
+      MapLimits(0.05, Eigen::Vector2d(5., 5.), CellLimits(200, 200)));
+  probability_grid.StartUpdate();
+  for (const Eigen::Vector2f& point : points) {
+    const Eigen::Array2i xy_index =
+        probability_grid.limits().GetXYIndexOfCellContainingPoint(point.x(),
+                                                                  point.y());
+    if (!probability_grid.IsKnown(xy_index)) {
+      probability_grid.SetProbability(xy_index, 0.9);
+    }
+  }
+  return probability_grid;
+}
+
+TEST(RangeAngleHistogramTest, IgnoresPose) {
+  const sensor::PointCloud2D room = CreateRoom();
+  const RangeAngleHistogram histogram(room);
+  EXPECT_NEAR(1.f, histogram.Match(histogram), 1e-6);
+  for (const double angle : {0.3, 1.2, -2.5}) {
+    const RangeAngleHistogram moved_histogram(sensor::TransformPointCloud2D(
+        room, transform::Rigid2f(Eigen::Vector2f(0.7f, -1.9f), angle)));
+    EXPECT_LT(0.9f, histogram.Match(moved_histogram));
+    EXPECT_NEAR(histogram.Match(moved_histogram),
+                moved_histogram.Match(histogram), 1e-6);
+  }
+}
+
+TEST(RangeAngleHistogramTest, PrefersSimilarSubmap) {
+  const RangeAngleHistogram corridor_histogram(
+      CreateProbabilityGrid(CreateCorridor()));
+  const RangeAngleHistogram room_histogram(
+      CreateProbabilityGrid(CreateRoom()));
+
+  // Scans which only see parts of the submaps, in the frame of the scanner.
+  sensor::PointCloud2D corridor_scan;
+  for (const Eigen::Vector2f& point : CreateCorridor()) {
+    if (point.x() < 2.f) {
+      corridor_scan.push_back(point);
+    }
+  }
+  sensor::PointCloud2D room_scan;
+  for (const Eigen::Vector2f& point : CreateRoom()) {
+    if (point.y() > -2.f) {
+      room_scan.push_back(point);
+    }
+  }
+  const transform::Rigid2f scanner_pose(Eigen::Vector2f(-1.f, 0.5f), 0.8);
+  const RangeAngleHistogram corridor_scan_histogram(
+      sensor::TransformPointCloud2D(corridor_scan, scanner_pose.inverse()));
+  const RangeAngleHistogram room_scan_histogram(
+      sensor::TransformPointCloud2D(room_scan, scanner_pose.inverse()));
+
+  EXPECT_GT(corridor_histogram.Match(corridor_scan_histogram),
+            room_histogram.Match(corridor_scan_histogram));
+  EXPECT_GT(room_histogram.Match(room_scan_histogram),
+            corridor_histogram.Match(room_scan_histogram));
+}
+
+}  // namespace
+}  // namespace scan_matching
+}  // namespace mapping_2d
+}  // namespace cartographer
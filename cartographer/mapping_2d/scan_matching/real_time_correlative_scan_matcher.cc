@@ -24,6 +24,7 @@
 #include "eigen3/Eigen/Geometry"
 #include "../common/lua_parameter_dictionary.h"
 #include "../common/math.h"
+#include "../mapping/probability_values.h"
 #include "../mapping_2d/probability_grid.h"
 #include "../sensor/point_cloud.h"
 #include "../transform/transform.h"
@@ -33,6 +34,204 @@ namespace cartographer {
 namespace mapping_2d {
 namespace scan_matching {
 
+namespace {
+
+// Difference between the probabilities of consecutive cell values, see
+// mapping::ValueToProbability().
+constexpr double kProbabilityStep =
+    (mapping::kMaxProbability - mapping::kMinProbability) / 32766.;
+
+// Number of points scored between checks whether a candidate can still beat
+// the best candidate.
+constexpr int kNumPointsPerBlock = 16;
+
+// Number of interleaved passes over the points of a scan, see
+// ScoringWindow::scans.
+constexpr int kNumInterleavedPasses = 8;
+
+// Returns the score of a candidate with 'num_points' points which are
+// 'num_steps' above kMinProbability in total and the 'penalty' for its
+// distance to the initial pose estimate. Increases with 'num_steps'.
+float ComputeScore(const int64 num_steps, const int num_points,
+                   const double penalty)
+{
+  const float mean_probability = static_cast<float>(
+      mapping::kMinProbability + kProbabilityStep * num_steps / num_points);
+  return static_cast<float>(mean_probability * penalty);
+}
+
+// Returns the factor applied to the score of a candidate at 'x', 'y' and
+// 'orientation' relative to the initial pose estimate.
+// 离初始位置越远 惩罚的越严重
+double ComputePenalty(
+    const proto::RealTimeCorrelativeScanMatcherOptions& options,
+    const double x, const double y, const double orientation)
+{
+  return std::exp(
+      -common::Pow2(std::hypot(x, y) * options.translation_delta_cost_weight() +
+                    std::abs(orientation) * options.rotation_delta_cost_weight()));
+}
+
+// Replaces each cell of the row-major 'cells' with 'num_x_cells' columns by
+// the largest of the 'size' cells starting at it. Both passes work in place,
+// since each cell only depends on cells after it. Cells closer than 'size' to
+// the end of a row or column are not used and left as they are.
+void ApplyMaxFilter(const Eigen::Array2i& size, const int num_x_cells,
+                    std::vector<uint16>* const cells)
+{
+  if (num_x_cells == 0)
+  {
+    return;
+  }
+  const int num_y_cells = cells->size() / num_x_cells;
+  for (int y = 0; y < num_y_cells; ++y)
+  {
+    uint16* const row = cells->data() + y * num_x_cells;
+    for (int x = 0; x <= num_x_cells - size.x(); ++x)
+    {
+      for (int i = 1; i != size.x(); ++i)
+      {
+        row[x] = std::max(row[x], row[x + i]);
+      }
+    }
+  }
+  for (int y = 0; y <= num_y_cells - size.y(); ++y)
+  {
+    uint16* const row = cells->data() + y * num_x_cells;
+    for (int i = 1; i != size.y(); ++i)
+    {
+      const uint16* const other_row = row + i * num_x_cells;
+      for (int x = 0; x < num_x_cells; ++x)
+      {
+        row[x] = std::max(row[x], other_row[x]);
+      }
+    }
+  }
+}
+
+// Fills 'scoring_window' with the cells of 'probability_grid' which
+// 'discrete_scans' can reach with offsets from 'min_offset' to 'max_offset'.
+// If 'coarse_cell_size' is larger than 1, the max-pooled cells for the coarse
+// search are computed as well.
+void BuildScoringWindow(const ProbabilityGrid& probability_grid,
+                        const std::vector<DiscreteScan>& discrete_scans,
+                        const Eigen::Array2i& min_offset,
+                        const Eigen::Array2i& max_offset,
+                        const int coarse_cell_size,
+                        ScoringWindow* const scoring_window)
+{
+  // Points outside of these limits do not reach a known cell with any offset
+  // and are left out, so that the window stays small even for long ranges.
+  Eigen::Array2i known_offset;
+  CellLimits known_limits;
+  probability_grid.ComputeCroppedLimits(&known_offset, &known_limits);
+  const Eigen::Array2i min_point = known_offset - max_offset;
+  const Eigen::Array2i max_point =
+      known_offset - min_offset +
+      Eigen::Array2i(known_limits.num_x_cells - 1,
+                     known_limits.num_y_cells - 1);
+  const auto reaches_known_cell = [&min_point, &max_point](
+      const Eigen::Array2i& xy_index) {
+    return (xy_index >= min_point).all() && (xy_index <= max_point).all();
+  };
+
+  Eigen::Array2i min_index = max_point;
+  Eigen::Array2i max_index = min_point;
+  for (const DiscreteScan& discrete_scan : discrete_scans)
+  {
+    for (const Eigen::Array2i& xy_index : discrete_scan)
+    {
+      if (reaches_known_cell(xy_index))
+      {
+        min_index = min_index.min(xy_index);
+        max_index = max_index.max(xy_index);
+      }
+    }
+  }
+
+  const Eigen::Array2i window_offset = min_index + min_offset;
+  const CellLimits window_limits(
+      std::max(0, max_index.x() + max_offset.x() - window_offset.x() + 1),
+      std::max(0, max_index.y() + max_offset.y() - window_offset.y() + 1));
+  scoring_window->stride = window_limits.num_x_cells;
+  scoring_window->cells.resize(window_limits.num_x_cells *
+                               window_limits.num_y_cells);
+  probability_grid.CopyValues(window_offset, window_limits,
+                              scoring_window->cells.data());
+  // Unknown cells and cells with value 1 both have kMinProbability.
+  for (uint16& cell : scoring_window->cells)
+  {
+    cell = std::max<uint16>(cell, 1) - 1;
+  }
+
+  scoring_window->max_cells = scoring_window->cells;
+  ApplyMaxFilter(max_offset - min_offset + 1, scoring_window->stride,
+                 &scoring_window->max_cells);
+  if (coarse_cell_size > 1)
+  {
+    scoring_window->coarse_cells = scoring_window->cells;
+    ApplyMaxFilter(Eigen::Array2i::Constant(coarse_cell_size),
+                   scoring_window->stride, &scoring_window->coarse_cells);
+  }
+  const int max_cells_offset =
+      min_offset.x() + min_offset.y() * scoring_window->stride;
+
+  scoring_window->scans.resize(discrete_scans.size());
+  scoring_window->num_points.resize(discrete_scans.size());
+  scoring_window->max_remaining_steps.resize(discrete_scans.size());
+  for (size_t scan_index = 0; scan_index != discrete_scans.size();
+       ++scan_index)
+  {
+    const DiscreteScan& discrete_scan = discrete_scans[scan_index];
+    std::vector<int>& scan = scoring_window->scans[scan_index];
+    scan.clear();
+    for (int pass = 0; pass != kNumInterleavedPasses; ++pass)
+    {
+      for (size_t i = pass; i < discrete_scan.size();
+           i += kNumInterleavedPasses)
+      {
+        const Eigen::Array2i& xy_index = discrete_scan[i];
+        if (reaches_known_cell(xy_index))
+        {
+          scan.push_back(
+              (xy_index.y() - window_offset.y()) * scoring_window->stride +
+              xy_index.x() - window_offset.x());
+        }
+      }
+    }
+    scoring_window->num_points[scan_index] = discrete_scan.size();
+
+    std::vector<int64>& max_remaining_steps =
+        scoring_window->max_remaining_steps[scan_index];
+    const int num_blocks =
+        (scan.size() + kNumPointsPerBlock - 1) / kNumPointsPerBlock;
+    max_remaining_steps.assign(num_blocks + 1, 0);
+    for (size_t i = 0; i != scan.size(); ++i)
+    {
+      max_remaining_steps[i / kNumPointsPerBlock] +=
+          scoring_window->max_cells[scan[i] + max_cells_offset];
+    }
+    for (int block = num_blocks - 1; block >= 0; --block)
+    {
+      max_remaining_steps[block] += max_remaining_steps[block + 1];
+    }
+  }
+}
+
+// Returns the sum of 'cells' at the points of 'scan' moved by 'offset'.
+int64 SumCells(const std::vector<uint16>& cells, const std::vector<int>& scan,
+               const int offset)
+{
+  int64 sum = 0;
+  for (const int index : scan)
+  {
+    sum += cells[index + offset];
+  }
+  return sum;
+}
+
+}  // namespace
+
 //参数配置
 proto::RealTimeCorrelativeScanMatcherOptions
 CreateRealTimeCorrelativeScanMatcherOptions(
@@ -52,9 +251,18 @@ CreateRealTimeCorrelativeScanMatcherOptions(
       parameter_dictionary->GetDouble("translation_delta_cost_weight"));
   options.set_rotation_delta_cost_weight(
       parameter_dictionary->GetDouble("rotation_delta_cost_weight"));
+  options.set_approximate_pruning(
+      parameter_dictionary->GetBool("approximate_pruning"));
+
+  options.set_coarse_search_cell_size(
+      parameter_dictionary->GetInt("coarse_search_cell_size"));
+  options.set_num_coarse_candidates_to_refine(
+      parameter_dictionary->GetInt("num_coarse_candidates_to_refine"));
 
   CHECK_GE(options.translation_delta_cost_weight(), 0.);
   CHECK_GE(options.rotation_delta_cost_weight(), 0.);
+  CHECK_GE(options.coarse_search_cell_size(), 1);
+  CHECK_GE(options.num_coarse_candidates_to_refine(), 1);
   return options;
 }
 
@@ -121,11 +329,80 @@ RealTimeCorrelativeScanMatcher::GenerateExhaustiveSearchCandidates(
   return candidates;
 }
 
+std::vector<Candidate>
+RealTimeCorrelativeScanMatcher::GenerateCoarseSearchCandidates(
+    const SearchParameters& search_parameters,
+    const ScoringWindow& scoring_window) const
+{
+  // Each block is represented by its first candidate. Its score is an upper
+  // bound for the scores of all candidates in the block.
+  // 每个块用它的第一个候选解表示 得分是块内所有候选解得分的上界
+  const int cell_size = options_.coarse_search_cell_size();
+  std::vector<Candidate> coarse_candidates;
+  for (int scan_index = 0; scan_index != search_parameters.num_scans;
+       ++scan_index)
+  {
+    const SearchParameters::LinearBounds& bounds =
+        search_parameters.linear_bounds[scan_index];
+    for (int x = bounds.min_x; x <= bounds.max_x; x += cell_size)
+    {
+      for (int y = bounds.min_y; y <= bounds.max_y; y += cell_size)
+      {
+        // The penalty is smallest for the candidate of the block which is
+        // closest to the initial pose estimate.
+        const Candidate closest_candidate(
+            scan_index,
+            common::Clamp(0, x, std::min(x + cell_size - 1, bounds.max_x)),
+            common::Clamp(0, y, std::min(y + cell_size - 1, bounds.max_y)),
+            search_parameters);
+        coarse_candidates.emplace_back(scan_index, x, y, search_parameters);
+        coarse_candidates.back().score = ComputeScore(
+            SumCells(scoring_window.coarse_cells,
+                     scoring_window.scans[scan_index],
+                     x + y * scoring_window.stride),
+            scoring_window.num_points[scan_index],
+            ComputePenalty(options_, closest_candidate.x, closest_candidate.y,
+                           closest_candidate.orientation));
+      }
+    }
+  }
+
+  const int num_refined_candidates =
+      std::min<int>(options_.num_coarse_candidates_to_refine(),
+                    coarse_candidates.size());
+  std::partial_sort(coarse_candidates.begin(),
+                    coarse_candidates.begin() + num_refined_candidates,
+                    coarse_candidates.end(), std::greater<Candidate>());
+
+  std::vector<Candidate> candidates;
+  candidates.reserve(num_refined_candidates * common::Pow2(cell_size));
+  for (int i = 0; i != num_refined_candidates; ++i)
+  {
+    const Candidate& coarse_candidate = coarse_candidates[i];
+    const SearchParameters::LinearBounds& bounds =
+        search_parameters.linear_bounds[coarse_candidate.scan_index];
+    const int max_x =
+        std::min(coarse_candidate.x_index_offset + cell_size - 1, bounds.max_x);
+    const int max_y =
+        std::min(coarse_candidate.y_index_offset + cell_size - 1, bounds.max_y);
+    for (int x = coarse_candidate.x_index_offset; x <= max_x; ++x)
+    {
+      for (int y = coarse_candidate.y_index_offset; y <= max_y; ++y)
+      {
+        candidates.emplace_back(coarse_candidate.scan_index, x, y,
+                                search_parameters);
+      }
+    }
+  }
+  return candidates;
+}
+
 /**
  * @brief RealTimeCorrelativeScanMatcher::Match
  * 实现的是RealTime CSM论文里面的方法:Computing 2D Slices
- * 这里并没有进行多分辨率地图的构建　因此这里实际上就是进行枚举而已。
- * 并没有进行什么高级的加速策略
+ * 默认不进行多分辨率地图的构建　因此这里实际上就是进行枚举而已。
+ * 不过打分时会提前剪掉不可能超过当前最优解的候选解
+ * 如果设置了coarse_search_cell_size 则先在降采样的地图上粗匹配 再细化最好的几个块
  * 用来进行scan-match来优化机器人的位姿
  * @param initial_pose_estimate         初始的机器人的位姿
  * @param point_cloud                   位于平面机器人坐标系中的点云数据
@@ -157,33 +434,49 @@ double RealTimeCorrelativeScanMatcher::Match(
       options_.linear_search_window(), options_.angular_search_window(),
       rotated_point_cloud, probability_grid.limits().resolution());
 
-  //把激光数据经过一些列的旋转操作 得到一系列的laser_scans。这里相当于已经把所有的不同角度的激光数据进行投影了。
+  //把激光数据经过一些列的旋转操作 然后转换到地图坐标系中 得到一系列的laser_scans。
+  //这里相当于已经把所有的不同角度的激光数据进行投影了。
   //后面枚举x,y的时候，就没必要进行投影了。这也是computing 2d slice比直接三层for循环快的原因
-  //这一系列的laser_scan都是经过旋转得到的
-  const std::vector<sensor::PointCloud2D> rotated_scans =
-      GenerateRotatedScans(rotated_point_cloud, search_parameters);
-
-  //把上面旋转得到的激光雷达数据 转换到 地图坐标系中
   //经过这个函数之后，所有的激光数据的原点都和世界坐标系重合。
   //而角度也都是在世界坐标系中描述的。
   //因此对于各个不同的x_offset y_offset只需要进行激光端点的平移就可以
-  const std::vector<DiscreteScan> discrete_scans = DiscretizeScans(
-      probability_grid.limits(), rotated_scans,
+  common::MutexLocker locker(&mutex_);
+  const std::vector<DiscreteScan>& discrete_scans = DiscretizeRotatedScans(
+      probability_grid.limits(), rotated_point_cloud, search_parameters,
       Eigen::Translation2f(initial_pose_estimate.translation().x(),
-                           initial_pose_estimate.translation().y()));
-
+                           initial_pose_estimate.translation().y()),
+      &discrete_scan_buffer_);
+
+  // The last block of the coarse search can reach beyond the search window.
+  const int coarse_cell_size = options_.coarse_search_cell_size();
+  const int block_size = std::max(1, coarse_cell_size);
+  Eigen::Array2i min_offset = Eigen::Array2i::Constant(
+      std::numeric_limits<int>::max());
+  Eigen::Array2i max_offset = Eigen::Array2i::Constant(
+      std::numeric_limits<int>::min());
+  for (const SearchParameters::LinearBounds& bounds :
+       search_parameters.linear_bounds)
+  {
+    const Eigen::Array2i min(bounds.min_x, bounds.min_y);
+    const Eigen::Array2i num_blocks =
+        (Eigen::Array2i(bounds.max_x, bounds.max_y) - min + block_size) /
+        block_size;
+    min_offset = min_offset.min(min);
+    max_offset = max_offset.max(min + num_blocks * block_size - 1);
+  }
+  BuildScoringWindow(probability_grid, discrete_scans, min_offset, max_offset,
+                     coarse_cell_size, &scoring_window_);
 
-  //得到整个搜索空间里面的所有的候选解
+  //得到整个搜索空间里面的所有的候选解 或者粗匹配得到的最好的几个块里面的候选解
   std::vector<Candidate> candidates =
-      GenerateExhaustiveSearchCandidates(search_parameters);
-
-  //计算空间中所有的候选解的得分
-  ScoreCandidates(probability_grid, discrete_scans, search_parameters,
-                  &candidates);
+      coarse_cell_size > 1
+          ? GenerateCoarseSearchCandidates(search_parameters, scoring_window_)
+          : GenerateExhaustiveSearchCandidates(search_parameters);
 
-  //找到得到最大的候选解candidate
+  //计算候选解的得分 不可能超过当前最优解的候选解会被提前剪掉
   const Candidate& best_candidate =
-      *std::max_element(candidates.begin(), candidates.end());
+      candidates[ScoreCandidates(scoring_window_, true /* prune */,
+                                 &candidates)];
 
   //候选解的位姿即为优化过后的位姿
   *pose_estimate = transform::Rigid2d(
@@ -211,39 +504,107 @@ void RealTimeCorrelativeScanMatcher::ScoreCandidates(
     const SearchParameters& search_parameters,
     std::vector<Candidate>* const candidates) const
 {
-  //枚举所有的candidate
-  for (Candidate& candidate : *candidates)
+  if (candidates->empty())
   {
-    candidate.score = 0.f;
+    return;
+  }
+  Eigen::Array2i min_offset = Eigen::Array2i::Constant(
+      std::numeric_limits<int>::max());
+  Eigen::Array2i max_offset = Eigen::Array2i::Constant(
+      std::numeric_limits<int>::min());
+  for (const Candidate& candidate : *candidates)
+  {
+    const Eigen::Array2i offset(candidate.x_index_offset,
+                                candidate.y_index_offset);
+    min_offset = min_offset.min(offset);
+    max_offset = max_offset.max(offset);
+  }
+  ScoringWindow scoring_window;
+  BuildScoringWindow(probability_grid, discrete_scans, min_offset, max_offset,
+                     1 /* coarse_cell_size */, &scoring_window);
+  ScoreCandidates(scoring_window, false /* prune */, candidates);
+}
 
-    //每个candidate都需要枚举所有的激光点
-    for (const Eigen::Array2i& xy_index :
-         discrete_scans[candidate.scan_index])
+int RealTimeCorrelativeScanMatcher::ScoreCandidates(
+    const ScoringWindow& scoring_window, const bool prune,
+    std::vector<Candidate>* const candidates) const
+{
+  float best_score = -std::numeric_limits<float>::infinity();
+  int best_index = -1;
+  const auto score_candidate = [this, &scoring_window, prune, candidates,
+                                &best_score, &best_index](const int index) {
+    Candidate& candidate = (*candidates)[index];
+    const std::vector<int>& scan = scoring_window.scans[candidate.scan_index];
+    const int num_points = scoring_window.num_points[candidate.scan_index];
+    const int num_scan_points = scan.size();
+    const int offset = candidate.x_index_offset +
+                       candidate.y_index_offset * scoring_window.stride;
+    const uint16* const cells = scoring_window.cells.data();
+    const std::vector<int64>& max_remaining_steps =
+        scoring_window.max_remaining_steps[candidate.scan_index];
+
+    const double penalty = ComputePenalty(options_, candidate.x, candidate.y,
+                                          candidate.orientation);
+
+    int64 num_steps = 0;
+    for (int begin = 0; begin < num_scan_points; begin += kNumPointsPerBlock)
     {
-      //因为事先经过旋转，所以这里只需要相加就可以
-      const Eigen::Array2i proposed_xy_index(
-          xy_index.x() + candidate.x_index_offset,
-          xy_index.y() + candidate.y_index_offset);
-
-      //计算占用概率的累加和
-      const float probability =
-          probability_grid.GetProbability(proposed_xy_index);
-      candidate.score += probability;
+      if (prune)
+      {
+        int64 bound =
+            num_steps + max_remaining_steps[begin / kNumPointsPerBlock];
+        if (options_.approximate_pruning() && 4 * begin >= num_scan_points)
+        {
+          // Assume the remaining points are as good as the ones so far.
+          bound = std::min(bound, num_steps * num_scan_points / begin);
+        }
+        if (ComputeScore(bound, num_points, penalty) < best_score)
+        {
+          candidate.score = 0.f;
+          return;
+        }
+      }
+      const int end = std::min(begin + kNumPointsPerBlock, num_scan_points);
+      int block_steps = 0;
+      for (int i = begin; i != end; ++i)
+      {
+        block_steps += cells[scan[i] + offset];
+      }
+      num_steps += block_steps;
     }
-
-    //进行平均
-    candidate.score /=
-        static_cast<float>(discrete_scans[candidate.scan_index].size());
-
-    //施加惩罚 离初始位置越远 惩罚的越严重
-    candidate.score *=
-        std::exp(-common::Pow2(std::hypot(candidate.x, candidate.y) *
-                                   options_.translation_delta_cost_weight() +
-                               std::abs(candidate.orientation) *
-                                   options_.rotation_delta_cost_weight()));
-
+    candidate.score = ComputeScore(num_steps, num_points, penalty);
     CHECK_GT(candidate.score, 0.f);
+    if (candidate.score > best_score ||
+        (candidate.score == best_score && index < best_index))
+    {
+      best_score = candidate.score;
+      best_index = index;
+    }
+  };
+
+  // The candidate without any offset is usually close to the best one. Scoring
+  // it first gives a good bound to prune the others with.
+  // 先计算初始位姿的得分 作为剪枝的下界
+  const int first_index =
+      std::find_if(candidates->begin(), candidates->end(),
+                   [](const Candidate& candidate) {
+                     return candidate.x_index_offset == 0 &&
+                            candidate.y_index_offset == 0 &&
+                            candidate.orientation == 0.;
+                   }) -
+      candidates->begin();
+  if (first_index != static_cast<int>(candidates->size()))
+  {
+    score_candidate(first_index);
+  }
+  for (int index = 0; index != static_cast<int>(candidates->size()); ++index)
+  {
+    if (index != first_index)
+    {
+      score_candidate(index);
+    }
   }
+  return best_index;
 }
 
 }  // namespace scan_matching
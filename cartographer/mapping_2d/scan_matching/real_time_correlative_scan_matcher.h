@@ -47,6 +47,7 @@
 #include <vector>
 
 #include "eigen3/Eigen/Core"
+#include "../common/mutex.h"
 #include "../mapping_2d/probability_grid.h"
 #include "../mapping_2d/scan_matching/correlative_scan_matcher.h"
 #include "cartographer/mapping_2d/scan_matching/proto/real_time_correlative_scan_matcher_options.pb.h"
@@ -59,6 +60,42 @@ proto::RealTimeCorrelativeScanMatcherOptions
 CreateRealTimeCorrelativeScanMatcherOptions(
     common::LuaParameterDictionary* const parameter_dictionary);
 
+// The part of a probability grid which the candidates of a search can reach,
+// copied into one array, and the discrete scans as indices into it. Scoring a
+// candidate then only adds up integers, without bounds checks or lookups of
+// tiles and probabilities.
+// 把搜索能够访问到的地图区域拷贝成一个连续的数组 打分的时候只需要做整数加法
+struct ScoringWindow
+{
+  // Number of cells in x direction, i.e. the distance between rows.
+  int stride = 0;
+
+  // Probability of each cell as the number of steps of size
+  // (kMaxProbability - kMinProbability) / 32766 above kMinProbability.
+  // Unknown cells are 0.
+  std::vector<uint16> cells;
+
+  // For each scan, the indices in 'cells' of its points without offset.
+  // Points which no candidate can move into a known cell are left out. The
+  // points are interleaved, so that every prefix is spread over the scan.
+  std::vector<std::vector<int>> scans;
+
+  // For each scan, its number of points including the ones left out.
+  std::vector<int> num_points;
+
+  // For each cell, the largest of the cells any candidate can move it to.
+  std::vector<uint16> max_cells;
+
+  // For each cell, the largest of the square of cells of the coarse search
+  // starting at it. Only used if the coarse search is enabled.
+  std::vector<uint16> coarse_cells;
+
+  // For each scan and block of points in 'scans', the largest number of steps
+  // the points from this block on can add up to for any of the candidates.
+  // Scoring a candidate stops as soon as even this cannot beat the best one.
+  std::vector<std::vector<int64>> max_remaining_steps;
+};
+
 // An implementation of "Real-Time Correlative Scan Matching" by Olson.
 // 实现了Computing 2d Slices方法。
 // 即也是三层for循环进行枚举，不过最外的一层为角度的循环。
@@ -101,7 +138,28 @@ class RealTimeCorrelativeScanMatcher
   std::vector<Candidate> GenerateExhaustiveSearchCandidates(
       const SearchParameters& search_parameters) const;
 
+  // Scores blocks of candidates on the max-pooled 'scoring_window' and returns
+  // all candidates of the best blocks.
+  // 在降采样的地图上粗匹配 只返回最好的几个块里面的候选解
+  std::vector<Candidate> GenerateCoarseSearchCandidates(
+      const SearchParameters& search_parameters,
+      const ScoringWindow& scoring_window) const;
+
+  // Scores 'candidates' on 'scoring_window' and returns the index of the best
+  // one, the first one for equal scores. If 'prune' is true, scoring a
+  // candidate stops once it can no longer beat the best candidate so far, or
+  // with 'approximate_pruning' once it is unlikely to, and its score is left
+  // at 0.
+  int ScoreCandidates(const ScoringWindow& scoring_window, bool prune,
+                      std::vector<Candidate>* candidates) const;
+
   const proto::RealTimeCorrelativeScanMatcherOptions options_;
+
+  // Reused by every Match() so that the discrete scans and the scoring window
+  // are not allocated anew for every scan.
+  mutable common::Mutex mutex_;
+  mutable DiscreteScanBuffer discrete_scan_buffer_ GUARDED_BY(mutex_);
+  mutable ScoringWindow scoring_window_ GUARDED_BY(mutex_);
 };
 
 }  // namespace scan_matching
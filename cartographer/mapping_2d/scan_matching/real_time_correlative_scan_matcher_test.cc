@@ -67,6 +67,9 @@ class RealTimeCorrelativeScanMatcherTest : public ::testing::Test {
           "angular_search_window = 0.16, "
           "translation_delta_cost_weight = 0., "
           "rotation_delta_cost_weight = 0., "
+          "approximate_pruning = false, "
+          "coarse_search_cell_size = 1, "
+          "num_coarse_candidates_to_refine = 8, "
           "}");
       real_time_correlative_scan_matcher_ =
           common::make_unique<RealTimeCorrelativeScanMatcher>(
@@ -119,6 +122,41 @@ TEST_F(RealTimeCorrelativeScanMatcherTest,
   EXPECT_GT(0.7, candidates[0].score);
 }
 
+TEST_F(RealTimeCorrelativeScanMatcherTest, MatchWithPruning) {
+  transform::Rigid2d pose_estimate;
+  const double score = real_time_correlative_scan_matcher_->Match(
+      transform::Rigid2d::Translation({0.1, -0.05}), point_cloud_,
+      probability_grid_, &pose_estimate);
+  // Every point should align perfectly, as for the unpruned search.
+  EXPECT_NEAR(0.7, score, 1e-2);
+  EXPECT_NEAR(0., pose_estimate.translation().x(), 1e-9);
+  EXPECT_NEAR(0., pose_estimate.translation().y(), 1e-9);
+  EXPECT_NEAR(0., pose_estimate.rotation().angle(), 1e-9);
+}
+
+TEST_F(RealTimeCorrelativeScanMatcherTest, MatchWithCoarseSearch) {
+  auto parameter_dictionary = common::MakeDictionary(
+      "return {"
+      "linear_search_window = 0.6, "
+      "angular_search_window = 0.16, "
+      "translation_delta_cost_weight = 0., "
+      "rotation_delta_cost_weight = 0., "
+      "approximate_pruning = false, "
+      "coarse_search_cell_size = 4, "
+      "num_coarse_candidates_to_refine = 2, "
+      "}");
+  const RealTimeCorrelativeScanMatcher real_time_correlative_scan_matcher(
+      CreateRealTimeCorrelativeScanMatcherOptions(parameter_dictionary.get()));
+  transform::Rigid2d pose_estimate;
+  const double score = real_time_correlative_scan_matcher.Match(
+      transform::Rigid2d::Translation({0.1, -0.05}), point_cloud_,
+      probability_grid_, &pose_estimate);
+  EXPECT_NEAR(0.7, score, 1e-2);
+  EXPECT_NEAR(0., pose_estimate.translation().x(), 1e-9);
+  EXPECT_NEAR(0., pose_estimate.translation().y(), 1e-9);
+  EXPECT_NEAR(0., pose_estimate.rotation().angle(), 1e-9);
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_2d
@@ -26,6 +26,7 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "eigen3/Eigen/Eigenvalues"
 #include "../common/make_unique.h"
@@ -179,21 +180,25 @@ void SparsePoseGraph::ComputeConstraintsForOldScans(
   CHECK_GT(point_cloud_poses_.size(), 0);
   CHECK_LT(point_cloud_poses_.size(), std::numeric_limits<int>::max());
 
+  // All old scans are matched against the same submap, so they are handed
+  // to the constraint builder together to be matched in batches.
   const int num_nodes = point_cloud_poses_.size();
+  std::vector<int> scan_indices;
+  std::vector<const sensor::PointCloud2D*> point_clouds;
+  std::vector<transform::Rigid2d> relative_poses;
   for (int scan_index = 0; scan_index < num_nodes; ++scan_index)
   {
     if (submap_states_[submap_index].scan_indices.count(scan_index) == 0)
     {
-      const transform::Rigid2d relative_pose =
-          submap_transforms_[submap_index].inverse() *
-          point_cloud_poses_[scan_index];
-
-      constraint_builder_.MaybeAddConstraint(
-          submap_index, submap, scan_index,
-          &trajectory_nodes_[scan_index].constant_data->laser_fan.point_cloud,
-          relative_pose);
+      scan_indices.push_back(scan_index);
+      point_clouds.push_back(
+          &trajectory_nodes_[scan_index].constant_data->laser_fan.point_cloud);
+      relative_poses.push_back(submap_transforms_[submap_index].inverse() *
+                               point_cloud_poses_[scan_index]);
     }
   }
+  constraint_builder_.MaybeAddConstraints(submap_index, submap, scan_indices,
+                                          point_clouds, relative_poses);
 }
 
 /**
@@ -16,6 +16,7 @@
 
 #include "../mapping_2d/sparse_pose_graph/constraint_builder.h"
 
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <iomanip>
@@ -24,6 +25,7 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "eigen3/Eigen/Eigenvalues"
 #include "../common/make_unique.h"
@@ -40,6 +42,14 @@ namespace cartographer {
 namespace mapping_2d {
 namespace sparse_pose_graph {
 
+namespace {
+
+// Maximum number of scans matched in one work item by MaybeAddConstraints().
+// Larger batches save more overhead, smaller ones keep more threads busy.
+constexpr size_t kMaxBatchSize = 32;
+
+}  // namespace
+
 transform::Rigid2d ComputeSubmapPose(const mapping::Submap& submap)
 {
   return transform::Project2D(submap.local_pose());
@@ -50,6 +60,9 @@ ConstraintBuilder::ConstraintBuilder(
     common::ThreadPool* const thread_pool)
     : options_(options),
       thread_pool_(thread_pool),
+      precomputed_grids_(
+          static_cast<size_t>(options.precomputation_grid_cache_memory_in_mb())
+          << 20),
       sampler_(options.sampling_ratio()),
       adaptive_voxel_filter_(options.adaptive_voxel_filter_options()),
       ceres_scan_matcher_(options.ceres_scan_matcher_options()) {}
@@ -99,6 +112,48 @@ void ConstraintBuilder::MaybeAddConstraint(
   }
 }
 
+//同时计算多帧激光和一个submap的约束 每一批激光在一个线程中匹配
+void ConstraintBuilder::MaybeAddConstraints(
+    const int submap_index, const mapping::Submap* const submap,
+    const std::vector<int>& scan_indices,
+    const std::vector<const sensor::PointCloud2D*>& point_clouds,
+    const std::vector<transform::Rigid2d>& initial_relative_poses)
+{
+  CHECK_EQ(scan_indices.size(), point_clouds.size());
+  CHECK_EQ(scan_indices.size(), initial_relative_poses.size());
+  common::MutexLocker locker(&mutex_);
+  std::vector<ScanToMatch> scans;
+  for (size_t i = 0; i != scan_indices.size(); ++i)
+  {
+    if (initial_relative_poses[i].translation().norm() >
+            options_.max_constraint_distance() ||
+        !sampler_.Pulse())
+    {
+      continue;
+    }
+    CHECK_LE(scan_indices[i], current_computation_);
+    constraints_.emplace_back();
+    scans.push_back(ScanToMatch{scan_indices[i], point_clouds[i],
+                                initial_relative_poses[i],
+                                &constraints_.back()});
+  }
+
+  const int current_computation = current_computation_;
+  for (size_t begin = 0; begin < scans.size(); begin += kMaxBatchSize)
+  {
+    const std::vector<ScanToMatch> batch(
+        scans.begin() + begin,
+        scans.begin() + std::min(begin + kMaxBatchSize, scans.size()));
+    ++pending_computations_[current_computation_];
+    ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
+        submap_index, submap->finished_probability_grid,
+        [=]() EXCLUDES(mutex_) {
+          ComputeConstraints(submap_index, submap, batch);
+          FinishComputation(current_computation);
+        });
+  }
+}
+
 //计算激光和scan-match的约束，被spa调用
 void ConstraintBuilder::MaybeAddGlobalConstraint(
     const int submap_index, const mapping::Submap* const submap,
@@ -155,8 +210,7 @@ void ConstraintBuilder::ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
     const int submap_index, const ProbabilityGrid* const submap,
     const std::function<void()> work_item)
 {
-  if (submap_scan_matchers_[submap_index].fast_correlative_scan_matcher !=
-      nullptr)
+  if (submap_scan_matchers_.count(submap_index) != 0)
   {
     thread_pool_->Schedule(work_item);
   }
@@ -175,12 +229,9 @@ void ConstraintBuilder::ScheduleSubmapScanMatcherConstructionAndQueueWorkItem(
 void ConstraintBuilder::ConstructSubmapScanMatcher(
     const int submap_index, const ProbabilityGrid* const submap)
 {
-  auto submap_scan_matcher =
-      common::make_unique<scan_matching::FastCorrelativeScanMatcher>(
-          *submap, options_.fast_correlative_scan_matcher_options());
+  GetPrecomputedGrids(submap_index, *submap);
   common::MutexLocker locker(&mutex_);
-  submap_scan_matchers_[submap_index] = {submap,
-                                         std::move(submap_scan_matcher)};
+  submap_scan_matchers_[submap_index] = {submap};
   for (const std::function<void()>& work_item :
        submap_queued_work_items_[submap_index])
   {
@@ -189,13 +240,81 @@ void ConstraintBuilder::ConstructSubmapScanMatcher(
   submap_queued_work_items_.erase(submap_index);
 }
 
+std::shared_ptr<const scan_matching::PrecomputedGrids>
+ConstraintBuilder::GetPrecomputedGrids(const int submap_index,
+                                       const ProbabilityGrid& submap)
+{
+  const auto& fast_correlative_scan_matcher_options =
+      options_.fast_correlative_scan_matcher_options();
+  if (options_.precomputation_grid_directory().empty())
+  {
+    return precomputed_grids_.Get(submap,
+                                  fast_correlative_scan_matcher_options);
+  }
+  //优先从文件中读取 读取失败则重新计算并写入文件
+  const string filename = options_.precomputation_grid_directory() +
+                          "/submap" + std::to_string(submap_index) +
+                          ".precomputation_grids";
+  return precomputed_grids_.Get(
+      submap, fast_correlative_scan_matcher_options,
+      [&filename, &submap, &fast_correlative_scan_matcher_options]() {
+        std::unique_ptr<scan_matching::PrecomputationGridStack> stack =
+            scan_matching::ReadPrecomputationGridStack(
+                filename, submap, fast_correlative_scan_matcher_options);
+        if (stack == nullptr)
+        {
+          stack = common::make_unique<scan_matching::PrecomputationGridStack>(
+              submap, fast_correlative_scan_matcher_options);
+          scan_matching::WritePrecomputationGridStack(filename, *stack, submap);
+        }
+        return stack;
+      });
+}
+
 const ConstraintBuilder::SubmapScanMatcher*
 ConstraintBuilder::GetSubmapScanMatcher(const int submap_index) {
   common::MutexLocker locker(&mutex_);
-  const SubmapScanMatcher* submap_scan_matcher =
-      &submap_scan_matchers_[submap_index];
-  CHECK(submap_scan_matcher->fast_correlative_scan_matcher != nullptr);
-  return submap_scan_matcher;
+  const auto it = submap_scan_matchers_.find(submap_index);
+  CHECK(it != submap_scan_matchers_.end());
+  return &it->second;
+}
+
+std::unique_ptr<scan_matching::FastCorrelativeScanMatcher>
+ConstraintBuilder::CreateFastCorrelativeScanMatcher(
+    const SubmapScanMatcher& submap_scan_matcher,
+    const std::shared_ptr<const scan_matching::PrecomputedGrids>&
+        precomputed_grids)
+{
+  // Shares the ownership of all 'precomputed_grids', so they are not evicted
+  // from the cache while the matcher exists.
+  return common::make_unique<scan_matching::FastCorrelativeScanMatcher>(
+      *submap_scan_matcher.probability_grid,
+      std::shared_ptr<const scan_matching::PrecomputationGridStack>(
+          precomputed_grids,
+          precomputed_grids->precomputation_grid_stack.get()),
+      options_.fast_correlative_scan_matcher_options());
+}
+
+bool ConstraintBuilder::MatchLocally(
+    const scan_matching::FastCorrelativeScanMatcher&
+        fast_correlative_scan_matcher,
+    const transform::Rigid2d& initial_pose,
+    const sensor::PointCloud2D& point_cloud,
+    sensor::PointCloud2D* const filtered_point_cloud, float* const score,
+    transform::Rigid2d* const pose_estimate)
+{
+  *filtered_point_cloud = adaptive_voxel_filter_.Filter(point_cloud);
+  if (!fast_correlative_scan_matcher.Match(initial_pose, *filtered_point_cloud,
+                                           options_.min_score(), score,
+                                           pose_estimate))
+  {
+    return false;
+  }
+  // We've reported a successful local match.
+  CHECK_GT(*score, options_.min_score());
+  common::MutexLocker locker(&mutex_);
+  score_histogram_.Add(*score);
+  return true;
 }
 
 //真正的计算约束的函数　这个函数被MaybeAddGlobalConstraint()和MaybeAddConstraint()调用
@@ -213,22 +332,29 @@ void ConstraintBuilder::ComputeConstraint(
 
   const SubmapScanMatcher* const submap_scan_matcher =
       GetSubmapScanMatcher(submap_index);
-
-  const sensor::PointCloud2D filtered_point_cloud =
-      adaptive_voxel_filter_.Filter(*point_cloud);
+  // If the grids were evicted in the meantime, they are recomputed or read
+  // again here.
+  const std::shared_ptr<const scan_matching::PrecomputedGrids>
+      precomputed_grids = GetPrecomputedGrids(
+          submap_index, *submap_scan_matcher->probability_grid);
+  const std::unique_ptr<scan_matching::FastCorrelativeScanMatcher>
+      fast_correlative_scan_matcher = CreateFastCorrelativeScanMatcher(
+          *submap_scan_matcher, precomputed_grids);
 
   // The 'constraint_transform' (i <- j) is computed from:
   // - a 'filtered_point_cloud' in j,
   // - the initial guess 'initial_pose' for (map <- j),
   // - the result 'pose_estimate' of Match() (map <- j).
   // - the ComputeSubmapPose() (map <- i)
+  sensor::PointCloud2D filtered_point_cloud;
   float score = 0.;
   transform::Rigid2d pose_estimate = transform::Rigid2d::Identity();
 
   //在整个图上进行搜索　程序自行确实搜索的起始位姿
   if (match_full_submap)
   {
-    if (submap_scan_matcher->fast_correlative_scan_matcher->MatchFullSubmap(
+    filtered_point_cloud = adaptive_voxel_filter_.Filter(*point_cloud);
+    if (fast_correlative_scan_matcher->MatchFullSubmap(
             filtered_point_cloud, options_.global_localization_min_score(),
             &score, &pose_estimate))
     {
@@ -241,20 +367,11 @@ void ConstraintBuilder::ComputeConstraint(
   }
 
   //指定初始位姿
-  else
+  else if (!MatchLocally(*fast_correlative_scan_matcher, initial_pose,
+                         *point_cloud, &filtered_point_cloud, &score,
+                         &pose_estimate))
   {
-    if (!submap_scan_matcher->fast_correlative_scan_matcher->Match(
-            initial_pose, filtered_point_cloud, options_.min_score(), &score,
-            &pose_estimate))
-    {
-      return;
-    }
-    // We've reported a successful local match.
-    CHECK_GT(score, options_.min_score());
-    {
-      common::MutexLocker locker(&mutex_);
-      score_histogram_.Add(score);
-    }
+    return;
   }
 
   // Use the CSM estimate as both the initial and previous pose. This has the
@@ -264,10 +381,85 @@ void ConstraintBuilder::ComputeConstraint(
   ceres::Solver::Summary unused_summary;
   kalman_filter::Pose2DCovariance covariance;
   ceres_scan_matcher_.Match(pose_estimate, pose_estimate, filtered_point_cloud,
-                            *submap_scan_matcher->probability_grid,
+                            precomputed_grids->float_probability_grid,
                             &pose_estimate, &covariance, &unused_summary);
-  // 'covariance' is unchanged as (submap <- map) is a translation.
+  AddConstraint(submap_index, submap, scan_index, initial_pose,
+                filtered_point_cloud.size(), score, pose_estimate, covariance,
+                constraint);
+}
+
+//对一批激光先分别用CSM匹配 再把匹配成功的一起优化
+void ConstraintBuilder::ComputeConstraints(
+    const int submap_index, const mapping::Submap* const submap,
+    const std::vector<ScanToMatch>& scans)
+{
+  const SubmapScanMatcher* const submap_scan_matcher =
+      GetSubmapScanMatcher(submap_index);
+  // If the grids were evicted in the meantime, they are recomputed or read
+  // again here.
+  const std::shared_ptr<const scan_matching::PrecomputedGrids>
+      precomputed_grids = GetPrecomputedGrids(
+          submap_index, *submap_scan_matcher->probability_grid);
+  const std::unique_ptr<scan_matching::FastCorrelativeScanMatcher>
+      fast_correlative_scan_matcher = CreateFastCorrelativeScanMatcher(
+          *submap_scan_matcher, precomputed_grids);
+
+  std::vector<const ScanToMatch*> matched_scans;
+  std::vector<transform::Rigid2d> initial_poses;
+  std::vector<float> scores;
+  std::vector<transform::Rigid2d> csm_pose_estimates;
+  std::vector<sensor::PointCloud2D> filtered_point_clouds;
+  for (const ScanToMatch& scan : scans)
+  {
+    const transform::Rigid2d initial_pose =
+        ComputeSubmapPose(*submap) * scan.initial_relative_pose;
+    sensor::PointCloud2D filtered_point_cloud;
+    float score = 0.;
+    transform::Rigid2d pose_estimate = transform::Rigid2d::Identity();
+    if (!MatchLocally(*fast_correlative_scan_matcher, initial_pose,
+                      *scan.point_cloud, &filtered_point_cloud, &score,
+                      &pose_estimate))
+    {
+      continue;
+    }
+    matched_scans.push_back(&scan);
+    initial_poses.push_back(initial_pose);
+    scores.push_back(score);
+    csm_pose_estimates.push_back(pose_estimate);
+    filtered_point_clouds.push_back(std::move(filtered_point_cloud));
+  }
 
+  // As in ComputeConstraint(), the CSM estimates are used as both the initial
+  // and previous poses.
+  std::vector<const sensor::PointCloud2D*> point_clouds;
+  for (const sensor::PointCloud2D& filtered_point_cloud :
+       filtered_point_clouds)
+  {
+    point_clouds.push_back(&filtered_point_cloud);
+  }
+  std::vector<transform::Rigid2d> pose_estimates;
+  std::vector<kalman_filter::Pose2DCovariance> covariances;
+  ceres_scan_matcher_.MatchBatch(csm_pose_estimates, point_clouds,
+                                 precomputed_grids->float_probability_grid,
+                                 &pose_estimates, &covariances);
+  for (size_t i = 0; i != matched_scans.size(); ++i)
+  {
+    AddConstraint(submap_index, submap, matched_scans[i]->scan_index,
+                  initial_poses[i], filtered_point_clouds[i].size(), scores[i],
+                  pose_estimates[i], covariances[i],
+                  matched_scans[i]->constraint);
+  }
+}
+
+void ConstraintBuilder::AddConstraint(
+    const int submap_index, const mapping::Submap* const submap,
+    const int scan_index, const transform::Rigid2d& initial_pose,
+    const int num_points, const float score,
+    const transform::Rigid2d& pose_estimate,
+    const kalman_filter::Pose2DCovariance& covariance,
+    std::unique_ptr<Constraint>* const constraint)
+{
+  // 'covariance' is unchanged as (submap <- map) is a translation.
   const transform::Rigid2d constraint_transform =
       ComputeSubmapPose(*submap).inverse() * pose_estimate;
 
@@ -286,7 +478,7 @@ void ConstraintBuilder::ComputeConstraint(
         initial_pose.inverse() * pose_estimate;
     std::ostringstream info;
     info << "Scan index " << scan_index << " with "
-         << filtered_point_cloud.size() << " points on submap " << submap_index
+         << num_points << " points on submap " << submap_index
          << " differs by translation " << std::fixed << std::setprecision(2)
          << difference.translation().norm() << " rotation "
          << std::setprecision(3) << std::abs(difference.normalized_angle())
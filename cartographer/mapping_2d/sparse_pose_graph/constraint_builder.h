@@ -21,6 +21,7 @@
 #include <deque>
 #include <functional>
 #include <limits>
+#include <memory>
 #include <vector>
 
 #include "eigen3/Eigen/Core"
@@ -30,9 +31,12 @@
 #include "../common/math.h"
 #include "../common/mutex.h"
 #include "../common/thread_pool.h"
+#include "../kalman_filter/pose_tracker.h"
 #include "../mapping/trajectory_connectivity.h"
 #include "../mapping_2d/scan_matching/ceres_scan_matcher.h"
 #include "../mapping_2d/scan_matching/fast_correlative_scan_matcher.h"
+#include "../mapping_2d/scan_matching/precomputation_grid_stack_cache.h"
+#include "../mapping_2d/scan_matching/precomputation_grid_stack_io.h"
 #include "../mapping_2d/sparse_pose_graph/optimization_problem.h"
 #include "../mapping_2d/submaps.h"
 #include "../mapping_3d/scan_matching/ceres_scan_matcher.h"
@@ -88,6 +92,17 @@ class ConstraintBuilder
                           const sensor::PointCloud2D* point_cloud,
                           const transform::Rigid2d& initial_relative_pose);
 
+  // Same as calling MaybeAddConstraint() for each of 'scan_indices' with the
+  // corresponding entries of 'point_clouds' and 'initial_relative_poses', e.g.
+  // for all old scans when 'submap' is finished. The scans are matched in
+  // batches, and the estimates of each batch are refined together by
+  // CeresScanMatcher::MatchBatch() instead of one Ceres problem per scan.
+  void MaybeAddConstraints(
+      int submap_index, const mapping::Submap* submap,
+      const std::vector<int>& scan_indices,
+      const std::vector<const sensor::PointCloud2D*>& point_clouds,
+      const std::vector<transform::Rigid2d>& initial_relative_poses);
+
   // Schedules exploring a new constraint between 'submap' identified by
   // 'submap_index' and the 'point_cloud' for 'scan_index'. This performs
   // full-submap matching.
@@ -116,11 +131,12 @@ class ConstraintBuilder
   int GetNumFinishedScans();
 
  private:
+  // The scan matchers themselves are cheap to build once the grids computed
+  // from the submap are in 'precomputed_grids_', so only the submap is
+  // remembered here.
   struct SubmapScanMatcher
   {
     const ProbabilityGrid* probability_grid;
-    std::unique_ptr<scan_matching::FastCorrelativeScanMatcher>
-        fast_correlative_scan_matcher;
   };
 
   // Either schedules the 'work_item', or if needed, schedules the scan matcher
@@ -129,15 +145,40 @@ class ConstraintBuilder
       int submap_index, const ProbabilityGrid* submap,
       std::function<void()> work_item) REQUIRES(mutex_);
 
-  // Constructs the scan matcher for a 'submap', then schedules its work items.
+  // Computes the precomputation grids for a 'submap', or reads them from the
+  // 'precomputation_grid_directory' if set, then schedules its work items.
   void ConstructSubmapScanMatcher(int submap_index,
                                   const ProbabilityGrid* submap)
       EXCLUDES(mutex_);
 
+  // Returns the precomputed grids of 'submap' from the cache. If they are not
+  // cached, the precomputation grids are read from the
+  // 'precomputation_grid_directory' if set and possible, or computed otherwise.
+  std::shared_ptr<const scan_matching::PrecomputedGrids> GetPrecomputedGrids(
+      int submap_index, const ProbabilityGrid& submap) EXCLUDES(mutex_);
+
   // Returns the scan matcher for a submap, which has to exist.
   const SubmapScanMatcher* GetSubmapScanMatcher(int submap_index)
       EXCLUDES(mutex_);
 
+  // Creates the FastCorrelativeScanMatcher of a submap for matching scans
+  // against it. The matcher keeps the 'precomputed_grids' in use.
+  std::unique_ptr<scan_matching::FastCorrelativeScanMatcher>
+  CreateFastCorrelativeScanMatcher(
+      const SubmapScanMatcher& submap_scan_matcher,
+      const std::shared_ptr<const scan_matching::PrecomputedGrids>&
+          precomputed_grids);
+
+  // Filters 'point_cloud' into 'filtered_point_cloud' and matches it around
+  // 'initial_pose'. Returns true and adds the 'score' to the histogram if the
+  // match is better than 'min_score'.
+  bool MatchLocally(const scan_matching::FastCorrelativeScanMatcher&
+                        fast_correlative_scan_matcher,
+                    const transform::Rigid2d& initial_pose,
+                    const sensor::PointCloud2D& point_cloud,
+                    sensor::PointCloud2D* filtered_point_cloud, float* score,
+                    transform::Rigid2d* pose_estimate) EXCLUDES(mutex_);
+
   // Runs in a background thread and does computations for an additional
   // constraint, assuming 'submap' and 'point_cloud' do not change anymore.
   // If 'match_full_submap' is true, and global localization succeeds, will
@@ -153,6 +194,31 @@ class ConstraintBuilder
       const transform::Rigid2d& initial_relative_pose,
       std::unique_ptr<Constraint>* constraint) EXCLUDES(mutex_);
 
+  // A scan of a batch given to ComputeConstraints().
+  struct ScanToMatch
+  {
+    int scan_index;
+    const sensor::PointCloud2D* point_cloud;
+    transform::Rigid2d initial_relative_pose;
+    std::unique_ptr<Constraint>* constraint;
+  };
+
+  // Like ComputeConstraint() without 'match_full_submap' for all 'scans'
+  // against the same 'submap'. The FastCorrelativeScanMatcher is built once
+  // and the successful matches are refined in one batch.
+  void ComputeConstraints(int submap_index, const mapping::Submap* submap,
+                          const std::vector<ScanToMatch>& scans)
+      EXCLUDES(mutex_);
+
+  // Creates the Constraint in 'constraint' from the refined 'pose_estimate'
+  // (map <- j) and its 'covariance', and logs the match if requested.
+  void AddConstraint(int submap_index, const mapping::Submap* submap,
+                     int scan_index, const transform::Rigid2d& initial_pose,
+                     int num_points, float score,
+                     const transform::Rigid2d& pose_estimate,
+                     const kalman_filter::Pose2DCovariance& covariance,
+                     std::unique_ptr<Constraint>* constraint);
+
   // Decrements the 'pending_computations_' count. If all computations are done,
   // runs the 'when_done_' callback and resets the state.
   void FinishComputation(int computation_index) EXCLUDES(mutex_);
@@ -178,7 +244,8 @@ class ConstraintBuilder
   // keep pointers valid when adding more entries.
   std::deque<std::unique_ptr<Constraint>> constraints_ GUARDED_BY(mutex_);
 
-  // Map of already constructed scan matchers by 'submap_index'.
+  // Map of submaps whose precomputation grids were computed by
+  // 'submap_index'.
   std::map<int, SubmapScanMatcher> submap_scan_matchers_ GUARDED_BY(mutex_);
 
   // Map by 'submap_index' of scan matchers under construction, and the work
@@ -186,6 +253,10 @@ class ConstraintBuilder
   std::map<int, std::vector<std::function<void()>>> submap_queued_work_items_
       GUARDED_BY(mutex_);
 
+  // Precomputation grids and float copies of the finished submaps, shared by
+  // all scan matchers and bounded in memory.
+  scan_matching::PrecomputationGridStackCache precomputed_grids_;
+
   common::FixedRatioSampler sampler_;
   const sensor::AdaptiveVoxelFilter adaptive_voxel_filter_;
   scan_matching::CeresScanMatcher ceres_scan_matcher_;
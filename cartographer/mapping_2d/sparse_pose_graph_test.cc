@@ -80,6 +80,8 @@ class SparsePoseGraphTest : public ::testing::Test {
               global_localization_min_score = 0.6,
               lower_covariance_eigenvalue_bound = 1e-6,
               log_matches = true,
+              precomputation_grid_cache_memory_in_mb = 64,
+              precomputation_grid_directory = "",
               fast_correlative_scan_matcher = {
                 linear_search_window = 3.,
                 angular_search_window = 0.1,
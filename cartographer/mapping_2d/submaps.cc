@@ -93,7 +93,9 @@ ProbabilityGrid ComputeCroppedProbabilityGrid(
       resolution * Eigen::Vector2d(offset.y(), offset.x());
 
   //生成新的覆盖栅格地图
-  ProbabilityGrid cropped_grid(MapLimits(resolution, max, limits));
+  //新地图的版本号接着原来的地图 使得所有的栅格都比客户端已有的版本新
+  ProbabilityGrid cropped_grid(MapLimits(resolution, max, limits),
+                               probability_grid.version());
 
   //对新的覆盖栅格地图进行赋值
   cropped_grid.StartUpdate();
@@ -201,6 +203,16 @@ void Submaps::SubmapToProto(
                                Get(index)->probability_grid, response);
 }
 
+void Submaps::SubmapDeltaToProto(
+    const int index, const int grid_version,
+    const std::vector<mapping::TrajectoryNode>&, const transform::Rigid3d&,
+    mapping::proto::SubmapQuery::Response* const response)
+{
+  AddProbabilityGridToResponse(Get(index)->local_pose(),
+                               Get(index)->probability_grid, grid_version,
+                               response);
+}
+
 /**
  * @brief Submaps::FinishSubmap
  * 把下标为Index的submap设置为finish状态。
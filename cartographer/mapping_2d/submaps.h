@@ -82,6 +82,13 @@ class Submaps : public mapping::Submaps
   // Inserts 'laser_fan' into the Submap collection.
   void InsertLaserFan(const sensor::LaserFan& laser_fan);
 
+ protected:
+  void SubmapDeltaToProto(
+      int index, int grid_version,
+      const std::vector<mapping::TrajectoryNode>& trajectory_nodes,
+      const transform::Rigid3d& global_submap_pose,
+      mapping::proto::SubmapQuery::Response* response) override;
+
  private:
   void FinishSubmap(int index);
   void AddSubmap(const Eigen::Vector2f& origin);
@@ -66,6 +66,62 @@ TEST(SubmapsTest, TheRightNumberOfScansAreInserted) {
   }
 }
 
+TEST(SubmapsTest, SubmapQueryOnlySendsChangesSinceGridVersion) {
+  auto parameter_dictionary = common::MakeDictionary(
+      "return {"
+      "resolution = 0.05, "
+      "half_length = 10., "
+      "num_laser_fans = 10, "
+      "output_debug_images = false, "
+      "laser_fan_inserter = {"
+      "insert_free_space = true, "
+      "hit_probability = 0.53, "
+      "miss_probability = 0.495, "
+      "},"
+      "}");
+  Submaps submaps{CreateSubmapsOptions(parameter_dictionary.get())};
+  for (int i = 0; i != 3; ++i) {
+    submaps.InsertLaserFan(
+        {Eigen::Vector2f::Zero(), {Eigen::Vector2f(2.f, 1.f)}, {}});
+  }
+
+  mapping::proto::SubmapQuery::Request request;
+  request.set_submap_id(0);
+  mapping::proto::SubmapQuery::Response full_response;
+  submaps.SubmapQueryToProto(request, {}, transform::Rigid3d::Identity(),
+                             &full_response);
+  EXPECT_FALSE(full_response.has_error_message());
+  EXPECT_FALSE(full_response.is_delta());
+  EXPECT_EQ(0, full_response.submap_id());
+  // The submap version counts the inserted laser fans, as in 'SubmapList'.
+  EXPECT_EQ(3, full_response.submap_version());
+  EXPECT_TRUE(full_response.has_grid_version());
+
+  request.set_grid_version(full_response.grid_version());
+  mapping::proto::SubmapQuery::Response unchanged_response;
+  submaps.SubmapQueryToProto(request, {}, transform::Rigid3d::Identity(),
+                             &unchanged_response);
+  EXPECT_TRUE(unchanged_response.is_delta());
+  EXPECT_EQ(0, unchanged_response.changed_regions_size());
+  EXPECT_EQ(3, unchanged_response.submap_version());
+
+  submaps.InsertLaserFan(
+      {Eigen::Vector2f::Zero(), {Eigen::Vector2f(-1.f, 3.f)}, {}});
+  mapping::proto::SubmapQuery::Response delta_response;
+  submaps.SubmapQueryToProto(request, {}, transform::Rigid3d::Identity(),
+                             &delta_response);
+  EXPECT_TRUE(delta_response.is_delta());
+  EXPECT_LT(0, delta_response.changed_regions_size());
+  EXPECT_EQ(4, delta_response.submap_version());
+  EXPECT_LT(full_response.grid_version(), delta_response.grid_version());
+
+  request.set_submap_id(submaps.size());
+  mapping::proto::SubmapQuery::Response error_response;
+  submaps.SubmapQueryToProto(request, {}, transform::Rigid3d::Identity(),
+                             &error_response);
+  EXPECT_TRUE(error_response.has_error_message());
+}
+
 }  // namespace
 }  // namespace mapping_2d
 }  // namespace cartographer
@@ -17,8 +17,14 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_HYBRID_GRID_H_
 #define CARTOGRAPHER_MAPPING_3D_HYBRID_GRID_H_
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -48,29 +54,209 @@ inline Eigen::Array3i To3DIndex(const int index, const int bits) {
                         (index >> bits) >> bits);
 }
 
+// Cell layout policy storing cells x-fastest, then y, then z.
+struct LinearLayout {
+  static int ToFlatIndex(const Eigen::Array3i& index, const int bits) {
+    return mapping_3d::ToFlatIndex(index, bits);
+  }
+
+  static Eigen::Array3i To3DIndex(const int index, const int bits) {
+    return mapping_3d::To3DIndex(index, bits);
+  }
+};
+
+// Cell layout policy storing cells in Morton (Z-curve) order, i.e. the bits
+// of the x, y and z coordinates are interleaved. Cells which are close to
+// each other in all three dimensions, e.g. the neighborhoods used for
+// interpolation, are also close to each other in memory.
+struct MortonLayout {
+  static int ToFlatIndex(const Eigen::Array3i& index, const int bits) {
+    DCHECK((index >= 0).all() && (index < (1 << bits)).all()) << index;
+    return SpreadBits(index.x()) | (SpreadBits(index.y()) << 1) |
+           (SpreadBits(index.z()) << 2);
+  }
+
+  static Eigen::Array3i To3DIndex(const int index, const int bits) {
+    DCHECK_LT(index, 1 << (3 * bits));
+    return Eigen::Array3i(CompactBits(index), CompactBits(index >> 1),
+                          CompactBits(index >> 2));
+  }
+
+ private:
+  // Moves bit i of the 10-bit 'value' to bit 3 * i.
+  static int SpreadBits(int value) {
+    value = (value | (value << 16)) & 0x030000ff;
+    value = (value | (value << 8)) & 0x0300f00f;
+    value = (value | (value << 4)) & 0x030c30c3;
+    value = (value | (value << 2)) & 0x09249249;
+    return value;
+  }
+
+  // Inverse of SpreadBits(), ignoring all bits not at multiples of 3.
+  static int CompactBits(int value) {
+    value &= 0x09249249;
+    value = (value | (value >> 2)) & 0x030c30c3;
+    value = (value | (value >> 4)) & 0x0300f00f;
+    value = (value | (value >> 8)) & 0x030000ff;
+    value = (value | (value >> 16)) & 0x000003ff;
+    return value;
+  }
+};
+
+// A cell value which may be read by other threads while one thread writes it.
+// Loads and stores are relaxed atomic operations, so readers see either the
+// old or the new value. For the small arithmetic types stored in grids they
+// compile to plain loads and stores.
+template <typename T>
+class RelaxedAtomic {
+ public:
+  RelaxedAtomic() : value_(T()) {}
+
+  RelaxedAtomic(const RelaxedAtomic&) = delete;
+
+  RelaxedAtomic& operator=(const T value) {
+    value_.store(value, std::memory_order_relaxed);
+    return *this;
+  }
+
+  operator T() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<T> value_;
+};
+
+// The type in which grids store values of type 'ValueType'. Arithmetic values
+// are stored as RelaxedAtomic so that cells can be read while they are being
+// written. This makes reads of single cells atomic, there is no consistency
+// across cells. Other values, e.g. std::vector, must not be read concurrently
+// with writes to the same cell.
+template <typename ValueType>
+using CellType =
+    typename std::conditional<std::is_arithmetic<ValueType>::value,
+                              RelaxedAtomic<ValueType>, ValueType>::type;
+
 // A function to compare value to the default value. (Allows specializations).
 template <typename TValueType>
 bool IsDefaultValue(const TValueType& v) {
   return v == TValueType();
 }
 
+// Specialization to compare a cell stored as RelaxedAtomic.
+template <typename T>
+bool IsDefaultValue(const RelaxedAtomic<T>& v) {
+  return static_cast<T>(v) == T();
+}
+
 // Specialization to compare a std::vector to the default value.
 template <typename TElementType>
 bool IsDefaultValue(const std::vector<TElementType>& v) {
   return v.empty();
 }
 
+// Allocates objects of type 'T' in chunks. Objects are never freed
+// individually, all of them are destroyed together with the allocator. This
+// avoids one heap allocation per object and keeps objects allocated around the
+// same time close together in memory. The first chunk holds about 4 KiB and
+// each further chunk twice as much up to about 64 KiB, so that allocators which
+// only ever hold a few objects, e.g. in short-lived grids, stay small.
+template <typename T>
+class ChunkAllocator {
+ public:
+  ChunkAllocator() : capacity_(0), num_objects_in_last_chunk_(0) {}
+
+  ~ChunkAllocator() {
+    for (size_t i = 0; i != chunks_.size(); ++i) {
+      const int num_objects = i + 1 == chunks_.size()
+                                  ? num_objects_in_last_chunk_
+                                  : chunks_[i].size;
+      for (int j = 0; j != num_objects; ++j) {
+        reinterpret_cast<T*>(&chunks_[i].objects[j])->~T();
+      }
+    }
+  }
+
+  ChunkAllocator(const ChunkAllocator&) = delete;
+  ChunkAllocator& operator=(const ChunkAllocator&) = delete;
+
+  // Returns a new object constructed from 'args' which lives as long as this
+  // allocator.
+  template <typename... Args>
+  T* New(Args&&... args) {
+    if (chunks_.empty() || num_objects_in_last_chunk_ == chunks_.back().size) {
+      const int size =
+          chunks_.empty()
+              ? kMinObjectsPerChunk
+              : std::min(2 * chunks_.back().size, kMaxObjectsPerChunk);
+      // The storage is default-initialized, i.e. not zeroed, since every
+      // object is constructed in place anyway.
+      chunks_.push_back(Chunk{std::unique_ptr<Storage[]>(new Storage[size]),
+                              size});
+      capacity_ += size;
+      num_objects_in_last_chunk_ = 0;
+    }
+    T* const object =
+        new (&chunks_.back().objects[num_objects_in_last_chunk_])
+            T(std::forward<Args>(args)...);
+    ++num_objects_in_last_chunk_;
+    return object;
+  }
+
+  // Returns the number of objects which fit into the chunks allocated so far.
+  int capacity() const { return capacity_; }
+
+ private:
+  static constexpr int kMinObjectsPerChunk =
+      sizeof(T) < (1 << 12) ? (1 << 12) / sizeof(T) : 1;
+  static constexpr int kMaxObjectsPerChunk =
+      sizeof(T) < (1 << 16) ? (1 << 16) / sizeof(T) : 1;
+
+  using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+  struct Chunk {
+    std::unique_ptr<Storage[]> objects;
+    int size;
+  };
+
+  std::vector<Chunk> chunks_;
+  int capacity_;
+  int num_objects_in_last_chunk_;
+};
+
+template <typename T>
+constexpr int ChunkAllocator<T>::kMinObjectsPerChunk;
+
+template <typename T>
+constexpr int ChunkAllocator<T>::kMaxObjectsPerChunk;
+
 // A flat grid of '2^kBits' x '2^kBits' x '2^kBits' voxels storing values of
-// type 'ValueType' in contiguous memory. Indices in each dimension are 0-based.
-template <typename TValueType, int kBits>
+// type 'ValueType' in contiguous memory, ordered according to 'Layout'.
+// Indices in each dimension are 0-based.
+//
+// Each grid keeps a bitmask of the cells handed out by 'mutable_value()'. All
+// other cells have the default value, so iteration only needs to look at the
+// cells whose bit is set and whole words of empty cells are skipped at once.
+template <typename TValueType, int kBits, typename Layout = LinearLayout>
 class FlatGrid {
  public:
   using ValueType = TValueType;
+  using Cell = CellType<ValueType>;
+  using Leaf = FlatGrid;
+
+  // Number of cells and of 64-bit words needed for one bit per cell.
+  static constexpr int kNumCells = 1 << (3 * kBits);
+  static constexpr int kNumOccupancyWords = (kNumCells + 63) / 64;
+
+  // Bit 'i % 64' of word 'i / 64' is set iff the cell with flat index 'i' is
+  // not equal to the default value.
+  using OccupancyMask = std::array<uint64, kNumOccupancyWords>;
 
   // Creates a new flat grid with all values being default constructed.
   FlatGrid() {
-    for (ValueType& value : cells_) {
-      value = ValueType();
+    for (Cell& cell : cells_) {
+      cell = ValueType();
+    }
+    for (std::atomic<uint64>& word : touched_) {
+      word.store(0, std::memory_order_relaxed);
     }
   }
 
@@ -83,64 +269,164 @@ class FlatGrid {
   // Returns the value stored at 'index', each dimension of 'index' being
   // between 0 and grid_size() - 1.
   ValueType value(const Eigen::Array3i& index) const {
-    return cells_[ToFlatIndex(index, kBits)];
+    return cells_[Layout::ToFlatIndex(index, kBits)];
+  }
+
+  // Returns a pointer to a cell to allow changing its value. For arithmetic
+  // value types this is a RelaxedAtomic<ValueType>, which can be assigned a
+  // ValueType and converts to one, but has no compound assignment.
+  Cell* mutable_value(const Eigen::Array3i& index) {
+    const int i = Layout::ToFlatIndex(index, kBits);
+    // Only one thread may call this, so no read-modify-write is needed.
+    std::atomic<uint64>& word = touched_[i / 64];
+    word.store(word.load(std::memory_order_relaxed) | (uint64{1} << (i % 64)),
+               std::memory_order_relaxed);
+    return &cells_[i];
   }
 
-  // Returns a pointer to a value to allow changing it.
-  ValueType* mutable_value(const Eigen::Array3i& index) {
-    return &cells_[ToFlatIndex(index, kBits)];
+  // Returns the contiguous storage of all kNumCells cells in 'Layout' order.
+  const Cell* cells() const { return cells_.data(); }
+
+  // Computes which cells are not equal to the default value. Only cells which
+  // have been handed out by 'mutable_value()' are read.
+  OccupancyMask ComputeOccupancy() const {
+    OccupancyMask occupancy;
+    for (int word = 0; word != kNumOccupancyWords; ++word) {
+      uint64 bits = touched_[word].load(std::memory_order_relaxed);
+      for (uint64 remaining = bits; remaining != 0;
+           remaining &= remaining - 1) {
+        const int bit = __builtin_ctzll(remaining);
+        if (IsDefaultValue(cells_[word * 64 + bit])) {
+          bits &= ~(uint64{1} << bit);
+        }
+      }
+      occupancy[word] = bits;
+    }
+    return occupancy;
+  }
+
+  // Returns the number of cells not equal to the default value.
+  int CountOccupiedCells() const {
+    int count = 0;
+    for (const uint64 bits : ComputeOccupancy()) {
+      count += __builtin_popcountll(bits);
+    }
+    return count;
+  }
+
+  // Calls 'visitor(index, value)' for all cells not equal to the default value
+  // in 'Layout' order, 'index' being relative to this grid. Empty cells are
+  // skipped 64 at a time using the occupancy mask.
+  template <typename Visitor>
+  void ForEachOccupiedCell(Visitor&& visitor) const {
+    for (int word = 0; word != kNumOccupancyWords; ++word) {
+      for (uint64 bits = touched_[word].load(std::memory_order_relaxed);
+           bits != 0; bits &= bits - 1) {
+        const int i = word * 64 + __builtin_ctzll(bits);
+        if (!IsDefaultValue(cells_[i])) {
+          visitor(Layout::To3DIndex(i, kBits), cells_[i]);
+        }
+      }
+    }
+  }
+
+  // Calls 'visitor(base_index, *this)', 'base_index' being the index of the
+  // first cell of this grid. Allows treating flat and nested grids alike.
+  template <typename Visitor>
+  void ForEachBlock(const Eigen::Array3i& base_index, Visitor&& visitor) const {
+    visitor(base_index, *this);
   }
 
   // An iterator for iterating over all values not comparing equal to the
   // default constructed value.
   class Iterator {
    public:
-    Iterator() : current_(nullptr), end_(nullptr) {}
+    Iterator()
+        : flat_grid_(nullptr), word_(kNumOccupancyWords), bits_(0), index_(0) {}
 
     explicit Iterator(const FlatGrid& flat_grid)
-        : current_(flat_grid.cells_.data()),
-          end_(flat_grid.cells_.data() + flat_grid.cells_.size()) {
-      while (!Done() && IsDefaultValue(*current_)) {
-        ++current_;
-      }
+        : flat_grid_(&flat_grid), word_(-1), bits_(0), index_(0) {
+      Advance();
     }
 
     void Next() {
       DCHECK(!Done());
-      do {
-        ++current_;
-      } while (!Done() && IsDefaultValue(*current_));
+      Advance();
     }
 
-    bool Done() const { return current_ == end_; }
+    bool Done() const { return word_ == kNumOccupancyWords; }
 
     Eigen::Array3i GetCellIndex() const {
       DCHECK(!Done());
-      const int index = (1 << (3 * kBits)) - (end_ - current_);
-      return To3DIndex(index, kBits);
+      return Layout::To3DIndex(index_, kBits);
     }
 
-    const ValueType& GetValue() const {
+    const Cell& GetValue() const {
       DCHECK(!Done());
-      return *current_;
+      return flat_grid_->cells_[index_];
     }
 
    private:
-    const ValueType* current_;
-    const ValueType* end_;
+    // Moves to the next touched cell not equal to the default value.
+    void Advance() {
+      for (;;) {
+        while (bits_ == 0) {
+          if (++word_ == kNumOccupancyWords) {
+            return;
+          }
+          bits_ = flat_grid_->touched_[word_].load(std::memory_order_relaxed);
+        }
+        index_ = word_ * 64 + __builtin_ctzll(bits_);
+        bits_ &= bits_ - 1;
+        if (!IsDefaultValue(flat_grid_->cells_[index_])) {
+          return;
+        }
+      }
+    }
+
+    const FlatGrid* flat_grid_;
+    int word_;
+    // Touched cells of the current word not yet visited.
+    uint64 bits_;
+    int index_;
   };
 
  private:
-  std::array<ValueType, 1 << (3 * kBits)> cells_;
+  std::array<Cell, kNumCells> cells_;
+
+  // Bit 'i % 64' of word 'i / 64' is set if the cell with flat index 'i' has
+  // been handed out by 'mutable_value()'. It may since have been reset to the
+  // default value.
+  std::array<std::atomic<uint64>, kNumOccupancyWords> touched_;
 };
 
+template <typename TValueType, int kBits, typename Layout>
+constexpr int FlatGrid<TValueType, kBits, Layout>::kNumCells;
+
+template <typename TValueType, int kBits, typename Layout>
+constexpr int FlatGrid<TValueType, kBits, Layout>::kNumOccupancyWords;
+
 // A grid consisting of '2^kBits' x '2^kBits' x '2^kBits' grids of type
-// 'WrappedGrid'. Wrapped grids are constructed on first access via
-// 'mutable_value()'.
-template <typename WrappedGrid, int kBits>
+// 'WrappedGrid', ordered according to 'Layout'. Wrapped grids are constructed
+// on first access via 'mutable_value()' by the 'allocator' which owns them and
+// must outlive this grid. New wrapped grids are published atomically, so
+// 'value()' and iterators may be used concurrently with 'mutable_value()'.
+template <typename WrappedGrid, int kBits, typename Layout = LinearLayout>
 class NestedGrid {
  public:
   using ValueType = typename WrappedGrid::ValueType;
+  using Cell = typename WrappedGrid::Cell;
+  using Leaf = typename WrappedGrid::Leaf;
+  using Allocator = ChunkAllocator<WrappedGrid>;
+
+  explicit NestedGrid(Allocator* const allocator) : allocator_(allocator) {
+    for (std::atomic<WrappedGrid*>& meta_cell : meta_cells_) {
+      meta_cell.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  NestedGrid(const NestedGrid&) = delete;
+  NestedGrid& operator=(const NestedGrid&) = delete;
 
   // Returns the number of voxels per dimension.
   static int grid_size() { return WrappedGrid::grid_size() << kBits; }
@@ -150,7 +436,8 @@ class NestedGrid {
   ValueType value(const Eigen::Array3i& index) const {
     const Eigen::Array3i meta_index = GetMetaIndex(index);
     const WrappedGrid* const meta_cell =
-        meta_cells_[ToFlatIndex(meta_index, kBits)].get();
+        meta_cells_[Layout::ToFlatIndex(meta_index, kBits)].load(
+            std::memory_order_acquire);
     if (meta_cell == nullptr) {
       return ValueType();
     }
@@ -159,18 +446,36 @@ class NestedGrid {
     return meta_cell->value(inner_index);
   }
 
-  // Returns a pointer to the value at 'index' to allow changing it. If
-  // necessary a new wrapped grid is constructed to contain that value.
-  ValueType* mutable_value(const Eigen::Array3i& index) {
+  // Returns a pointer to the cell at 'index' to allow changing it. If
+  // necessary a new wrapped grid is constructed to contain that cell.
+  Cell* mutable_value(const Eigen::Array3i& index) {
     const Eigen::Array3i meta_index = GetMetaIndex(index);
-    std::unique_ptr<WrappedGrid>& meta_cell =
-        meta_cells_[ToFlatIndex(meta_index, kBits)];
-    if (meta_cell == nullptr) {
-      meta_cell = common::make_unique<WrappedGrid>();
+    std::atomic<WrappedGrid*>& meta_cell =
+        meta_cells_[Layout::ToFlatIndex(meta_index, kBits)];
+    WrappedGrid* wrapped_grid = meta_cell.load(std::memory_order_relaxed);
+    if (wrapped_grid == nullptr) {
+      wrapped_grid = allocator_->New();
+      meta_cell.store(wrapped_grid, std::memory_order_release);
     }
     const Eigen::Array3i inner_index =
         index - meta_index * WrappedGrid::grid_size();
-    return meta_cell->mutable_value(inner_index);
+    return wrapped_grid->mutable_value(inner_index);
+  }
+
+  // Calls 'visitor(base_index, leaf)' for all allocated innermost grids,
+  // 'base_index' being the index of their first cell offset by 'base_index'.
+  template <typename Visitor>
+  void ForEachBlock(const Eigen::Array3i& base_index, Visitor&& visitor) const {
+    for (int i = 0; i != static_cast<int>(meta_cells_.size()); ++i) {
+      const WrappedGrid* const wrapped_grid =
+          meta_cells_[i].load(std::memory_order_acquire);
+      if (wrapped_grid != nullptr) {
+        wrapped_grid->ForEachBlock(
+            base_index +
+                Layout::To3DIndex(i, kBits) * WrappedGrid::grid_size(),
+            visitor);
+      }
+    }
   }
 
   // An iterator for iterating over all values not comparing equal to the
@@ -201,11 +506,11 @@ class NestedGrid {
     Eigen::Array3i GetCellIndex() const {
       DCHECK(!Done());
       const int index = (1 << (3 * kBits)) - (end_ - current_);
-      return To3DIndex(index, kBits) * WrappedGrid::grid_size() +
+      return Layout::To3DIndex(index, kBits) * WrappedGrid::grid_size() +
              nested_iterator_.GetCellIndex();
     }
 
-    const ValueType& GetValue() const {
+    const Cell& GetValue() const {
       DCHECK(!Done());
       return nested_iterator_.GetValue();
     }
@@ -213,8 +518,10 @@ class NestedGrid {
    private:
     void AdvanceToValidNestedIterator() {
       for (; !Done(); ++current_) {
-        if (*current_ != nullptr) {
-          nested_iterator_ = typename WrappedGrid::Iterator(**current_);
+        const WrappedGrid* const wrapped_grid =
+            current_->load(std::memory_order_acquire);
+        if (wrapped_grid != nullptr) {
+          nested_iterator_ = typename WrappedGrid::Iterator(*wrapped_grid);
           if (!nested_iterator_.Done()) {
             break;
           }
@@ -222,8 +529,8 @@ class NestedGrid {
       }
     }
 
-    const std::unique_ptr<WrappedGrid>* current_;
-    const std::unique_ptr<WrappedGrid>* end_;
+    const std::atomic<WrappedGrid*>* current_;
+    const std::atomic<WrappedGrid*>* end_;
     typename WrappedGrid::Iterator nested_iterator_;
   };
 
@@ -237,36 +544,71 @@ class NestedGrid {
     return meta_index;
   }
 
-  std::array<std::unique_ptr<WrappedGrid>, 1 << (3 * kBits)> meta_cells_;
+  Allocator* allocator_;
+  std::array<std::atomic<WrappedGrid*>, 1 << (3 * kBits)> meta_cells_;
 };
 
 // A grid consisting of 2x2x2 grids of type 'WrappedGrid' initially. Wrapped
 // grids are constructed on first access via 'mutable_value()'. If necessary,
 // the grid grows to twice the size in each dimension. The range of indices is
 // (almost) symmetric around the origin, i.e. negative indices are allowed.
+// The innermost grids of all wrapped grids are allocated in chunks owned by
+// this grid and are only freed when it is destroyed.
+//
+// Only one thread may call 'mutable_value()' and write cells at a time, but
+// 'value()' and iterators may be used by other threads at the same time.
+// Growing publishes a new table of wrapped grids and keeps the replaced tables
+// alive until this grid is destroyed, so readers always see a complete table.
+// Their total size is less than a seventh of the current table. Cells of
+// arithmetic types are RelaxedAtomic, so a cell which is being changed
+// concurrently is read either before or after the change. This holds per
+// cell only: readers do not get a snapshot of the whole grid, and a reader
+// of a grid which is being written may see part of an insertion. Grids which
+// are no longer written, e.g. of finished submaps, read consistently. Cells
+// of other types must not be read while they are being written.
 template <typename WrappedGrid>
 class DynamicGrid {
  public:
   using ValueType = typename WrappedGrid::ValueType;
+  using Cell = typename WrappedGrid::Cell;
+  using Leaf = typename WrappedGrid::Leaf;
+
+  DynamicGrid()
+      : allocator_(common::make_unique<typename WrappedGrid::Allocator>()),
+        wrapped_grids_(common::make_unique<ChunkAllocator<WrappedGrid>>()) {
+    meta_cells_tables_.push_back(common::make_unique<MetaCells>(1));
+    meta_cells_.store(meta_cells_tables_.back().get(),
+                      std::memory_order_release);
+  }
+
+  DynamicGrid(DynamicGrid&& other)
+      : allocator_(std::move(other.allocator_)),
+        wrapped_grids_(std::move(other.wrapped_grids_)),
+        meta_cells_tables_(std::move(other.meta_cells_tables_)),
+        meta_cells_(other.meta_cells_.load(std::memory_order_acquire)) {
+    other.meta_cells_.store(nullptr, std::memory_order_release);
+  }
 
-  DynamicGrid() : bits_(1), meta_cells_(8) {}
-  DynamicGrid(DynamicGrid&&) = default;
-  DynamicGrid& operator=(DynamicGrid&&) = default;
+  DynamicGrid& operator=(DynamicGrid&&) = delete;
 
   // Returns the current number of voxels per dimension.
-  int grid_size() const { return WrappedGrid::grid_size() << bits_; }
+  int grid_size() const {
+    return GridSize(*meta_cells_.load(std::memory_order_acquire));
+  }
 
   // Returns the value stored at 'index'.
   ValueType value(const Eigen::Array3i& index) const {
-    const Eigen::Array3i shifted_index = index + (grid_size() >> 1);
+    const MetaCells& meta_cells = *meta_cells_.load(std::memory_order_acquire);
+    const Eigen::Array3i shifted_index = index + (GridSize(meta_cells) >> 1);
     // The cast to unsigned is for performance to check with 3 comparisons
     // shifted_index.[xyz] >= 0 and shifted_index.[xyz] < grid_size.
-    if ((shifted_index.cast<unsigned int>() >= grid_size()).any()) {
+    if ((shifted_index.cast<unsigned int>() >= GridSize(meta_cells)).any()) {
       return ValueType();
     }
-    const Eigen::Array3i meta_index = GetMetaIndex(shifted_index);
+    const Eigen::Array3i meta_index = GetMetaIndex(meta_cells, shifted_index);
     const WrappedGrid* const meta_cell =
-        meta_cells_[ToFlatIndex(meta_index, bits_)].get();
+        meta_cells.cells[ToFlatIndex(meta_index, meta_cells.bits)].load(
+            std::memory_order_acquire);
     if (meta_cell == nullptr) {
       return ValueType();
     }
@@ -275,38 +617,95 @@ class DynamicGrid {
     return meta_cell->value(inner_index);
   }
 
-  // Returns a pointer to the value at 'index' to allow changing it, dynamically
+  // Returns a pointer to the cell at 'index' to allow changing it, dynamically
   // growing the DynamicGrid and constructing new WrappedGrids as needed.
-  ValueType* mutable_value(const Eigen::Array3i& index) {
-    const Eigen::Array3i shifted_index = index + (grid_size() >> 1);
+  Cell* mutable_value(const Eigen::Array3i& index) {
+    MetaCells& meta_cells = *meta_cells_.load(std::memory_order_relaxed);
+    const Eigen::Array3i shifted_index = index + (GridSize(meta_cells) >> 1);
     // The cast to unsigned is for performance to check with 3 comparisons
     // shifted_index.[xyz] >= 0 and shifted_index.[xyz] < grid_size.
-    if ((shifted_index.cast<unsigned int>() >= grid_size()).any()) {
+    if ((shifted_index.cast<unsigned int>() >= GridSize(meta_cells)).any()) {
       Grow();
       return mutable_value(index);
     }
-    const Eigen::Array3i meta_index = GetMetaIndex(shifted_index);
-    std::unique_ptr<WrappedGrid>& meta_cell =
-        meta_cells_[ToFlatIndex(meta_index, bits_)];
-    if (meta_cell == nullptr) {
-      meta_cell = common::make_unique<WrappedGrid>();
+    const Eigen::Array3i meta_index = GetMetaIndex(meta_cells, shifted_index);
+    std::atomic<WrappedGrid*>& meta_cell =
+        meta_cells.cells[ToFlatIndex(meta_index, meta_cells.bits)];
+    WrappedGrid* wrapped_grid = meta_cell.load(std::memory_order_relaxed);
+    if (wrapped_grid == nullptr) {
+      wrapped_grid = wrapped_grids_->New(allocator_.get());
+      meta_cell.store(wrapped_grid, std::memory_order_release);
     }
     const Eigen::Array3i inner_index =
         shifted_index - meta_index * WrappedGrid::grid_size();
-    return meta_cell->mutable_value(inner_index);
+    return wrapped_grid->mutable_value(inner_index);
   }
 
-  // An iterator for iterating over all values not comparing equal to the
+  // Calls 'visitor(base_index, leaf)' for all allocated innermost grids of
+  // type 'Leaf', 'base_index' being the index of their first cell. This is
+  // faster than using an iterator as index computations are done once per
+  // block instead of once per cell.
+  template <typename Visitor>
+  void ForEachBlock(Visitor&& visitor) const {
+    const MetaCells& meta_cells = *meta_cells_.load(std::memory_order_acquire);
+    const Eigen::Array3i shift =
+        Eigen::Array3i::Constant(-(GridSize(meta_cells) >> 1));
+    for (int i = 0; i != static_cast<int>(meta_cells.cells.size()); ++i) {
+      const WrappedGrid* const wrapped_grid =
+          meta_cells.cells[i].load(std::memory_order_acquire);
+      if (wrapped_grid != nullptr) {
+        wrapped_grid->ForEachBlock(
+            shift + To3DIndex(i, meta_cells.bits) * WrappedGrid::grid_size(),
+            visitor);
+      }
+    }
+  }
+
+  // Returns the number of cells not comparing equal to the default constructed
+  // value.
+  int CountOccupiedCells() const {
+    int count = 0;
+    ForEachBlock([&count](const Eigen::Array3i& base_index, const Leaf& leaf) {
+      count += leaf.CountOccupiedCells();
+    });
+    return count;
+  }
+
+  // Calls 'visitor(index, value)' for all cells not comparing equal to the
   // default constructed value.
+  template <typename Visitor>
+  void ForEachOccupiedCell(Visitor&& visitor) const {
+    ForEachBlock([&visitor](const Eigen::Array3i& base_index,
+                            const Leaf& leaf) {
+      leaf.ForEachOccupiedCell(
+          [&visitor, &base_index](const Eigen::Array3i& index,
+                                  const ValueType& value) {
+            visitor(base_index + index, value);
+          });
+    });
+  }
+
+ private:
+  // Table of wrapped grids for one size of this grid.
+  struct MetaCells {
+    explicit MetaCells(const int bits) : bits(bits), cells(1 << (3 * bits)) {
+      for (std::atomic<WrappedGrid*>& cell : cells) {
+        cell.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    const int bits;
+    std::vector<std::atomic<WrappedGrid*>> cells;
+  };
+
+ public:
+  // An iterator for iterating over all values not comparing equal to the
+  // default constructed value. It iterates over the wrapped grids which
+  // existed when it was constructed.
   class Iterator {
    public:
     explicit Iterator(const DynamicGrid& dynamic_grid)
-        : bits_(dynamic_grid.bits_),
-          current_(dynamic_grid.meta_cells_.data()),
-          end_(dynamic_grid.meta_cells_.data() +
-               dynamic_grid.meta_cells_.size()),
-          nested_iterator_() {
-      AdvanceToValidNestedIterator();
+        : Iterator(*dynamic_grid.meta_cells_.load(std::memory_order_acquire)) {
     }
 
     void Next() {
@@ -330,7 +729,7 @@ class DynamicGrid {
       return shifted_index - ((1 << (bits_ - 1)) * WrappedGrid::grid_size());
     }
 
-    const ValueType& GetValue() const {
+    const Cell& GetValue() const {
       DCHECK(!Done());
       return nested_iterator_.GetValue();
     }
@@ -338,7 +737,8 @@ class DynamicGrid {
     void AdvanceToEnd() { current_ = end_; }
 
     const std::pair<Eigen::Array3i, ValueType> operator*() const {
-      return std::pair<Eigen::Array3i, ValueType>(GetCellIndex(), GetValue());
+      const ValueType& value = GetValue();
+      return std::pair<Eigen::Array3i, ValueType>(GetCellIndex(), value);
     }
 
     Iterator& operator++() {
@@ -351,10 +751,20 @@ class DynamicGrid {
     }
 
    private:
+    explicit Iterator(const MetaCells& meta_cells)
+        : bits_(meta_cells.bits),
+          current_(meta_cells.cells.data()),
+          end_(meta_cells.cells.data() + meta_cells.cells.size()),
+          nested_iterator_() {
+      AdvanceToValidNestedIterator();
+    }
+
     void AdvanceToValidNestedIterator() {
       for (; !Done(); ++current_) {
-        if (*current_ != nullptr) {
-          nested_iterator_ = typename WrappedGrid::Iterator(**current_);
+        const WrappedGrid* const wrapped_grid =
+            current_->load(std::memory_order_acquire);
+        if (wrapped_grid != nullptr) {
+          nested_iterator_ = typename WrappedGrid::Iterator(*wrapped_grid);
           if (!nested_iterator_.Done()) {
             break;
           }
@@ -363,54 +773,77 @@ class DynamicGrid {
     }
 
     int bits_;
-    const std::unique_ptr<WrappedGrid>* current_;
-    const std::unique_ptr<WrappedGrid>* const end_;
+    const std::atomic<WrappedGrid*>* current_;
+    const std::atomic<WrappedGrid*>* const end_;
     typename WrappedGrid::Iterator nested_iterator_;
   };
 
  private:
+  static int GridSize(const MetaCells& meta_cells) {
+    return WrappedGrid::grid_size() << meta_cells.bits;
+  }
+
   // Returns the Eigen::Array3i (meta) index of the meta cell containing
   // 'index'.
-  Eigen::Array3i GetMetaIndex(const Eigen::Array3i& index) const {
+  static Eigen::Array3i GetMetaIndex(const MetaCells& meta_cells,
+                                     const Eigen::Array3i& index) {
     DCHECK((index >= 0).all()) << index;
     const Eigen::Array3i meta_index = index / WrappedGrid::grid_size();
-    DCHECK((meta_index < (1 << bits_)).all()) << index;
+    DCHECK((meta_index < (1 << meta_cells.bits)).all()) << index;
     return meta_index;
   }
 
-  // Grows this grid by a factor of 2 in each of the 3 dimensions.
+  // Grows this grid by a factor of 2 in each of the 3 dimensions. The new
+  // table is filled before it is published, and the old one stays valid.
   void Grow() {
-    const int new_bits = bits_ + 1;
+    const MetaCells& meta_cells = *meta_cells_.load(std::memory_order_relaxed);
+    const int bits = meta_cells.bits;
+    const int new_bits = bits + 1;
     CHECK_LE(new_bits, 8);
-    std::vector<std::unique_ptr<WrappedGrid>> new_meta_cells_(
-        8 * meta_cells_.size());
-    for (int z = 0; z != (1 << bits_); ++z) {
-      for (int y = 0; y != (1 << bits_); ++y) {
-        for (int x = 0; x != (1 << bits_); ++x) {
+    std::unique_ptr<MetaCells> new_meta_cells =
+        common::make_unique<MetaCells>(new_bits);
+    for (int z = 0; z != (1 << bits); ++z) {
+      for (int y = 0; y != (1 << bits); ++y) {
+        for (int x = 0; x != (1 << bits); ++x) {
           const Eigen::Array3i original_meta_index(x, y, z);
           const Eigen::Array3i new_meta_index =
-              original_meta_index + (1 << (bits_ - 1));
-          new_meta_cells_[ToFlatIndex(new_meta_index, new_bits)] =
-              std::move(meta_cells_[ToFlatIndex(original_meta_index, bits_)]);
+              original_meta_index + (1 << (bits - 1));
+          new_meta_cells->cells[ToFlatIndex(new_meta_index, new_bits)].store(
+              meta_cells.cells[ToFlatIndex(original_meta_index, bits)].load(
+                  std::memory_order_relaxed),
+              std::memory_order_relaxed);
         }
       }
     }
-    meta_cells_ = std::move(new_meta_cells_);
-    bits_ = new_bits;
+    meta_cells_tables_.push_back(std::move(new_meta_cells));
+    meta_cells_.store(meta_cells_tables_.back().get(),
+                      std::memory_order_release);
   }
 
-  int bits_;
-  std::vector<std::unique_ptr<WrappedGrid>> meta_cells_;
+  // Owns the innermost grids. It is kept on the heap so that pointers to it
+  // stay valid when this grid is moved.
+  std::unique_ptr<typename WrappedGrid::Allocator> allocator_;
+
+  // Owns the wrapped grids which are shared by all tables.
+  std::unique_ptr<ChunkAllocator<WrappedGrid>> wrapped_grids_;
+
+  // All tables this grid ever used, the last one being the current one.
+  std::vector<std::unique_ptr<MetaCells>> meta_cells_tables_;
+
+  // The current table.
+  std::atomic<MetaCells*> meta_cells_;
 };
 
-template <typename ValueType>
-using Grid = DynamicGrid<NestedGrid<FlatGrid<ValueType, 3>, 3>>;
+template <typename ValueType, typename Layout = LinearLayout>
+using Grid =
+    DynamicGrid<NestedGrid<FlatGrid<ValueType, 3, Layout>, 3, Layout>>;
 
-// Represents a 3D grid as a wide, shallow tree.
-template <typename ValueType>
-class HybridGridBase : public Grid<ValueType> {
+// Represents a 3D grid as a wide, shallow tree. 'Layout' is the order of cells
+// inside the flat and nested grids.
+template <typename ValueType, typename Layout = LinearLayout>
+class HybridGridBase : public Grid<ValueType, Layout> {
  public:
-  using Iterator = typename Grid<ValueType>::Iterator;
+  using Iterator = typename Grid<ValueType, Layout>::Iterator;
 
   // Creates a new tree-based probability grid around 'origin' which becomes the
   // center of the cell at index (0, 0, 0). Each voxel has edge length
@@ -476,8 +909,10 @@ class HybridGrid : public HybridGridBase<uint16> {
   // Starts the next update sequence.
   void StartUpdate() {
     while (!update_indices_.empty()) {
-      DCHECK_GE(*update_indices_.back(), mapping::kUpdateMarker);
-      *update_indices_.back() -= mapping::kUpdateMarker;
+      Cell* const cell = update_indices_.back();
+      const uint16 value = *cell;
+      DCHECK_GE(value, mapping::kUpdateMarker);
+      *cell = value - mapping::kUpdateMarker;
       update_indices_.pop_back();
     }
   }
@@ -492,13 +927,14 @@ class HybridGrid : public HybridGridBase<uint16> {
   bool ApplyLookupTable(const Eigen::Array3i& index,
                         const std::vector<uint16>& table) {
     DCHECK_EQ(table.size(), mapping::kUpdateMarker);
-    uint16* const cell = mutable_value(index);
-    if (*cell >= mapping::kUpdateMarker) {
+    Cell* const cell = mutable_value(index);
+    const uint16 value = *cell;
+    if (value >= mapping::kUpdateMarker) {
       return false;
     }
     update_indices_.push_back(cell);
-    *cell = table[*cell];
-    DCHECK_GE(*cell, mapping::kUpdateMarker);
+    *cell = table[value];
+    DCHECK_GE(table[value], mapping::kUpdateMarker);
     return true;
   }
 
@@ -512,7 +948,7 @@ class HybridGrid : public HybridGridBase<uint16> {
 
  private:
   // Markers at changed cells.
-  std::vector<ValueType*> update_indices_;
+  std::vector<Cell*> update_indices_;
 };
 
 }  // namespace mapping_3d
@@ -16,7 +16,9 @@
 
 #include "cartographer/mapping_3d/hybrid_grid.h"
 
+#include <atomic>
 #include <random>
+#include <thread>
 #include <tuple>
 
 #include "gmock/gmock.h"
@@ -177,6 +179,249 @@ TEST(HybridGridTest, TestIteration) {
   }
 }
 
+TEST(HybridGridTest, MortonLayoutRoundTrip) {
+  for (int bits = 1; bits <= 3; ++bits) {
+    for (int index = 0; index != (1 << (3 * bits)); ++index) {
+      EXPECT_EQ(index, MortonLayout::ToFlatIndex(
+                           MortonLayout::To3DIndex(index, bits), bits));
+    }
+  }
+  EXPECT_EQ(1, MortonLayout::ToFlatIndex(Eigen::Array3i(1, 0, 0), 3));
+  EXPECT_EQ(2, MortonLayout::ToFlatIndex(Eigen::Array3i(0, 1, 0), 3));
+  EXPECT_EQ(4, MortonLayout::ToFlatIndex(Eigen::Array3i(0, 0, 1), 3));
+  EXPECT_EQ(7, MortonLayout::ToFlatIndex(Eigen::Array3i(1, 1, 1), 3));
+  EXPECT_EQ(8, MortonLayout::ToFlatIndex(Eigen::Array3i(2, 0, 0), 3));
+}
+
+TEST(HybridGridTest, MortonLayoutIteration) {
+  HybridGridBase<uint8, MortonLayout> grid(1.f, Eigen::Vector3f::Zero());
+  std::map<std::tuple<int, int, int>, uint8> values;
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> xyz_distribution(-100, 99);
+  for (int i = 0; i < 1000; ++i) {
+    const Eigen::Array3i index(xyz_distribution(rng), xyz_distribution(rng),
+                               xyz_distribution(rng));
+    const uint8 value = 1 + i % 200;
+    *grid.mutable_value(index) = value;
+    values[std::make_tuple(index.x(), index.y(), index.z())] = value;
+  }
+  for (const auto& cell : grid) {
+    const auto key =
+        std::make_tuple(cell.first.x(), cell.first.y(), cell.first.z());
+    ASSERT_TRUE(values.count(key)) << cell.first;
+    EXPECT_EQ(values[key], cell.second);
+    EXPECT_EQ(cell.second, grid.value(cell.first));
+    values.erase(key);
+  }
+  EXPECT_TRUE(values.empty());
+}
+
+template <typename Layout>
+void TestForEachOccupiedCell() {
+  HybridGridBase<uint16, Layout> grid(1.f, Eigen::Vector3f::Zero());
+  std::mt19937 rng(1285120005);
+  std::uniform_int_distribution<int> xyz_distribution(-300, 299);
+  for (int i = 0; i < 5000; ++i) {
+    *grid.mutable_value(Eigen::Array3i(xyz_distribution(rng),
+                                       xyz_distribution(rng),
+                                       xyz_distribution(rng))) = 1 + i;
+  }
+  // Touched cells which still have the default value must be skipped.
+  *grid.mutable_value(Eigen::Array3i(1000, 0, 0)) = 0;
+
+  // Visits the same cells in the same order as the iterator.
+  auto it = typename HybridGridBase<uint16, Layout>::Iterator(grid);
+  int num_cells = 0;
+  grid.ForEachOccupiedCell(
+      [&it, &num_cells](const Eigen::Array3i& index, const uint16 value) {
+        ASSERT_FALSE(it.Done());
+        EXPECT_THAT(index, AllCwiseEqual(it.GetCellIndex()));
+        EXPECT_EQ(it.GetValue(), value);
+        it.Next();
+        ++num_cells;
+      });
+  EXPECT_TRUE(it.Done());
+  EXPECT_GT(num_cells, 4900);
+}
+
+TEST(HybridGridTest, ForEachOccupiedCell) {
+  TestForEachOccupiedCell<LinearLayout>();
+  TestForEachOccupiedCell<MortonLayout>();
+}
+
+TEST(HybridGridTest, ForEachBlock) {
+  HybridGrid hybrid_grid(1.f, Eigen::Vector3f::Zero());
+  const std::vector<Eigen::Array3i> indices = {
+      {0, 0, 0}, {7, 7, 7}, {8, 0, 0}, {-1, -1, -1}, {100, -100, 50}};
+  for (const Eigen::Array3i& index : indices) {
+    hybrid_grid.SetProbability(index, 0.7f);
+  }
+  int num_blocks = 0;
+  int num_cells = 0;
+  hybrid_grid.ForEachBlock([&](const Eigen::Array3i& base_index,
+                               const HybridGrid::Leaf& leaf) {
+    ++num_blocks;
+    EXPECT_THAT(base_index - (base_index / 8) * 8,
+                AllCwiseEqual(Eigen::Array3i::Zero()));
+    const HybridGrid::Leaf::OccupancyMask occupancy = leaf.ComputeOccupancy();
+    for (int i = 0; i != HybridGrid::Leaf::kNumCells; ++i) {
+      const Eigen::Array3i index = base_index + To3DIndex(i, 3);
+      EXPECT_EQ(hybrid_grid.value(index), leaf.cells()[i]);
+      EXPECT_EQ(leaf.cells()[i] != 0,
+                static_cast<bool>((occupancy[i / 64] >> (i % 64)) & 1));
+      num_cells += leaf.cells()[i] != 0;
+    }
+  });
+  EXPECT_EQ(4, num_blocks);
+  EXPECT_EQ(static_cast<int>(indices.size()), num_cells);
+  EXPECT_EQ(num_cells, hybrid_grid.CountOccupiedCells());
+}
+
+TEST(HybridGridTest, FlatGridOccupancy) {
+  using TestFlatGrid = FlatGrid<uint16, 3>;
+  TestFlatGrid flat_grid;
+  EXPECT_TRUE(TestFlatGrid::Iterator(flat_grid).Done());
+  EXPECT_EQ(0, flat_grid.CountOccupiedCells());
+  *flat_grid.mutable_value(Eigen::Array3i(1, 0, 0)) = 5;
+  *flat_grid.mutable_value(Eigen::Array3i(7, 7, 7)) = 6;
+  *flat_grid.mutable_value(Eigen::Array3i(0, 1, 0)) = 7;
+  // Reading through 'mutable_value()' without changing the value.
+  flat_grid.mutable_value(Eigen::Array3i(3, 3, 3));
+  // Resetting a cell to the default value.
+  *flat_grid.mutable_value(Eigen::Array3i(0, 1, 0)) = 0;
+  EXPECT_EQ(2, flat_grid.CountOccupiedCells());
+  const TestFlatGrid::OccupancyMask occupancy = flat_grid.ComputeOccupancy();
+  EXPECT_EQ(uint64{1} << 1, occupancy[0]);
+  EXPECT_EQ(uint64{1} << 63, occupancy[7]);
+
+  TestFlatGrid::Iterator it(flat_grid);
+  ASSERT_FALSE(it.Done());
+  EXPECT_THAT(it.GetCellIndex(), AllCwiseEqual(Eigen::Array3i(1, 0, 0)));
+  EXPECT_EQ(5, it.GetValue());
+  it.Next();
+  ASSERT_FALSE(it.Done());
+  EXPECT_THAT(it.GetCellIndex(), AllCwiseEqual(Eigen::Array3i(7, 7, 7)));
+  EXPECT_EQ(6, it.GetValue());
+  it.Next();
+  EXPECT_TRUE(it.Done());
+}
+
+TEST(HybridGridTest, MovedGridKeepsValues) {
+  HybridGridBase<std::vector<int>> grid(1.f, Eigen::Vector3f::Zero());
+  // Enough cells far apart to need several chunks of leaves.
+  for (int i = 0; i != 200; ++i) {
+    grid.mutable_value(Eigen::Array3i(8 * i, -8 * i, i))->push_back(i);
+  }
+  HybridGridBase<std::vector<int>> moved_grid(std::move(grid));
+  moved_grid.mutable_value(Eigen::Array3i(-1000, 0, 0))->push_back(-1);
+  for (int i = 0; i != 200; ++i) {
+    const std::vector<int> value =
+        moved_grid.value(Eigen::Array3i(8 * i, -8 * i, i));
+    ASSERT_EQ(1, value.size());
+    EXPECT_EQ(i, value.front());
+  }
+  EXPECT_EQ(-1, moved_grid.value(Eigen::Array3i(-1000, 0, 0)).front());
+}
+
+struct CountedObject {
+  explicit CountedObject(int* const num_destroyed)
+      : num_destroyed(num_destroyed) {}
+  ~CountedObject() { ++*num_destroyed; }
+
+  int* num_destroyed;
+  char payload[100];
+};
+
+TEST(ChunkAllocatorTest, FewObjectsUseSmallChunk) {
+  int num_destroyed = 0;
+  ChunkAllocator<CountedObject> allocator;
+  EXPECT_EQ(0, allocator.capacity());
+  allocator.New(&num_destroyed);
+  EXPECT_GE(allocator.capacity(), 1);
+  EXPECT_LE(allocator.capacity() * sizeof(CountedObject), 1 << 12);
+}
+
+TEST(ChunkAllocatorTest, DestroysAllObjects) {
+  int num_destroyed = 0;
+  {
+    ChunkAllocator<CountedObject> allocator;
+    std::vector<CountedObject*> objects;
+    for (int i = 0; i != 10000; ++i) {
+      objects.push_back(allocator.New(&num_destroyed));
+      objects.back()->payload[0] = i % 128;
+    }
+    // At most the last chunk of about 64 KiB is not filled up.
+    EXPECT_GE(allocator.capacity(), 10000);
+    EXPECT_LE(allocator.capacity(),
+              10000 + (1 << 16) / static_cast<int>(sizeof(CountedObject)));
+    for (int i = 0; i != 10000; ++i) {
+      EXPECT_EQ(i % 128, objects[i]->payload[0]);
+    }
+    EXPECT_EQ(0, num_destroyed);
+  }
+  EXPECT_EQ(10000, num_destroyed);
+}
+
+TEST(HybridGridTest, ConcurrentReadsWhileGrowing) {
+  HybridGrid hybrid_grid(1.f, Eigen::Vector3f::Zero());
+  for (int i = 0; i != 10; ++i) {
+    hybrid_grid.SetProbability(Eigen::Array3i(i, 0, 0), 0.75f);
+  }
+  std::atomic<bool> done(false);
+  std::thread reader([&hybrid_grid, &done]() {
+    while (!done.load()) {
+      for (int i = 0; i != 10; ++i) {
+        ASSERT_NEAR(0.75f, hybrid_grid.GetProbability(Eigen::Array3i(i, 0, 0)),
+                    1e-3);
+      }
+      EXPECT_FALSE(hybrid_grid.IsKnown(Eigen::Array3i(0, 1, 0)));
+    }
+  });
+  // Writes far away cells so that the grid grows several times.
+  for (int i = 1; i != 2000; ++i) {
+    hybrid_grid.SetProbability(Eigen::Array3i(-i, i / 2, 2 * i), 0.25f);
+  }
+  done.store(true);
+  reader.join();
+  int num_cells = 0;
+  for (auto it = HybridGrid::Iterator(hybrid_grid); !it.Done(); it.Next()) {
+    ++num_cells;
+  }
+  EXPECT_EQ(10 + 1999, num_cells);
+}
+
+TEST(HybridGridTest, ConcurrentReadsOfCellsBeingWritten) {
+  HybridGrid hybrid_grid(1.f, Eigen::Vector3f::Zero());
+  const uint16 low_value = mapping::ProbabilityToValue(0.25f);
+  const uint16 high_value = mapping::ProbabilityToValue(0.75f);
+  for (int i = 0; i != 10; ++i) {
+    hybrid_grid.SetProbability(Eigen::Array3i(i, 0, 0), 0.25f);
+  }
+  std::atomic<bool> done(false);
+  std::thread reader([&]() {
+    while (!done.load()) {
+      for (int i = 0; i != 10; ++i) {
+        const uint16 value = hybrid_grid.value(Eigen::Array3i(i, 0, 0));
+        ASSERT_TRUE(value == low_value || value == high_value) << value;
+      }
+      for (auto it = HybridGrid::Iterator(hybrid_grid); !it.Done();
+           it.Next()) {
+        const uint16 value = it.GetValue();
+        ASSERT_TRUE(value == low_value || value == high_value) << value;
+      }
+    }
+  });
+  // Changes the cells the reader looks at, and adds new cells far away so
+  // that the grid also grows.
+  for (int i = 1; i != 2000; ++i) {
+    hybrid_grid.SetProbability(Eigen::Array3i(i % 10, 0, 0),
+                               i % 2 == 0 ? 0.25f : 0.75f);
+    hybrid_grid.SetProbability(Eigen::Array3i(-i, i / 2, 2 * i), 0.75f);
+  }
+  done.store(true);
+  reader.join();
+}
+
 }  // namespace
 }  // namespace mapping_3d
 }  // namespace cartographer
@@ -102,6 +102,9 @@ class KalmanLocalTrajectoryBuilderTest : public ::testing::Test {
               angular_search_window = math.rad(1.),
               translation_delta_cost_weight = 1e-1,
               rotation_delta_cost_weight = 1.,
+              approximate_pruning = false,
+              coarse_search_cell_size = 1,
+              num_coarse_candidates_to_refine = 8,
             },
             pose_tracker = {
               orientation_model_variance = 5e-4,
@@ -17,6 +17,7 @@
 #include "cartographer/mapping_3d/scan_matching/fast_correlative_scan_matcher.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <functional>
 #include <limits>
@@ -24,6 +25,7 @@
 #include "Eigen/Geometry"
 #include "cartographer/common/make_unique.h"
 #include "cartographer/common/math.h"
+#include "cartographer/common/parallel_for.h"
 #include "cartographer/mapping_3d/scan_matching/precomputation_grid.h"
 #include "cartographer/mapping_3d/scan_matching/proto/fast_correlative_scan_matcher_options.pb.h"
 #include "cartographer/transform/transform.h"
@@ -63,7 +65,12 @@ class PrecomputationGridStack {
     CHECK_GE(options.branch_and_bound_depth(), 1);
     CHECK_GE(options.full_resolution_depth(), 1);
     precomputation_grids_.reserve(options.branch_and_bound_depth());
-    precomputation_grids_.push_back(ConvertToPrecomputationGrid(hybrid_grid));
+    // Only the compact copies are kept, the PrecomputationGrid of the previous
+    // depth is needed to compute the next one.
+    auto last_grid = common::make_unique<PrecomputationGrid>(
+        ConvertToPrecomputationGrid(hybrid_grid));
+    precomputation_grids_.push_back(
+        common::make_unique<CompactPrecomputationGrid>(*last_grid));
     Eigen::Array3i last_width = Eigen::Array3i::Ones();
     for (int depth = 1; depth != options.branch_and_bound_depth(); ++depth) {
       const bool half_resolution = depth >= options.full_resolution_depth();
@@ -75,20 +82,23 @@ class PrecomputationGridStack {
           (next_width - last_width +
            (full_voxels_per_high_resolution_voxel - 1)) /
           full_voxels_per_high_resolution_voxel;
+      last_grid = common::make_unique<PrecomputationGrid>(
+          PrecomputeGrid(*last_grid, half_resolution, shift));
       precomputation_grids_.push_back(
-          PrecomputeGrid(precomputation_grids_.back(), half_resolution, shift));
+          common::make_unique<CompactPrecomputationGrid>(*last_grid));
       last_width = next_width;
     }
   }
 
-  const PrecomputationGrid& Get(int depth) const {
-    return precomputation_grids_.at(depth);
+  const CompactPrecomputationGrid& Get(int depth) const {
+    return *precomputation_grids_.at(depth);
   }
 
   int max_depth() const { return precomputation_grids_.size() - 1; }
 
  private:
-  std::vector<PrecomputationGrid> precomputation_grids_;
+  std::vector<std::unique_ptr<CompactPrecomputationGrid>>
+      precomputation_grids_;
 };
 
 FastCorrelativeScanMatcher::FastCorrelativeScanMatcher(
@@ -113,20 +123,27 @@ bool FastCorrelativeScanMatcher::Match(
     const transform::Rigid3d& initial_pose_estimate,
     const sensor::PointCloud& coarse_point_cloud,
     const sensor::PointCloud& fine_point_cloud, const float min_score,
-    float* score, transform::Rigid3d* pose_estimate) const {
+    float* score, transform::Rigid3d* pose_estimate,
+    const int num_threads) const {
   CHECK_NOTNULL(score);
   CHECK_NOTNULL(pose_estimate);
+  CHECK_GE(num_threads, 1);
 
-  const std::vector<DiscreteScan> discrete_scans =
-      GenerateDiscreteScans(coarse_point_cloud, fine_point_cloud,
-                            initial_pose_estimate.cast<float>());
+  const std::vector<DiscreteScan> discrete_scans = GenerateDiscreteScans(
+      coarse_point_cloud, fine_point_cloud,
+      initial_pose_estimate.cast<float>(), num_threads);
 
   const std::vector<Candidate> lowest_resolution_candidates =
       ComputeLowestResolutionCandidates(discrete_scans);
 
   const Candidate best_candidate =
-      BranchAndBound(discrete_scans, lowest_resolution_candidates,
-                     precomputation_grid_stack_->max_depth(), min_score);
+      num_threads > 1
+          ? ParallelBranchAndBound(discrete_scans,
+                                   lowest_resolution_candidates, min_score,
+                                   num_threads)
+          : BranchAndBound(discrete_scans, lowest_resolution_candidates,
+                           precomputation_grid_stack_->max_depth(), min_score,
+                           0 /* root_index */, nullptr /* best_score_so_far */);
   if (best_candidate.score > min_score) {
     *score = best_candidate.score;
     *pose_estimate =
@@ -144,7 +161,8 @@ DiscreteScan FastCorrelativeScanMatcher::DiscretizeScan(
     const sensor::PointCloud& point_cloud,
     const transform::Rigid3f& pose) const {
   std::vector<std::vector<Eigen::Array3i>> cell_indices_per_depth;
-  const PrecomputationGrid& original_grid = precomputation_grid_stack_->Get(0);
+  const CompactPrecomputationGrid& original_grid =
+      precomputation_grid_stack_->Get(0);
   std::vector<Eigen::Array3i> full_resolution_cell_indices;
   for (const Eigen::Vector3f& point :
        sensor::TransformPointCloud(point_cloud, pose)) {
@@ -184,8 +202,7 @@ DiscreteScan FastCorrelativeScanMatcher::DiscretizeScan(
 std::vector<DiscreteScan> FastCorrelativeScanMatcher::GenerateDiscreteScans(
     const sensor::PointCloud& coarse_point_cloud,
     const sensor::PointCloud& fine_point_cloud,
-    const transform::Rigid3f& initial_pose) const {
-  std::vector<DiscreteScan> result;
+    const transform::Rigid3f& initial_pose, const int num_threads) const {
   // We set this value to something on the order of resolution to make sure that
   // the std::acos() below is defined.
   float max_scan_range = 3.f * resolution_;
@@ -208,6 +225,7 @@ std::vector<DiscreteScan> FastCorrelativeScanMatcher::GenerateDiscreteScans(
   }
   const std::vector<float> scores = rotational_scan_matcher_.Match(
       sensor::TransformPointCloud(fine_point_cloud, initial_pose), angles);
+  std::vector<transform::Rigid3f> poses;
   for (size_t i = 0; i != angles.size(); ++i) {
     if (scores[i] < options_.min_rotational_score()) {
       continue;
@@ -220,8 +238,13 @@ std::vector<DiscreteScan> FastCorrelativeScanMatcher::GenerateDiscreteScans(
         Eigen::Translation3f(initial_pose.translation()) *
         transform::AngleAxisVectorToRotationQuaternion(angle_axis) *
         Eigen::Quaternionf(initial_pose.rotation()));
-    result.push_back(DiscretizeScan(coarse_point_cloud, pose));
+    poses.push_back(pose);
   }
+  // Discretizing the rotated scans is independent for each rotation.
+  std::vector<DiscreteScan> result(poses.size());
+  common::ParallelFor(poses.size(), num_threads, [&](const int i) {
+    result[i] = DiscretizeScan(coarse_point_cloud, poses[i]);
+  });
   return result;
 }
 
@@ -260,6 +283,8 @@ void FastCorrelativeScanMatcher::ScoreCandidates(
     std::vector<Candidate>* const candidates) const {
   const int reduction_exponent =
       std::max(0, depth - options_.full_resolution_depth() + 1);
+  const CompactPrecomputationGrid& precomputation_grid =
+      precomputation_grid_stack_->Get(depth);
   for (Candidate& candidate : *candidates) {
     int sum = 0;
     const DiscreteScan& discrete_scan = discrete_scans[candidate.scan_index];
@@ -270,7 +295,7 @@ void FastCorrelativeScanMatcher::ScoreCandidates(
     for (const Eigen::Array3i& cell_index :
          discrete_scan.cell_indices_per_depth[depth]) {
       const Eigen::Array3i proposed_cell_index = cell_index + offset;
-      sum += precomputation_grid_stack_->Get(depth).value(proposed_cell_index);
+      sum += precomputation_grid.value(proposed_cell_index);
     }
     candidate.score = PrecomputationGrid::ToProbability(
         sum /
@@ -292,7 +317,8 @@ FastCorrelativeScanMatcher::ComputeLowestResolutionCandidates(
 Candidate FastCorrelativeScanMatcher::BranchAndBound(
     const std::vector<DiscreteScan>& discrete_scans,
     const std::vector<Candidate>& candidates, const int candidate_depth,
-    float min_score) const {
+    float min_score, const int root_index,
+    BestScoreSoFar* const best_score_so_far) const {
   if (candidate_depth == 0) {
     // Return the best candidate.
     return *candidates.begin();
@@ -301,7 +327,14 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
   Candidate best_high_resolution_candidate(0, Eigen::Array3i::Zero());
   best_high_resolution_candidate.score = min_score;
   for (const Candidate& candidate : candidates) {
-    if (candidate.score <= min_score) {
+    // The candidates are sorted, so none of the remaining ones can beat the
+    // best candidate found so far in this or, when searching in parallel, in
+    // any other subtree.
+    if (candidate.score <= best_high_resolution_candidate.score) {
+      break;
+    }
+    if (best_score_so_far != nullptr &&
+        candidate.score <= best_score_so_far->MinScore(root_index)) {
       break;
     }
     std::vector<Candidate> higher_resolution_candidates;
@@ -325,11 +358,58 @@ Candidate FastCorrelativeScanMatcher::BranchAndBound(
     }
     ScoreCandidates(candidate_depth - 1, discrete_scans,
                     &higher_resolution_candidates);
-    best_high_resolution_candidate =
-        std::max(best_high_resolution_candidate,
-                 BranchAndBound(discrete_scans, higher_resolution_candidates,
-                                candidate_depth - 1,
-                                best_high_resolution_candidate.score));
+    const Candidate best_child = BranchAndBound(
+        discrete_scans, higher_resolution_candidates, candidate_depth - 1,
+        best_high_resolution_candidate.score, root_index, best_score_so_far);
+    if (best_high_resolution_candidate < best_child) {
+      best_high_resolution_candidate = best_child;
+      if (best_score_so_far != nullptr) {
+        best_score_so_far->Update(best_child.score, root_index);
+      }
+    }
+  }
+  return best_high_resolution_candidate;
+}
+
+Candidate FastCorrelativeScanMatcher::ParallelBranchAndBound(
+    const std::vector<DiscreteScan>& discrete_scans,
+    const std::vector<Candidate>& lowest_resolution_candidates,
+    const float min_score, const int num_threads) const {
+  const int num_candidates = lowest_resolution_candidates.size();
+  BestScoreSoFar best_score_so_far(min_score);
+  // Subtrees are taken in order of decreasing score, so that good candidates
+  // are found early and tighten the bound for all threads.
+  std::vector<Candidate> best_candidates(lowest_resolution_candidates);
+  std::vector<char> found(num_candidates, false);
+  std::atomic<bool> done(false);
+  common::ParallelFor(num_candidates, num_threads, [&](const int i) {
+    if (done.load(std::memory_order_relaxed)) {
+      return;
+    }
+    const float root_min_score = best_score_so_far.MinScore(i);
+    if (lowest_resolution_candidates[i].score <= root_min_score) {
+      // All remaining candidates have lower or equal scores.
+      done.store(true, std::memory_order_relaxed);
+      return;
+    }
+    const Candidate best_candidate = BranchAndBound(
+        discrete_scans, {lowest_resolution_candidates[i]},
+        precomputation_grid_stack_->max_depth(), root_min_score, i,
+        &best_score_so_far);
+    if (best_candidate.score > root_min_score) {
+      best_candidates[i] = best_candidate;
+      found[i] = true;
+    }
+  });
+
+  // Same as the single-threaded search: the best score wins, and on ties the
+  // candidate which it would have found first.
+  Candidate best_high_resolution_candidate(0, Eigen::Array3i::Zero());
+  best_high_resolution_candidate.score = min_score;
+  for (int i = 0; i != num_candidates; ++i) {
+    if (found[i] && best_high_resolution_candidate < best_candidates[i]) {
+      best_high_resolution_candidate = best_candidates[i];
+    }
   }
   return best_high_resolution_candidate;
 }
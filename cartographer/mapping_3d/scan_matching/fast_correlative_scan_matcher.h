@@ -84,18 +84,25 @@ class FastCorrelativeScanMatcher {
   // is possible, true is returned, and 'score' and 'pose_estimate' are updated
   // with the result. 'fine_point_cloud' is used to compute the rotational scan
   // matcher score.
+  //
+  // The rotations are discretized and the branch and bound search runs on up
+  // to 'num_threads' threads, including the calling thread. The result does
+  // not depend on 'num_threads'.
   bool Match(const transform::Rigid3d& initial_pose_estimate,
              const sensor::PointCloud& coarse_point_cloud,
              const sensor::PointCloud& fine_point_cloud, float min_score,
-             float* score, transform::Rigid3d* pose_estimate) const;
+             float* score, transform::Rigid3d* pose_estimate,
+             int num_threads = 1) const;
 
  private:
+  using BestScoreSoFar = mapping_2d::scan_matching::BestScoreSoFar;
+
   DiscreteScan DiscretizeScan(const sensor::PointCloud& point_cloud,
                               const transform::Rigid3f& pose) const;
   std::vector<DiscreteScan> GenerateDiscreteScans(
       const sensor::PointCloud& coarse_point_cloud,
       const sensor::PointCloud& fine_point_cloud,
-      const transform::Rigid3f& initial_pose) const;
+      const transform::Rigid3f& initial_pose, int num_threads) const;
   std::vector<Candidate> GenerateLowestResolutionCandidates(
       int num_discrete_scans) const;
   void ScoreCandidates(int depth,
@@ -103,9 +110,21 @@ class FastCorrelativeScanMatcher {
                        std::vector<Candidate>* const candidates) const;
   std::vector<Candidate> ComputeLowestResolutionCandidates(
       const std::vector<DiscreteScan>& discrete_scans) const;
+  // Searches the subtrees of 'candidates' for the best candidate with a score
+  // above 'min_score'. When several searches run in parallel, 'root_index' is
+  // the index of the lowest resolution candidate the subtrees belong to, and
+  // all searches prune against 'best_score_so_far'. Otherwise it is nullptr.
   Candidate BranchAndBound(const std::vector<DiscreteScan>& discrete_scans,
                            const std::vector<Candidate>& candidates,
-                           int candidate_depth, float min_score) const;
+                           int candidate_depth, float min_score,
+                           int root_index,
+                           BestScoreSoFar* best_score_so_far) const;
+  // Searches the subtrees of all 'lowest_resolution_candidates' on up to
+  // 'num_threads' threads. Returns the same candidate as BranchAndBound().
+  Candidate ParallelBranchAndBound(
+      const std::vector<DiscreteScan>& discrete_scans,
+      const std::vector<Candidate>& lowest_resolution_candidates,
+      float min_score, int num_threads) const;
 
   const proto::FastCorrelativeScanMatcherOptions options_;
   const float resolution_;
@@ -108,6 +108,17 @@ TEST(FastCorrelativeScanMatcherTest, CorrectPose) {
                 transform::IsNearly(pose_estimate.cast<float>(), 0.05f))
         << "Actual: " << transform::ToProto(pose_estimate).DebugString()
         << "\nExpected: " << transform::ToProto(expected_pose).DebugString();
+
+    // Searching on several threads finds the same candidate.
+    transform::Rigid3d parallel_pose_estimate;
+    float parallel_score;
+    EXPECT_TRUE(fast_correlative_scan_matcher.Match(
+        transform::Rigid3d::Identity(), point_cloud, point_cloud, kMinScore,
+        &parallel_score, &parallel_pose_estimate, 4 /* num_threads */));
+    EXPECT_EQ(score, parallel_score);
+    EXPECT_EQ(pose_estimate.translation(), parallel_pose_estimate.translation());
+    EXPECT_EQ(pose_estimate.rotation().coeffs(),
+              parallel_pose_estimate.rotation().coeffs());
   }
 }
 
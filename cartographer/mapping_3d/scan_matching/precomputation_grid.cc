@@ -17,6 +17,8 @@
 #include "cartographer/mapping_3d/scan_matching/precomputation_grid.h"
 
 #include <algorithm>
+#include <type_traits>
+#include <utility>
 
 #include "Eigen/Core"
 #include "cartographer/common/math.h"
@@ -47,17 +49,73 @@ Eigen::Array3i CellIndexAtHalfResolution(const Eigen::Array3i& cell_index) {
 
 }  // namespace
 
+constexpr int CompactPrecomputationGrid::kBlockBits;
+constexpr int CompactPrecomputationGrid::kBlockMask;
+constexpr int CompactPrecomputationGrid::kCellsPerBlock;
+constexpr int CompactPrecomputationGrid::kKeyBits;
+constexpr uint64 CompactPrecomputationGrid::kEmptyKey;
+
+CompactPrecomputationGrid::CompactPrecomputationGrid(
+    const PrecomputationGrid& grid)
+    : resolution_(grid.resolution()), origin_(grid.origin()) {
+  // Blocks are copied from the innermost grids of the HybridGrid as a whole.
+  static_assert(
+      std::is_same<PrecomputationGrid::Leaf,
+                   FlatGrid<uint8, kBlockBits, LinearLayout>>::value,
+      "Blocks have to have the layout of the innermost grids.");
+  std::vector<std::pair<Eigen::Array3i, const PrecomputationGrid::Leaf*>>
+      blocks;
+  grid.ForEachBlock([&blocks](const Eigen::Array3i& base_index,
+                              const PrecomputationGrid::Leaf& leaf) {
+    if (leaf.CountOccupiedCells() != 0) {
+      blocks.emplace_back(base_index, &leaf);
+    }
+  });
+
+  // Keep the table at most half full, so that probe sequences stay short.
+  int num_slots = 2;
+  while (num_slots < 2 * static_cast<int>(blocks.size())) {
+    num_slots *= 2;
+  }
+  hash_shift_ = 64;
+  for (int i = num_slots; i != 1; i /= 2) {
+    --hash_shift_;
+  }
+  slot_mask_ = num_slots - 1;
+  slots_.assign(num_slots, Slot{kEmptyKey, 0});
+  values_.assign(blocks.size() * kCellsPerBlock, 0);
+
+  int offset = 0;
+  for (const auto& block : blocks) {
+    const Eigen::Array3i& base_index = block.first;
+    CHECK_EQ(base_index.x() & kBlockMask, 0);
+    CHECK_EQ(base_index.y() & kBlockMask, 0);
+    CHECK_EQ(base_index.z() & kBlockMask, 0);
+    const uint64 key = ToKey(Eigen::Array3i(base_index.x() >> kBlockBits,
+                                            base_index.y() >> kBlockBits,
+                                            base_index.z() >> kBlockBits));
+    uint64 slot = Hash(key);
+    while (slots_[slot].key != kEmptyKey) {
+      CHECK_NE(slots_[slot].key, key);
+      slot = (slot + 1) & slot_mask_;
+    }
+    slots_[slot] = Slot{key, offset};
+    std::copy_n(block.second->cells(), kCellsPerBlock, &values_[offset]);
+    offset += kCellsPerBlock;
+  }
+}
+
 PrecomputationGrid ConvertToPrecomputationGrid(const HybridGrid& hybrid_grid) {
   PrecomputationGrid result(hybrid_grid.resolution(), hybrid_grid.origin());
-  for (auto it = HybridGrid::Iterator(hybrid_grid); !it.Done(); it.Next()) {
+  hybrid_grid.ForEachOccupiedCell([&result](const Eigen::Array3i& index,
+                                            const uint16 value) {
     const int cell_value = common::RoundToInt(
-        (mapping::ValueToProbability(it.GetValue()) -
-         mapping::kMinProbability) *
+        (mapping::ValueToProbability(value) - mapping::kMinProbability) *
         (255.f / (mapping::kMaxProbability - mapping::kMinProbability)));
     CHECK_GE(cell_value, 0);
     CHECK_LE(cell_value, 255);
-    *result.mutable_value(it.GetCellIndex()) = cell_value;
-  }
+    *result.mutable_value(index) = cell_value;
+  });
   return result;
 }
 
@@ -65,19 +123,20 @@ PrecomputationGrid PrecomputeGrid(const PrecomputationGrid& grid,
                                   const bool half_resolution,
                                   const Eigen::Array3i& shift) {
   PrecomputationGrid result(grid.resolution(), grid.origin());
-  for (auto it = PrecomputationGrid::Iterator(grid); !it.Done(); it.Next()) {
+  grid.ForEachOccupiedCell([&](const Eigen::Array3i& index,
+                                const uint8 value) {
     for (int i = 0; i != 8; ++i) {
       // We use this value to update 8 values in the resulting grid, at
       // position (x - {0, 'shift'}, y - {0, 'shift'}, z - {0, 'shift'}).
       // If 'shift' is 2 ** (depth - 1), where depth 0 is the original grid,
       // this results in precomputation grids analogous to the 2D case.
       const Eigen::Array3i cell_index =
-          it.GetCellIndex() - shift * PrecomputationGrid::GetOctant(i);
+          index - shift * PrecomputationGrid::GetOctant(i);
       auto* const cell_value = result.mutable_value(
           half_resolution ? CellIndexAtHalfResolution(cell_index) : cell_index);
-      *cell_value = std::max(it.GetValue(), *cell_value);
+      *cell_value = std::max<uint8>(value, *cell_value);
     }
-  }
+  });
   return result;
 }
 
@@ -17,6 +17,10 @@
 #ifndef CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_PRECOMPUTATION_GRID_H_
 #define CARTOGRAPHER_MAPPING_3D_SCAN_MATCHING_PRECOMPUTATION_GRID_H_
 
+#include <vector>
+
+#include "Eigen/Core"
+#include "cartographer/common/port.h"
 #include "cartographer/mapping_3d/hybrid_grid.h"
 
 namespace cartographer {
@@ -36,6 +40,92 @@ class PrecomputationGrid : public HybridGridBase<uint8> {
   }
 };
 
+// A read-only copy of a finished PrecomputationGrid for fast lookups. The
+// non-empty 8x8x8 blocks of the original grid are stored one after another
+// in a single array, and an open addressing hash table maps the index of a
+// block to its position in that array. A lookup is a hash computation, on
+// average little more than one probe of the table, and a read in a contiguous
+// block, instead of following the pointers of the tree of the HybridGrid.
+class CompactPrecomputationGrid {
+ public:
+  explicit CompactPrecomputationGrid(const PrecomputationGrid& grid);
+
+  CompactPrecomputationGrid(const CompactPrecomputationGrid&) = delete;
+  CompactPrecomputationGrid& operator=(const CompactPrecomputationGrid&) =
+      delete;
+
+  float resolution() const { return resolution_; }
+  Eigen::Vector3f origin() const { return origin_; }
+
+  // Same as PrecomputationGrid::GetCellIndex().
+  Eigen::Array3i GetCellIndex(const Eigen::Vector3f& point) const {
+    const Eigen::Array3f index = (point - origin_).array() / resolution_;
+    return Eigen::Array3i(common::RoundToInt(index.x()),
+                          common::RoundToInt(index.y()),
+                          common::RoundToInt(index.z()));
+  }
+
+  // Returns the same value as PrecomputationGrid::value() for 'index', which
+  // has to be within the index range of a HybridGrid.
+  uint8 value(const Eigen::Array3i& index) const {
+    const uint64 key = ToKey(Eigen::Array3i(
+        index.x() >> kBlockBits, index.y() >> kBlockBits,
+        index.z() >> kBlockBits));
+    for (uint64 slot = Hash(key);; slot = (slot + 1) & slot_mask_) {
+      const Slot& candidate = slots_[slot];
+      if (candidate.key == key) {
+        return values_[candidate.offset +
+                       ((((index.z() & kBlockMask) << kBlockBits) +
+                         (index.y() & kBlockMask))
+                        << kBlockBits) +
+                       (index.x() & kBlockMask)];
+      }
+      if (candidate.key == kEmptyKey) {
+        return 0;
+      }
+    }
+  }
+
+  // Returns the number of bytes used for the blocks and the hash table.
+  size_t num_bytes() const {
+    return values_.size() * sizeof(uint8) + slots_.size() * sizeof(Slot);
+  }
+
+ private:
+  static constexpr int kBlockBits = 3;
+  static constexpr int kBlockMask = (1 << kBlockBits) - 1;
+  static constexpr int kCellsPerBlock = 1 << (3 * kBlockBits);
+  // Each block index component is stored with this many bits in a key.
+  static constexpr int kKeyBits = 21;
+  // Keys only use the lower 3 * kKeyBits bits, so no block has this key.
+  static constexpr uint64 kEmptyKey = ~uint64{0};
+
+  struct Slot {
+    uint64 key;
+    // Position of the first cell of the block in 'values_'.
+    int offset;
+  };
+
+  static uint64 ToKey(const Eigen::Array3i& block_index) {
+    constexpr uint64 kMask = (uint64{1} << kKeyBits) - 1;
+    return (static_cast<uint64>(block_index.x()) & kMask) |
+           ((static_cast<uint64>(block_index.y()) & kMask) << kKeyBits) |
+           ((static_cast<uint64>(block_index.z()) & kMask) << (2 * kKeyBits));
+  }
+
+  uint64 Hash(const uint64 key) const {
+    // Fibonacci hashing: the high bits of the product depend on all key bits.
+    return (key * 0x9e3779b97f4a7c15ull) >> hash_shift_;
+  }
+
+  float resolution_;
+  Eigen::Vector3f origin_;
+  int hash_shift_;
+  uint64 slot_mask_;
+  std::vector<Slot> slots_;
+  std::vector<uint8> values_;
+};
+
 // Converts a HybridGrid to a PrecomputationGrid representing the same data,
 // but only using 8 bit instead of 2 x 16 bit.
 PrecomputationGrid ConvertToPrecomputationGrid(const HybridGrid& hybrid_grid);
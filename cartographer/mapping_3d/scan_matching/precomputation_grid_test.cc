@@ -76,6 +76,54 @@ TEST(PrecomputedGridGeneratorTest, TestAgainstNaiveAlgorithm) {
   }
 }
 
+TEST(PrecomputedGridGeneratorTest, CompactGridHasSameValues) {
+  HybridGrid hybrid_grid(0.1f, Eigen::Vector3f(1.f, -2.f, 0.5f));
+
+  std::mt19937 rng(4711);
+  std::uniform_int_distribution<int> coordinate_distribution(-100, 99);
+  std::uniform_real_distribution<float> value_distribution(
+      mapping::kMinProbability, mapping::kMaxProbability);
+  for (int i = 0; i < 1000; ++i) {
+    const auto x = coordinate_distribution(rng);
+    const auto y = coordinate_distribution(rng);
+    const auto z = coordinate_distribution(rng);
+    hybrid_grid.SetProbability(Eigen::Array3i(x, y, z),
+                               value_distribution(rng));
+  }
+
+  const PrecomputationGrid precomputation_grid = PrecomputeGrid(
+      ConvertToPrecomputationGrid(hybrid_grid), false, Eigen::Array3i(2, 2, 1));
+  const CompactPrecomputationGrid compact_grid(precomputation_grid);
+  EXPECT_EQ(precomputation_grid.resolution(), compact_grid.resolution());
+  EXPECT_EQ(precomputation_grid.origin(), compact_grid.origin());
+  const Eigen::Vector3f point(-3.14f, 2.71f, 0.77f);
+  EXPECT_TRUE((precomputation_grid.GetCellIndex(point) ==
+               compact_grid.GetCellIndex(point))
+                  .all());
+
+  // Look at every occupied cell and at indices which are mostly empty,
+  // including ones far outside of the occupied blocks.
+  int num_occupied_cells = 0;
+  precomputation_grid.ForEachOccupiedCell(
+      [&](const Eigen::Array3i& index, const uint8 value) {
+        EXPECT_EQ(value, compact_grid.value(index));
+        ++num_occupied_cells;
+      });
+  EXPECT_LT(1000, num_occupied_cells);
+  std::uniform_int_distribution<int> wide_coordinate_distribution(-3000, 3000);
+  for (int i = 0; i < 10000; ++i) {
+    for (const Eigen::Array3i& index :
+         {Eigen::Array3i(coordinate_distribution(rng),
+                         coordinate_distribution(rng),
+                         coordinate_distribution(rng)),
+          Eigen::Array3i(wide_coordinate_distribution(rng),
+                         wide_coordinate_distribution(rng),
+                         wide_coordinate_distribution(rng))}) {
+      EXPECT_EQ(precomputation_grid.value(index), compact_grid.value(index));
+    }
+  }
+}
+
 }  // namespace
 }  // namespace scan_matching
 }  // namespace mapping_3d
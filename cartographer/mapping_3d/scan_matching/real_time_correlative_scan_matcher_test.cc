@@ -56,6 +56,9 @@ class RealTimeCorrelativeScanMatcherTest : public ::testing::Test {
           angular_search_window = math.rad(1.),
           translation_delta_cost_weight = 1e-1,
           rotation_delta_cost_weight = 1.,
+          approximate_pruning = false,
+          coarse_search_cell_size = 1,
+          num_coarse_candidates_to_refine = 8,
         })text");
     real_time_correlative_scan_matcher_.reset(
         new RealTimeCorrelativeScanMatcher(
@@ -223,6 +223,8 @@ void ConstraintBuilder::ComputeConstraint(
 
   CHECK(!match_full_submap) << "match_full_submap not supported for 3D.";
 
+  // Matches run on the thread pool, one work item per scan and submap, so
+  // each match itself stays on a single thread.
   if (!submap_scan_matcher->fast_correlative_scan_matcher->Match(
           initial_pose, filtered_point_cloud, point_cloud, options_.min_score(),
           &score, &pose_estimate)) {
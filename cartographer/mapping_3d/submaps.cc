@@ -347,16 +347,16 @@ void Submaps::ExtractVoxelData(const HybridGrid& hybrid_grid,
   const float resolution_inverse = 1. / hybrid_grid.resolution();
 
   constexpr double kXrayObstructedCellProbabilityLimit = 0.501;
-  for (auto it = HybridGrid::Iterator(hybrid_grid); !it.Done(); it.Next()) {
-    const uint16 probability_value = it.GetValue();
+  hybrid_grid.ForEachOccupiedCell([&](const Eigen::Array3i& index,
+                                       const uint16 probability_value) {
     const float probability = mapping::ValueToProbability(probability_value);
     if (probability < kXrayObstructedCellProbabilityLimit) {
       // We ignore non-obstructed cells.
-      continue;
+      return;
     }
 
     const Eigen::Vector3f cell_center_local =
-        hybrid_grid.GetCenterOfCell(it.GetCellIndex());
+        hybrid_grid.GetCenterOfCell(index);
     const Eigen::Vector3f cell_center_global = transform * cell_center_local;
     const Eigen::Array4i voxel_index_and_probability(
         common::RoundToInt(cell_center_global.x() * resolution_inverse),
@@ -368,7 +368,7 @@ void Submaps::ExtractVoxelData(const HybridGrid& hybrid_grid,
     const Eigen::Array2i pixel_index = voxel_index_and_probability.head<2>();
     *min_index = min_index->cwiseMin(pixel_index);
     *max_index = max_index->cwiseMax(pixel_index);
-  }
+  });
 }
 
 void Submaps::ComputePixelValues(const int width, const int height) {
@@ -26,6 +26,8 @@ SPARSE_POSE_GRAPH = {
     global_localization_min_score = 0.6,
     lower_covariance_eigenvalue_bound = 1e-11,
     log_matches = false,
+    precomputation_grid_cache_memory_in_mb = 1024,
+    precomputation_grid_directory = "",
     fast_correlative_scan_matcher = {
       linear_search_window = 7.,
       angular_search_window = math.rad(30.),
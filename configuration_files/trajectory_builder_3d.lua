@@ -82,6 +82,9 @@ TRAJECTORY_BUILDER_3D = {
       angular_search_window = math.rad(1.),
       translation_delta_cost_weight = 1e-1,
       rotation_delta_cost_weight = 1e-1,
+      approximate_pruning = false,
+      coarse_search_cell_size = 1,
+      num_coarse_candidates_to_refine = 8,
     },
   },
 